@@ -0,0 +1,81 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // cpu_set_t, pthread_attr_setaffinity_np()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "affinity.h"
+
+int cpu_list_parse(struct cpu_list *l, const char *s) {
+    l->count = 0;
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (end == s || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpu >= AFFINITY_MAX_CPUS || l->count == AFFINITY_MAX_CPUS) {
+                return -1;
+            }
+            l->cpus[l->count++] = (int)cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        s = end;
+    }
+    return l->count > 0 ? 0 : -1;
+}
+
+int cpu_list_pick(const struct cpu_list *l, int index) {
+    if (!l || l->count == 0) {
+        return -1;
+    }
+    return l->cpus[index % l->count];
+}
+
+int thread_create_on(pthread_t *thread, int cpu, void *(*fn)(void *), void *arg) {
+    if (cpu < 0) {
+        return pthread_create(thread, NULL, fn, arg);
+    }
+#if defined(__linux__)
+    // Pinned from the first instruction, not after a migration
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    if (rc == 0) {
+        rc = pthread_create(thread, &attr, fn, arg);
+    }
+    pthread_attr_destroy(&attr);
+    if (rc == EINVAL) {
+        // CPU not in our allowed set (offline, cgroup, container)
+        fprintf(stderr, "CPU %d is not available, thread left unpinned\n", cpu);
+        rc = pthread_create(thread, NULL, fn, arg);
+    }
+    return rc;
+#else
+    static atomic_int warned = 0;
+    if (!atomic_exchange(&warned, 1)) {
+        fprintf(stderr, "CPU pinning is not supported here, threads left unpinned\n");
+    }
+    return pthread_create(thread, NULL, fn, arg);
+#endif
+}
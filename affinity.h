@@ -0,0 +1,30 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+/*
+ * Thread placement shared by producer and consumer: parse a CPU list
+ * such as "0-3,8,10-11" and start threads already pinned to one CPU of
+ * it, so a thread's first memory touches happen on its own NUMA node.
+ * Pinning uses pthread affinity attributes on Linux; elsewhere threads
+ * start unpinned after a one-time warning.
+ */
+
+#define AFFINITY_MAX_CPUS 1024
+
+struct cpu_list {
+    int count;
+    int cpus[AFFINITY_MAX_CPUS];
+};
+
+// Parse a CPU list; returns 0, or -1 if it is malformed or empty
+int cpu_list_parse(struct cpu_list *l, const char *s);
+
+// CPU for the index-th thread (CPUs are reused round-robin); -1 if l is NULL or empty
+int cpu_list_pick(const struct cpu_list *l, int index);
+
+// pthread_create(), pinned to cpu unless it is -1
+int thread_create_on(pthread_t *thread, int cpu, void *(*fn)(void *), void *arg);
+
+#endif // AFFINITY_H
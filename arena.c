@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "arena.h"
+
+#define MPOL_LOCAL_MODE 4   // <linux/mempolicy.h> MPOL_LOCAL, without libnuma
+
+// Bytes mapped per chunk when chunks are node-local
+static size_t chunk_map_len(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (sizeof(struct arena_chunk) + page - 1) / page * page;
+}
+
+static struct arena_chunk *chunk_alloc(const struct arena *a) {
+    if (!a->node_local) {
+        return aligned_alloc(ARENA_CACHELINE, sizeof(struct arena_chunk));
+    }
+    // Fresh pages, so nothing was touched on another node before us
+    void *p = mmap(NULL, chunk_map_len(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef __linux__
+    // Best effort: without it (no NUMA support) first touch still places them
+    syscall(SYS_mbind, p, chunk_map_len(), MPOL_LOCAL_MODE, NULL, 0UL, 0U);
+#endif
+    return p;
+}
+
+static void chunk_free(const struct arena *a, struct arena_chunk *c) {
+    if (!c) {
+        return;
+    }
+    if (a->node_local) {
+        munmap(c, chunk_map_len());
+    } else {
+        free(c);
+    }
+}
+
+int arena_init(struct arena *a, uint64_t limit) {
+    // calloc'd so untouched directory pages stay unbacked
+    a->chunks = calloc(ARENA_MAX_CHUNKS, sizeof(*a->chunks));
+    if (!a->chunks) {
+        return -1;
+    }
+    a->limit = limit == 0 || limit > ARENA_MAX_VALUES ? ARENA_MAX_VALUES : limit;
+    a->node_local = 0;
+    a->ordered = 0;
+    a->on_full = NULL;
+    a->on_full_ctx = NULL;
+    atomic_init(&a->next_chunk, 0);
+    atomic_init(&a->reserved, 0);
+    atomic_init(&a->in_order_chunks, 0);
+    atomic_init(&a->end, 0);
+    atomic_init(&a->cas_lost, 0);
+    return 0;
+}
+
+void arena_destroy(struct arena *a) {
+    size_t n = atomic_load(&a->next_chunk);
+    if (n > ARENA_MAX_CHUNKS) {
+        n = ARENA_MAX_CHUNKS;
+    }
+    for (size_t i = 0; i < n; i++) {
+        chunk_free(a, atomic_load(&a->chunks[i]));
+    }
+    free(a->chunks);
+    a->chunks = NULL;
+}
+
+void arena_set_local(struct arena *a, int on) {
+    a->node_local = on;
+}
+
+void arena_set_ordered(struct arena *a, int on) {
+    a->ordered = on;
+}
+
+void arena_on_full(struct arena *a, arena_full_fn fn, void *ctx) {
+    a->on_full = fn;
+    a->on_full_ctx = ctx;
+}
+
+uint32_t arena_reserve(struct arena *a, uint32_t count) {
+    uint64_t start = atomic_fetch_add_explicit(&a->reserved, count, memory_order_relaxed);
+    if (start >= a->limit) {
+        return 0;
+    }
+    return a->limit - start < count ? (uint32_t)(a->limit - start) : count;
+}
+
+void arena_writer_init(struct arena_writer *w, struct arena *a) {
+    w->arena = a;
+    w->chunk = NULL;
+    w->fill = 0;
+}
+
+static void publish(struct arena_writer *w) {
+    if (w->chunk) {
+        atomic_store_explicit(&w->chunk->used, w->fill, memory_order_release);
+    }
+}
+
+// Publish a chunk as soon as it fills, rather than when the writer moves on
+static void filled(struct arena_writer *w) {
+    if (w->fill == ARENA_CHUNK_VALUES) {
+        publish(w);
+        if (w->arena->on_full) {
+            w->arena->on_full(w->arena->on_full_ctx, w->slot, w->chunk->values,
+                              ARENA_CHUNK_VALUES);
+        }
+    }
+}
+
+// Take the next chunk slot for this writer; the chunk is private until published
+static int claim_chunk(struct arena_writer *w) {
+    struct arena *a = w->arena;
+    size_t slot = atomic_fetch_add_explicit(&a->next_chunk, 1, memory_order_relaxed);
+    if (slot >= ARENA_MAX_CHUNKS) {
+        return -1;
+    }
+    struct arena_chunk *c = chunk_alloc(a);
+    if (!c) {
+        return -1;
+    }
+    atomic_init(&c->used, 0);
+    atomic_store_explicit(&a->chunks[slot], c, memory_order_release);
+    w->chunk = c;
+    w->slot = slot;
+    w->fill = 0;
+    return 0;
+}
+
+int arena_append(struct arena_writer *w, const value_t *values, uint32_t count) {
+    while (count > 0) {
+        if (!w->chunk || w->fill == ARENA_CHUNK_VALUES) {
+            publish(w);
+            if (claim_chunk(w) < 0) {
+                return -1;
+            }
+        }
+        uint32_t room = ARENA_CHUNK_VALUES - w->fill;
+        uint32_t n = count < room ? count : room;
+        memcpy(&w->chunk->values[w->fill], values, n * sizeof(*values));
+        w->fill += n;
+        filled(w);
+        values += n;
+        count -= n;
+    }
+    return 0;
+}
+
+value_t *arena_window(struct arena_writer *w, uint32_t max, uint32_t *room) {
+    if (!w->chunk || w->fill == ARENA_CHUNK_VALUES) {
+        publish(w);
+        if (claim_chunk(w) < 0) {
+            return NULL;
+        }
+    }
+    uint32_t left = ARENA_CHUNK_VALUES - w->fill;
+    *room = max < left ? max : left;
+    return &w->chunk->values[w->fill];
+}
+
+void arena_commit(struct arena_writer *w, uint32_t count) {
+    w->fill += count;
+    filled(w);
+}
+
+void arena_writer_finish(struct arena_writer *w) {
+    publish(w);
+}
+
+uint32_t arena_reserve_at(struct arena *a, uint64_t pos, uint32_t count) {
+    uint32_t n = pos >= a->limit ? 0 : a->limit - pos < count ? (uint32_t)(a->limit - pos) : count;
+    atomic_fetch_add_explicit(&a->reserved, n, memory_order_relaxed);
+    return n;
+}
+
+static void cas_lost(struct arena *a, uint64_t n) {
+    if (n > 0) {
+        atomic_fetch_add_explicit(&a->cas_lost, n, memory_order_relaxed);
+    }
+}
+
+// Raise *v to at least to; lock-free. Returns the CASes lost on the way
+static uint64_t atomic_max_size(atomic_size_t *v, size_t to) {
+    uint64_t lost = 0;
+    size_t cur = atomic_load_explicit(v, memory_order_relaxed);
+    while (cur < to && !atomic_compare_exchange_weak(v, &cur, to)) {
+        lost++;
+    }
+    return lost;
+}
+
+static uint64_t atomic_max_u64(_Atomic uint64_t *v, uint64_t to) {
+    uint64_t lost = 0;
+    uint64_t cur = atomic_load_explicit(v, memory_order_relaxed);
+    while (cur < to && !atomic_compare_exchange_weak(v, &cur, to)) {
+        lost++;
+    }
+    return lost;
+}
+
+// The chunk holding position pos, installed by whichever writer gets
+// there first; NULL if it can't be allocated
+static struct arena_chunk *chunk_at(struct arena *a, uint64_t pos) {
+    size_t slot = (size_t)(pos / ARENA_CHUNK_VALUES);
+    struct arena_chunk *c = atomic_load_explicit(&a->chunks[slot], memory_order_acquire);
+    if (c) {
+        return c;
+    }
+    struct arena_chunk *fresh = chunk_alloc(a);
+    if (!fresh) {
+        return NULL;
+    }
+    atomic_init(&fresh->used, 0);
+    if (atomic_compare_exchange_strong(&a->chunks[slot], &c, fresh)) {
+        cas_lost(a, atomic_max_size(&a->next_chunk, slot + 1));
+        return fresh;
+    }
+    chunk_free(a, fresh);   // Another writer installed it first; c is theirs
+    cas_lost(a, 1);
+    return c;
+}
+
+value_t *arena_at(struct arena *a, uint64_t pos, uint32_t max, uint32_t *room) {
+    struct arena_chunk *c = chunk_at(a, pos);
+    if (!c) {
+        return NULL;
+    }
+    uint32_t off = (uint32_t)(pos % ARENA_CHUNK_VALUES);
+    uint32_t left = ARENA_CHUNK_VALUES - off;
+    *room = max < left ? max : left;
+    return &c->values[off];
+}
+
+void arena_filled(struct arena *a, uint64_t pos, uint32_t count) {
+    size_t slot = (size_t)(pos / ARENA_CHUNK_VALUES);
+    struct arena_chunk *c = atomic_load_explicit(&a->chunks[slot], memory_order_relaxed);
+    cas_lost(a, atomic_max_u64(&a->end, pos + count));
+    unsigned used = atomic_fetch_add_explicit(&c->used, count, memory_order_acq_rel) + count;
+    if (used < ARENA_CHUNK_VALUES) {
+        return;
+    }
+    if (a->on_full) {
+        a->on_full(a->on_full_ctx, slot, c->values, ARENA_CHUNK_VALUES);
+    }
+    // A chunk just filled up: move the watermark past every full chunk
+    size_t w = atomic_load_explicit(&a->in_order_chunks, memory_order_acquire);
+    while (w < ARENA_MAX_CHUNKS) {
+        c = atomic_load_explicit(&a->chunks[w], memory_order_acquire);
+        if (!c || atomic_load_explicit(&c->used, memory_order_acquire) < ARENA_CHUNK_VALUES) {
+            break;
+        }
+        // On failure w is reloaded, whoever moved it looks further
+        if (atomic_compare_exchange_weak(&a->in_order_chunks, &w, w + 1)) {
+            w++;
+        } else {
+            cas_lost(a, 1);
+        }
+    }
+}
+
+int arena_place(struct arena *a, uint64_t pos, const value_t *values, uint32_t count) {
+    while (count > 0) {
+        uint32_t n;
+        value_t *dst = arena_at(a, pos, count, &n);
+        if (!dst) {
+            return -1;
+        }
+        memcpy(dst, values, n * sizeof(*values));
+        arena_filled(a, pos, n);
+        pos += n;
+        values += n;
+        count -= n;
+    }
+    return 0;
+}
+
+uint64_t arena_in_order(const struct arena *a) {
+    size_t w = atomic_load_explicit(&a->in_order_chunks, memory_order_acquire);
+    uint64_t base = (uint64_t)w * ARENA_CHUNK_VALUES;
+    uint64_t end = arena_end(a);
+    if (w >= ARENA_MAX_CHUNKS || end <= base || end - base > ARENA_CHUNK_VALUES) {
+        return base;
+    }
+    // The last chunk is whole if what it holds reaches end
+    struct arena_chunk *c = atomic_load_explicit(&a->chunks[w], memory_order_acquire);
+    return c && atomic_load_explicit(&c->used, memory_order_acquire) == end - base ? end : base;
+}
+
+uint64_t arena_count(const struct arena *a) {
+    uint64_t total = 0;
+    struct arena_iter it;
+    const value_t *values;
+    size_t n;
+    arena_iter_init(&it, a);
+    while ((n = arena_iter_next(&it, &values)) > 0) {
+        total += n;
+    }
+    return total;
+}
+
+size_t arena_bytes(const struct arena *a) {
+    size_t n = atomic_load_explicit(&a->next_chunk, memory_order_acquire);
+    if (n > ARENA_MAX_CHUNKS) {
+        n = ARENA_MAX_CHUNKS;
+    }
+    // Claimed slots whose chunk is not stored yet, and ordered slots no
+    // writer reached, hold nothing
+    size_t held = 0;
+    for (size_t i = 0; i < n; i++) {
+        held += atomic_load_explicit(&a->chunks[i], memory_order_relaxed) != NULL;
+    }
+    return held * (a->node_local ? chunk_map_len() : sizeof(struct arena_chunk));
+}
+
+void arena_iter_init(struct arena_iter *it, const struct arena *a) {
+    it->arena = a;
+    it->next = 0;
+}
+
+size_t arena_iter_next(struct arena_iter *it, const value_t **values) {
+    const struct arena *a = it->arena;
+    size_t claimed = atomic_load_explicit(&a->next_chunk, memory_order_acquire);
+    if (claimed > ARENA_MAX_CHUNKS) {
+        claimed = ARENA_MAX_CHUNKS;
+    }
+    while (it->next < claimed) {
+        struct arena_chunk *c = atomic_load_explicit(&a->chunks[it->next++], memory_order_acquire);
+        if (!c) {
+            continue;   // Slot claimed but not installed yet
+        }
+        unsigned used = atomic_load_explicit(&c->used, memory_order_acquire);
+        if (used > 0) {
+            *values = c->values;
+            return used;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "value.h"
+
+/*
+ * Chunked arena for the consumer's received values.
+ *
+ * Storage is a directory of fixed-size, cache-line-aligned chunks. Each
+ * inserting thread claims whole chunks for itself (one fetch-add on the
+ * chunk counter per chunk) and fills them privately through an
+ * arena_writer, so no two threads ever write the same cache line and
+ * growth never copies data. The global value limit is enforced with one
+ * atomic reservation per batch.
+ *
+ * Reading back: an arena_iter walks the chunks in the order they were
+ * claimed and yields each chunk's filled prefix, i.e. insertion order
+ * per chunk. A chunk becomes visible to readers once its writer moves
+ * on or calls arena_writer_finish().
+ *
+ * Ordered mode (arena_set_ordered()): values are stored at their
+ * sequence number instead, so the arena reads back in the producer's
+ * order however frames interleave. The directory is then indexed by
+ * position: whoever first writes into a chunk allocates and installs it
+ * with one CAS (a loser frees its copy), and chunk fill counts are
+ * atomic adds. That makes the directory a lock-free reorder window:
+ * chunks between the in-order watermark and the furthest write fill in
+ * any order, and the watermark moves past each chunk that is full, one
+ * CAS per chunk. Everything is read back in order once the writers are
+ * done.
+ *
+ * Writers that lose one of these CASes to another count it (cas_lost),
+ * on the losing path only, so contention between writers stays
+ * visible without costing the common case anything.
+ *
+ * Full chunks can be handed on as they complete (arena_on_full()), so
+ * a downstream stage works on the data while the rest still arrives.
+ *
+ * NUMA: with arena_set_local() every chunk is mapped fresh and bound to
+ * the node of the thread that first writes it (MPOL_LOCAL on Linux), so
+ * a pinned writer fills memory on its own node regardless of the
+ * process's memory policy. Default chunks come from the allocator.
+ */
+
+#define ARENA_CACHELINE 64
+#define ARENA_CHUNK_VALUES 16384                 // values per chunk, 64 KB at WIDTH=32
+#define ARENA_MAX_CHUNKS ((size_t)1 << 20)       // 16G values in total
+#define ARENA_MAX_VALUES ((uint64_t)ARENA_CHUNK_VALUES * ARENA_MAX_CHUNKS)
+
+struct arena_chunk {
+    _Alignas(ARENA_CACHELINE) atomic_uint used;  // published fill count
+    _Alignas(ARENA_CACHELINE) value_t values[ARENA_CHUNK_VALUES];
+};
+
+// Called once per chunk as it fills up, from the thread that filled it
+typedef void (*arena_full_fn)(void *ctx, size_t slot, const value_t *values, uint32_t count);
+
+struct arena {
+    _Atomic(struct arena_chunk *) *chunks;       // claim order
+    uint64_t limit;                              // values accepted at most
+    int node_local;                              // chunks mmap'd node-local
+    int ordered;                                 // values stored at their position
+    arena_full_fn on_full;
+    void *on_full_ctx;
+    _Alignas(ARENA_CACHELINE) atomic_size_t next_chunk;
+    _Alignas(ARENA_CACHELINE) _Atomic uint64_t reserved;
+    _Alignas(ARENA_CACHELINE) atomic_size_t in_order_chunks;  // ordered: full chunks from 0
+    _Atomic uint64_t end;                        // ordered: past the furthest value written
+    _Atomic uint64_t cas_lost;                   // ordered: CASes another writer won
+};
+
+// Per-thread fill cursor; keep one per inserting thread
+struct arena_writer {
+    struct arena *arena;
+    struct arena_chunk *chunk;   // chunk being filled, NULL before first use
+    size_t slot;                 // its directory index
+    uint32_t fill;
+};
+
+struct arena_iter {
+    const struct arena *arena;
+    size_t next;
+};
+
+// limit 0 or above ARENA_MAX_VALUES means ARENA_MAX_VALUES
+int arena_init(struct arena *a, uint64_t limit);
+void arena_destroy(struct arena *a);
+
+// Place chunks on the writing thread's NUMA node; call before any insert
+void arena_set_local(struct arena *a, int on);
+
+// Store values at their position (see above); call before any insert
+void arena_set_ordered(struct arena *a, int on);
+
+/*
+ * Call fn(ctx, slot, values, ARENA_CHUNK_VALUES) for every chunk the
+ * moment it is full: slot is its directory index, which in ordered mode
+ * is its position / ARENA_CHUNK_VALUES. Chunks left partly filled are
+ * not reported; arena_iter finds them. Call before any insert.
+ */
+void arena_on_full(struct arena *a, arena_full_fn fn, void *ctx);
+
+/*
+ * Reserve room for up to count values against the limit. Returns how
+ * many of them may be appended (0 once the arena is full).
+ */
+uint32_t arena_reserve(struct arena *a, uint32_t count);
+
+static inline int arena_full(struct arena *a) {
+    return atomic_load_explicit(&a->reserved, memory_order_relaxed) >= a->limit;
+}
+
+// Values that may still be reserved
+static inline uint64_t arena_room(struct arena *a) {
+    uint64_t reserved = atomic_load_explicit(&a->reserved, memory_order_relaxed);
+    return reserved < a->limit ? a->limit - reserved : 0;
+}
+
+void arena_writer_init(struct arena_writer *w, struct arena *a);
+
+// Append count reserved values; returns 0, or -1 if a chunk can't be allocated
+int arena_append(struct arena_writer *w, const value_t *values, uint32_t count);
+
+/*
+ * Fill in place instead of copying: return room for up to max values at
+ * the end of the writer's chunk (claiming a fresh chunk when it is full)
+ * and set *room to how many fit, at least one. The caller writes there
+ * and then calls arena_commit() with the number actually stored, which
+ * must have been reserved. Returns NULL if a chunk can't be allocated.
+ */
+value_t *arena_window(struct arena_writer *w, uint32_t max, uint32_t *room);
+void arena_commit(struct arena_writer *w, uint32_t count);
+
+// Publish the partially filled chunk; call once the thread stops inserting
+void arena_writer_finish(struct arena_writer *w);
+
+/*
+ * Ordered mode. arena_reserve_at() is arena_reserve() for the count
+ * values at positions pos..: it returns how many of them lie below the
+ * limit. arena_place() stores reserved values at pos and returns 0, or
+ * -1 if a chunk can't be allocated. To fill in place instead,
+ * arena_at() returns room for up to max values at pos, within one
+ * chunk, with *room set to how many fit (NULL if a chunk can't be
+ * allocated), and arena_filled() marks count of them stored.
+ * Any number of threads may write, each position once.
+ */
+uint32_t arena_reserve_at(struct arena *a, uint64_t pos, uint32_t count);
+int arena_place(struct arena *a, uint64_t pos, const value_t *values, uint32_t count);
+value_t *arena_at(struct arena *a, uint64_t pos, uint32_t max, uint32_t *room);
+void arena_filled(struct arena *a, uint64_t pos, uint32_t count);
+
+// Ordered mode: how many values from position 0 on are stored with no
+// gap, and one past the furthest position written
+uint64_t arena_in_order(const struct arena *a);
+static inline uint64_t arena_end(const struct arena *a) {
+    return atomic_load_explicit(&a->end, memory_order_acquire);
+}
+
+// Values stored in published chunks
+uint64_t arena_count(const struct arena *a);
+
+/*
+ * For observers on other threads while writers run (the consumer's
+ * --metrics); all only read atomics. arena_taken() is how many values
+ * were reserved, i.e. taken in, including those a writer is still
+ * copying; arena_bytes() the memory of the chunks allocated so far,
+ * walking the directory, and arena_cas_lost() the CASes lost to
+ * another writer.
+ */
+static inline uint64_t arena_taken(const struct arena *a) {
+    uint64_t reserved = atomic_load_explicit(&a->reserved, memory_order_relaxed);
+    return reserved < a->limit ? reserved : a->limit;
+}
+size_t arena_bytes(const struct arena *a);
+static inline uint64_t arena_cas_lost(const struct arena *a) {
+    return atomic_load_explicit(&a->cas_lost, memory_order_relaxed);
+}
+
+void arena_iter_init(struct arena_iter *it, const struct arena *a);
+
+/*
+ * Point *values at the next non-empty chunk's data and return its length,
+ * or return 0 after the last chunk.
+ */
+size_t arena_iter_next(struct arena_iter *it, const value_t **values);
+
+// Directory index of the chunk arena_iter_next() yielded last
+static inline size_t arena_iter_slot(const struct arena_iter *it) {
+    return it->next - 1;
+}
+
+#endif // ARENA_H
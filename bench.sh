@@ -0,0 +1,164 @@
+#!/bin/bash
+
+# End-to-end benchmark: runs ./producer (which starts ./consumer) over
+# generated inputs for every combination of the swept parameters and
+# prints one result row per run as CSV or JSON.
+#
+# Throughput is wall-clock time of the whole run, consumer startup included.
+# Latency is per element, from the moment a producer thread takes a batch to
+# its insert on the consumer (--stamp, see protocol.h); -b 0 has no frames
+# and so no latency.
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -n SIZES       input sizes in elements, e.g. "1e3 1e6 1e9" (default "1e4 1e6")
+  -t THREADS     producer thread counts (default "1 2 4")
+  -b BATCHES     batch sizes (default "1 64 1024")
+  -T TRANSPORTS  transports (default "tcp unix shm")
+  -i IOS         I/O engines (default "blocking")
+  -c CODECS      value codecs: raw varint delta pack svb (default "raw")
+  -m MODES       input modes: pipeline shared mmap binary (default "pipeline")
+  -r REPEAT      runs per combination (default 1)
+  -f FORMAT      csv or json (default csv)
+  -o FILE        write results to FILE instead of stdout
+  -d DIR         where generated inputs are kept (default bench_data)
+EOF
+    exit 1
+}
+
+SIZES="1e4 1e6"
+THREADS="1 2 4"
+BATCHES="1 64 1024"
+TRANSPORTS="tcp unix shm"
+IOS="blocking"
+CODECS="raw"
+MODES="pipeline"
+REPEAT=1
+FORMAT=csv
+OUT=/dev/stdout
+DATA_DIR=bench_data
+
+while getopts "n:t:b:T:i:c:m:r:f:o:d:h" opt; do
+    case $opt in
+    n) SIZES=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    b) BATCHES=$OPTARG ;;
+    T) TRANSPORTS=$OPTARG ;;
+    i) IOS=$OPTARG ;;
+    c) CODECS=$OPTARG ;;
+    m) MODES=$OPTARG ;;
+    r) REPEAT=$OPTARG ;;
+    f) FORMAT=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    d) DATA_DIR=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+if [ "$FORMAT" != csv ] && [ "$FORMAT" != json ]; then
+    usage
+fi
+if [ ! -x ./producer ] || [ ! -x ./consumer ] || [ ! -x ./gen ]; then
+    echo "Error: build producer, consumer and gen first (make)" >&2
+    exit 1
+fi
+
+BUILD=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+now() {
+    perl -MTime::HiRes=time -e 'printf "%.6f\n", time'
+}
+
+# Inputs are generated once per size (./gen, uniform values) and kept; the
+# same seed gives the same file on every machine
+input_file() {
+    local n=$1 kind=$2
+    local path="$DATA_DIR/numbers-$n.$kind"
+    if [ ! -s "$path" ] && [ "$n" -gt 0 ]; then
+        mkdir -p "$DATA_DIR"
+        echo "Generating $path" >&2
+        ./gen -n "$n" --seed 42 $([ "$kind" = bin ] && echo -B) -o "$path.tmp" 2>/dev/null &&
+            mv "$path.tmp" "$path"
+    fi
+    echo "$path"
+}
+
+ROWS=0
+emit() {
+    if [ "$FORMAT" = csv ]; then
+        if [ $ROWS -eq 0 ]; then
+            echo "build,mode,transport,io,codec,threads,batch,elements,seconds,elements_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns,max_ns,status"
+        fi
+        local IFS=,
+        echo "$*"
+    else
+        [ $ROWS -eq 0 ] && echo "[" || echo ","
+        printf '  {"build": "%s", "mode": "%s", "transport": "%s", "io": "%s", "codec": "%s", ' "$1" "$2" "$3" "$4" "$5"
+        printf '"threads": %s, "batch": %s, "elements": %s, "seconds": %s, ' "$6" "$7" "$8" "$9"
+        printf '"elements_per_sec": %s, "mb_per_sec": %s, ' "${10}" "${11}"
+        printf '"p50_ns": %s, "p99_ns": %s, "p999_ns": %s, "max_ns": %s, "status": "%s"}' \
+            "${12:-null}" "${13:-null}" "${14:-null}" "${15:-null}" "${16}"
+    fi
+    ROWS=$((ROWS + 1))
+}
+
+run_one() {
+    local mode=$1 transport=$2 io=$3 codec=$4 threads=$5 batch=$6 n=$7
+    local flags="" file
+    case $mode in
+    pipeline) file=$(input_file "$n" txt) ;;
+    shared) file=$(input_file "$n" txt); flags="-s" ;;
+    mmap) file=$(input_file "$n" txt); flags="--mmap" ;;
+    binary) file=$(input_file "$n" bin); flags="--binary" ;;
+    *) echo "Unknown mode $mode" >&2; return ;;
+    esac
+    if [ "$mode" = binary ] && [ "$batch" -eq 0 ]; then
+        return  # --binary needs frames
+    fi
+
+    local start end out
+    start=$(now)
+    out=$(./producer --spawn -n 0 --stamp --log summary -t "$threads" -b "$batch" -T "$transport" \
+          --io "$io" --codec "$codec" $flags "$file" 2>/dev/null)
+    local rc=$?
+    end=$(now)
+
+    local sent got p50="" p99="" p999="" pmax=""
+    sent=$(awk '/^Producer PID .* read [0-9]+ data elements/ { print $(NF-2) }' <<<"$out")
+    got=$(awk '/^Consumer PID .* inserted [0-9]+ data elements/ { print $(NF-2) }' <<<"$out")
+    read -r p50 p99 p999 pmax < <(awk '/latency ns/ { print $(NF-6), $(NF-4), $(NF-2), $NF }' <<<"$out")
+    local status=ok
+    if [ $rc -ne 0 ] || [ "$sent" != "$n" ] || [ "$got" != "$n" ]; then
+        status=fail
+    fi
+    local secs rate mbs
+    read -r secs rate mbs < <(awk -v s="$start" -v e="$end" -v n="$n" \
+        'BEGIN { t = e - s; printf "%.6f %.0f %.3f\n", t, n / t, n * 4 / t / 1e6 }')
+    emit "$BUILD" "$mode" "$transport" "$io" "$codec" "$threads" "$batch" "$n" "$secs" "$rate" "$mbs" \
+         "$p50" "$p99" "$p999" "$pmax" "$status"
+}
+
+{
+    for n in $SIZES; do
+        n=$(awk -v n="$n" 'BEGIN { printf "%.0f\n", n }')
+        for mode in $MODES; do
+            for transport in $TRANSPORTS; do
+                for io in $IOS; do
+                    for codec in $CODECS; do
+                        for threads in $THREADS; do
+                            for batch in $BATCHES; do
+                                for ((rep = 0; rep < REPEAT; rep++)); do
+                                    run_one "$mode" "$transport" "$io" "$codec" "$threads" "$batch" "$n"
+                                done
+                            done
+                        done
+                    done
+                done
+            done
+        done
+    done
+    if [ "$FORMAT" = json ]; then
+        [ $ROWS -eq 0 ] && echo "[" || echo
+        echo "]"
+    fi
+} > "$OUT"
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "bufpool.h"
+#include "stats.h"
+#include "lockprof.h"
+
+#define BUF_MIN_SHIFT 8                         // class 0: up to 256 bytes
+#define BUF_REFILL_BYTES ((size_t)256 << 10)    // taken from the shared list at once
+
+// The shared side of one class: buffers threads spilled, and the
+// uncarved rest of its newest slab
+struct buf_class {
+    pthread_mutex_t mutex;
+    void *free;
+    char *bump;
+    char *bump_end;
+};
+
+// A thread's own lists; the first word of a free buffer links the next
+struct buf_cache {
+    void *head[BUF_CLASSES];
+    size_t count[BUF_CLASSES];
+    int registered;     // cache_key is set, so thread exit hands them back
+};
+
+static struct buf_class classes[BUF_CLASSES];
+static _Thread_local struct buf_cache cache;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static int huge_pages = 0;
+static atomic_int huge_warned = 0;
+
+static size_t class_size(int i) {
+    if (i == 0) {
+        return (size_t)1 << BUF_MIN_SHIFT;
+    }
+    int k = BUF_MIN_SHIFT + (i - 1) / 4;
+    return (size_t)(5 + (i - 1) % 4) << (k - 2);
+}
+
+// The smallest class that holds size bytes; size is at most BUF_MAX
+static int size_class(size_t size) {
+    if (size <= (size_t)1 << BUF_MIN_SHIFT) {
+        return 0;
+    }
+    int k = 63 - __builtin_clzll((unsigned long long)(size - 1));   // 2^k < size <= 2^(k+1)
+    int quarter = (int)((size - 1) >> (k - 2)) & 3;
+    return 1 + (k - BUF_MIN_SHIFT) * 4 + quarter;
+}
+
+static size_t round_slab(size_t len) {
+    return (len + BUF_SLAB - 1) / BUF_SLAB * BUF_SLAB;
+}
+
+/*
+ * len bytes (a multiple of BUF_SLAB) of fresh memory: huge pages if
+ * asked for and reserved, else normal pages cut out 2 MB-aligned so
+ * transparent huge pages can back them. NULL if none can be mapped.
+ */
+static void *map_region(size_t len) {
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+        if (atomic_exchange(&huge_warned, 1) == 0) {
+            fprintf(stderr, "No 2 MB huge pages reserved (vm.nr_hugepages), using transparent "
+                    "huge pages\n");
+        }
+    }
+#endif
+    size_t span = len + BUF_SLAB;
+    char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    char *start = (char *)(((uintptr_t)raw + BUF_SLAB - 1) & ~(uintptr_t)(BUF_SLAB - 1));
+    if (start > raw) {
+        munmap(raw, (size_t)(start - raw));
+    }
+    if (start + len < raw + span) {
+        munmap(start + len, (size_t)(raw + span - (start + len)));
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(start, len, MADV_HUGEPAGE);
+    }
+#endif
+    return start;
+}
+
+// Move all but keep buffers of the thread's class i list to the shared one
+static void spill(int i, size_t keep) {
+    void *first = NULL;
+    void *last = NULL;
+    while (cache.count[i] > keep) {
+        void *b = cache.head[i];
+        cache.head[i] = *(void **)b;
+        cache.count[i]--;
+        *(void **)b = first;
+        first = b;
+        if (!last) {
+            last = b;
+        }
+    }
+    if (!first) {
+        return;
+    }
+    struct buf_class *c = &classes[i];
+    LOCK(&c->mutex, "buf_mutex");
+    *(void **)last = c->free;
+    c->free = first;
+    UNLOCK(&c->mutex);
+}
+
+// Thread exit: buffers left on our lists go to the other threads
+static void cache_exit(void *arg) {
+    (void)arg;
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        spill(i, 0);
+    }
+}
+
+static void setup(void) {
+    for (int i = 0; i < BUF_CLASSES; i++) {
+        pthread_mutex_init(&classes[i].mutex, NULL);
+    }
+    pthread_key_create(&cache_key, cache_exit);
+}
+
+static inline void cache_register(void) {
+    if (!cache.registered) {
+        cache.registered = 1;
+        pthread_setspecific(cache_key, &cache);
+    }
+}
+
+// Fill the thread's empty class i list with up to BUF_REFILL_BYTES of
+// buffers: spilled ones first, then carved from the slab. Returns 0, or
+// -1 if a slab was needed and could not be mapped.
+static int refill(int i) {
+    struct buf_class *c = &classes[i];
+    size_t size = class_size(i);
+    size_t want = size < BUF_REFILL_BYTES ? BUF_REFILL_BYTES / size : 1;
+    size_t got = 0;
+    STAT_ADD(STAT_BUF_REFILLS, 1);
+    LOCK(&c->mutex, "buf_mutex");
+    while (got < want && c->free) {
+        void *b = c->free;
+        c->free = *(void **)b;
+        *(void **)b = cache.head[i];
+        cache.head[i] = b;
+        got++;
+    }
+    while (got < want) {
+        if ((size_t)(c->bump_end - c->bump) < size) {
+            if (got > 0) {
+                break;  // Enough to go on; map when we run out
+            }
+            size_t len = size > BUF_SLAB ? round_slab(size) : BUF_SLAB;
+            char *slab = map_region(len);
+            if (!slab) {
+                UNLOCK(&c->mutex);
+                return -1;
+            }
+            c->bump = slab;
+            c->bump_end = slab + len;
+        }
+        void *b = c->bump;
+        c->bump += size;
+        *(void **)b = cache.head[i];
+        cache.head[i] = b;
+        got++;
+    }
+    UNLOCK(&c->mutex);
+    cache.count[i] += got;
+    return 0;
+}
+
+void bufpool_init(int huge) {
+    pthread_once(&setup_once, setup);
+    huge_pages = huge;
+}
+
+void *buf_alloc(size_t size) {
+    pthread_once(&setup_once, setup);
+    if (size > BUF_MAX) {
+        STAT_ADD(STAT_BUF_REFILLS, 1);
+        void *p = map_region(round_slab(size));
+        if (!p) {
+            errno = ENOMEM;
+        }
+        return p;
+    }
+    int i = size_class(size);
+    if (!cache.head[i]) {
+        cache_register();
+        if (refill(i) < 0) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    void *b = cache.head[i];
+    cache.head[i] = *(void **)b;
+    cache.count[i]--;
+    return b;
+}
+
+void buf_free(void *p, size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size > BUF_MAX) {
+        munmap(p, round_slab(size));
+        return;
+    }
+    int i = size_class(size);
+    cache_register();
+    *(void **)p = cache.head[i];
+    cache.head[i] = p;
+    // A thread that frees more than it takes (a worker) passes half on
+    if (++cache.count[i] > 1 && cache.count[i] * class_size(i) > BUF_CACHE_BYTES) {
+        spill(i, cache.count[i] / 2);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+/*
+ * Size-classed buffer pool for frames and batches, shared by producer
+ * and consumer.
+ *
+ * Sizes are rounded up to one of BUF_CLASSES classes: up to 256 bytes,
+ * then four classes per doubling (x1.25, x1.5, x1.75, x2), so rounding
+ * wastes at most a quarter, and every class is a multiple of 64 bytes.
+ * Buffers are carved out of 2 MB slabs that are never handed back, and
+ * a freed buffer goes onto the freeing thread's own list for its class,
+ * so the steady state of a transfer allocates nothing and takes no lock:
+ * a thread only visits the shared per-class list (under its mutex) to
+ * refill an empty list or spill half of one that grew past
+ * BUF_CACHE_BYTES, and a thread that exits hands its buffers back.
+ * Sizes above BUF_MAX are mapped and unmapped one by one.
+ *
+ * With bufpool_init(1) the slabs are 2 MB huge pages (MAP_HUGETLB, from
+ * the vm.nr_hugepages reserve) so a batch costs one TLB entry, not 64;
+ * without a reserve they are 2 MB-aligned and madvise()d for transparent
+ * huge pages instead.
+ *
+ * buf_free() takes the size that was asked for, like free_sized(): the
+ * class is computed again rather than stored in a header.
+ */
+
+#define BUF_SLAB ((size_t)2 << 20)          // slab size, one huge page
+#define BUF_MAX ((size_t)4 << 20)           // largest pooled size
+#define BUF_CLASSES 57                      // 256 B, then 4 per doubling up to 4 MB
+#define BUF_CACHE_BYTES ((size_t)1 << 20)   // per thread and class before spilling
+
+// Pick the backing before the first buffer is taken: huge asks for 2 MB
+// pages. Without a call the pool uses normal pages.
+void bufpool_init(int huge);
+
+// A buffer of at least size bytes, 64-byte aligned; NULL with errno set
+void *buf_alloc(size_t size);
+
+// Hand back a buffer; size is what it was allocated with. NULL is ignored.
+void buf_free(void *p, size_t size);
+
+#endif // BUFPOOL_H
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_FORMAT "producer-checkpoint 1\n"
+
+int checkpoint_load(struct checkpoint *cp, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char first[64];
+    int ok = fgets(first, sizeof(first), f) && strcmp(first, CHECKPOINT_FORMAT) == 0 &&
+             fscanf(f, "input_size %" SCNu64 "\n", &cp->input_size) == 1 &&
+             fscanf(f, "input_mtime %" SCNd64 "\n", &cp->input_mtime) == 1 &&
+             fscanf(f, "values %" SCNu64 "\n", &cp->values) == 1 &&
+             fscanf(f, "offset %" SCNu64 "\n", &cp->offset) == 1;
+    fclose(f);
+    if (!ok) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_save(const struct checkpoint *cp, const char *path) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+                       CHECKPOINT_FORMAT "input_size %" PRIu64 "\ninput_mtime %" PRId64
+                       "\nvalues %" PRIu64 "\noffset %" PRIu64 "\n",
+                       cp->input_size, cp->input_mtime, cp->values, cp->offset);
+    // Synced before the rename, so FILE is never a torn write
+    errno = 0;  // A short write sets none
+    if (write(fd, buf, (size_t)len) != len || fsync(fd) < 0) {
+        int saved = errno;
+        close(fd);
+        unlink(tmp);
+        errno = saved ? saved : EIO;
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0) {
+        int saved = errno;
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The producer's checkpoint file (--checkpoint FILE).
+ *
+ * While a run goes on, the producer keeps FILE at the last position the
+ * consumer has acknowledged as stored (see HELLO_ACKS): how many values
+ * from the start of the input that is, and the input byte offset just
+ * past them. --resume reads it back, seeks straight to that offset and
+ * sends the rest, so a broken run costs at most the unacknowledged
+ * tail. The input's size and modification time are recorded so a
+ * checkpoint is never applied to a file that changed since.
+ *
+ * The format is a few "key value" text lines. Saving writes a temporary
+ * file next to FILE, syncs it and renames it over FILE, so a crash
+ * leaves either the old checkpoint or the new one.
+ */
+
+struct checkpoint {
+    uint64_t input_size;    // st_size of the input
+    int64_t input_mtime;    // st_mtime of the input
+    uint64_t values;        // positions 0 .. values - 1 are stored
+    uint64_t offset;        // input byte offset of position values
+};
+
+// Read path into cp; returns 0, or -1 with errno set (ENOENT: no
+// checkpoint yet, EINVAL: not a checkpoint file)
+int checkpoint_load(struct checkpoint *cp, const char *path);
+
+// Replace path with cp atomically; returns 0, or -1 with errno set
+int checkpoint_save(const struct checkpoint *cp, const char *path);
+
+#endif // CHECKPOINT_H
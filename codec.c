@@ -0,0 +1,393 @@
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define SVB_SSSE3 1     // built for it, or picked at run time
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SVB_NEON 1
+#endif
+
+#include "codec.h"
+
+static const char *const codec_names[CODEC_COUNT] = { "raw", "varint", "delta", "pack", "svb" };
+
+int codec_parse(const char *name) {
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (strcmp(name, codec_names[i]) == 0) {
+            return codec_available(i) ? i : -1;
+        }
+    }
+    return -1;
+}
+
+const char *codec_name(enum codec c) {
+    return (unsigned)c < CODEC_COUNT ? codec_names[c] : "unknown";
+}
+
+static inline value_t zz(value_t v) {
+    return (value_t)((value_t)(v << 1) ^ (value_t)(0 - (v >> (VALUE_BITS - 1))));
+}
+
+static inline value_t unzz(value_t z) {
+    return (value_t)((z >> 1) ^ (value_t)(0 - (z & 1)));
+}
+
+/*
+ * Replace zig-zag deltas with the values they add up to, in place. The
+ * SIMD loops take one register of lanes at a time: the in-register prefix
+ * sum shifts by one lane, then two, then (16-bit lanes) four, and the
+ * last lane carries into the next register.
+ */
+static void undelta(value_t *v, uint32_t count) {
+    uint32_t i = 0;
+    value_t prev = 0;
+#if defined(__SSE2__) && VALUE_BITS == 16
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        x = _mm_xor_si128(_mm_srli_epi16(x, 1),
+                          _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(x, one)));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi16(x, carry);
+        _mm_storeu_si128((__m128i *)(v + i), x);
+        carry = _mm_shufflehi_epi16(x, 0xFF);
+        carry = _mm_unpackhi_epi64(carry, carry);
+    }
+    prev = (value_t)_mm_cvtsi128_si32(carry);
+#elif defined(__SSE2__) && VALUE_BITS == 64 && defined(__x86_64__)
+    const __m128i one = _mm_set1_epi64x(1);
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        x = _mm_xor_si128(_mm_srli_epi64(x, 1),
+                          _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(x, one)));
+        x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi64(x, carry);
+        _mm_storeu_si128((__m128i *)(v + i), x);
+        carry = _mm_unpackhi_epi64(x, x);
+    }
+    prev = (value_t)_mm_cvtsi128_si64(carry);
+#elif defined(__SSE2__) && VALUE_BITS == 32
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        x = _mm_xor_si128(_mm_srli_epi32(x, 1),
+                          _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(x, one)));
+        // Prefix sum of the four lanes, plus the last value before them
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i *)(v + i), x);
+        carry = _mm_shuffle_epi32(x, 0xFF);
+    }
+    prev = (uint32_t)_mm_cvtsi128_si32(carry);
+#elif defined(SVB_NEON) && VALUE_BITS == 32
+    const uint32x4_t zero = vdupq_n_u32(0);
+    uint32x4_t carry = zero;
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t x = vld1q_u32(v + i);
+        x = veorq_u32(vshrq_n_u32(x, 1),
+                      vreinterpretq_u32_s32(vnegq_s32(vreinterpretq_s32_u32(
+                          vandq_u32(x, vdupq_n_u32(1))))));
+        x = vaddq_u32(x, vextq_u32(zero, x, 3));
+        x = vaddq_u32(x, vextq_u32(zero, x, 2));
+        x = vaddq_u32(x, carry);
+        vst1q_u32(v + i, x);
+        carry = vdupq_laneq_u32(x, 3);
+    }
+    prev = vgetq_lane_u32(carry, 0);
+#endif
+    for (; i < count; i++) {
+        prev = (value_t)(prev + unzz(v[i]));
+        v[i] = prev;
+    }
+}
+
+static inline unsigned char *put_varint(unsigned char *p, value_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// Read one varint at *pos; returns 0, or -1 if it runs off the input
+static inline int get_varint(const unsigned char *in, size_t len, size_t *pos, value_t *out) {
+    value_t v = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+        if (*pos == len || shift >= 7 * CODEC_VARINT_MAX) {
+            return -1;
+        }
+        c = in[(*pos)++];
+        v |= (value_t)((value_t)(c & 0x7F) << shift);
+        shift += 7;
+    } while (c & 0x80);
+    *out = v;
+    return 0;
+}
+
+static int get_varints(const unsigned char *in, size_t len, value_t *out, uint32_t count) {
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (get_varint(in, len, &pos, &out[i]) < 0) {
+            return -1;
+        }
+    }
+    return pos == len ? 0 : -1;
+}
+
+// Bit accumulator for pack: one delta of up to VALUE_BITS on top of the
+// up to 7 bits still waiting
+#if VALUE_BITS == 64
+typedef unsigned __int128 pack_acc;
+#else
+typedef uint64_t pack_acc;
+#endif
+
+// The first value goes first as a varint, so one large starting value
+// doesn't widen every packed delta after it
+static size_t pack_encode(const value_t *in, uint32_t count, unsigned char *out) {
+    value_t all = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        all |= zz((value_t)(in[i] - in[i - 1]));
+    }
+    int bits = all ? 64 - __builtin_clzll((unsigned long long)all) : 0;
+    unsigned char *p = out;
+    *p++ = (unsigned char)bits;
+    p = put_varint(p, zz(in[0]));
+    pack_acc acc = 0;
+    int have = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        acc |= (pack_acc)zz((value_t)(in[i] - in[i - 1])) << have;
+        have += bits;
+        while (have >= 8) {
+            *p++ = (unsigned char)acc;
+            acc >>= 8;
+            have -= 8;
+        }
+    }
+    if (have > 0) {
+        *p++ = (unsigned char)acc;
+    }
+    return (size_t)(p - out);
+}
+
+static int pack_decode(const unsigned char *in, size_t len, value_t *out, uint32_t count) {
+    size_t pos = 1;
+    if (len == 0 || in[0] > VALUE_BITS || count == 0 ||
+        get_varint(in, len, &pos, &out[0]) < 0) {
+        return -1;
+    }
+    int bits = in[0];
+    if (len - pos != ((uint64_t)bits * (count - 1) + 7) / 8) {
+        return -1;
+    }
+    const pack_acc mask = ((pack_acc)1 << bits) - 1;
+    const unsigned char *p = in + pos;
+    pack_acc acc = 0;
+    int have = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        // The length check above keeps this inside the input
+        while (have < bits) {
+            acc |= (pack_acc)*p++ << have;
+            have += 8;
+        }
+        out[i] = (value_t)(acc & mask);
+        acc >>= bits;
+        have -= bits;
+    }
+    undelta(out, count);
+    return 0;
+}
+
+#if VALUE_BITS == 32
+static size_t svb_encode(const uint32_t *in, uint32_t count, unsigned char *out) {
+    unsigned char *ctrl = out;
+    unsigned char *data = out + (count + 3) / 4;
+    memset(ctrl, 0, (count + 3) / 4);
+    uint32_t prev = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t z = zz(in[i] - prev);
+        prev = in[i];
+        int n = z < (1u << 8) ? 1 : z < (1u << 16) ? 2 : z < (1u << 24) ? 3 : 4;
+        ctrl[i / 4] |= (unsigned char)((n - 1) << (2 * (i % 4)));
+        for (int k = 0; k < n; k++) {
+            *data++ = (unsigned char)(z >> (8 * k));
+        }
+    }
+    return (size_t)(data - out);
+}
+
+// Per control byte: how many data bytes its four values take, and the
+// shuffle that moves those bytes into four little-endian lanes
+static unsigned char svb_len[256];
+static unsigned char svb_shuffle[256][16];
+static pthread_once_t svb_once = PTHREAD_ONCE_INIT;
+#if defined(SVB_SSSE3) && !defined(__SSSE3__)
+static int svb_have_ssse3;
+#endif
+
+static void svb_init(void) {
+    for (int c = 0; c < 256; c++) {
+        int off = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            int n = ((c >> (2 * lane)) & 3) + 1;
+            for (int k = 0; k < 4; k++) {
+                svb_shuffle[c][4 * lane + k] = (unsigned char)(k < n ? off + k : 0x80);
+            }
+            off += n;
+        }
+        svb_len[c] = (unsigned char)off;
+    }
+#if defined(SVB_SSSE3) && !defined(__SSSE3__)
+    __builtin_cpu_init();
+    svb_have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+/*
+ * Expand whole groups of four while 16 data bytes remain readable, so a
+ * shuffle never reads past the input; returns how many values are done.
+ * *data is advanced past the bytes used.
+ */
+#if defined(SVB_SSSE3)
+#if !defined(__SSSE3__)
+__attribute__((target("ssse3")))
+#endif
+static uint32_t svb_groups_ssse3(const unsigned char *ctrl, const unsigned char **data,
+                                 const unsigned char *end, uint32_t *out, uint32_t count) {
+    const unsigned char *p = *data;
+    uint32_t i = 0;
+    for (; i + 4 <= count && end - p >= 16; i += 4) {
+        unsigned char c = ctrl[i / 4];
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        x = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)svb_shuffle[c]));
+        _mm_storeu_si128((__m128i *)(out + i), x);
+        p += svb_len[c];
+    }
+    *data = p;
+    return i;
+}
+#elif defined(SVB_NEON)
+static uint32_t svb_groups_neon(const unsigned char *ctrl, const unsigned char **data,
+                                const unsigned char *end, uint32_t *out, uint32_t count) {
+    const unsigned char *p = *data;
+    uint32_t i = 0;
+    for (; i + 4 <= count && end - p >= 16; i += 4) {
+        unsigned char c = ctrl[i / 4];
+        uint8x16_t x = vqtbl1q_u8(vld1q_u8(p), vld1q_u8(svb_shuffle[c]));
+        vst1q_u32(out + i, vreinterpretq_u32_u8(x));
+        p += svb_len[c];
+    }
+    *data = p;
+    return i;
+}
+#endif
+
+static int svb_decode(const unsigned char *in, size_t len, uint32_t *out, uint32_t count) {
+    pthread_once(&svb_once, svb_init);
+    size_t ctrl_len = (count + 3) / 4;
+    if (len < ctrl_len) {
+        return -1;
+    }
+    // Check the lengths add up before trusting any of them
+    size_t need = ctrl_len;
+    for (uint32_t i = 0; i < count; i++) {
+        need += ((in[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    }
+    if (need != len) {
+        return -1;
+    }
+    const unsigned char *ctrl = in;
+    const unsigned char *data = in + ctrl_len;
+    const unsigned char *end = in + len;
+    uint32_t i = 0;
+#if defined(SVB_SSSE3) && defined(__SSSE3__)
+    i = svb_groups_ssse3(ctrl, &data, end, out, count);
+#elif defined(SVB_SSSE3)
+    if (svb_have_ssse3) {
+        i = svb_groups_ssse3(ctrl, &data, end, out, count);
+    }
+#elif defined(SVB_NEON)
+    i = svb_groups_neon(ctrl, &data, end, out, count);
+#endif
+    for (; i < count; i++) {
+        int n = ((ctrl[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        uint32_t z = 0;
+        for (int k = 0; k < n; k++) {
+            z |= (uint32_t)*data++ << (8 * k);
+        }
+        out[i] = z;
+    }
+    (void)end;
+    undelta(out, count);
+    return 0;
+}
+
+#endif // VALUE_BITS == 32
+
+size_t codec_encode(enum codec c, const value_t *in, uint32_t count, unsigned char *out) {
+    unsigned char *p = out;
+    value_t prev = 0;
+    switch (c) {
+    case CODEC_VARINT:
+        for (uint32_t i = 0; i < count; i++) {
+            p = put_varint(p, zz(in[i]));
+        }
+        return (size_t)(p - out);
+    case CODEC_DELTA:
+        for (uint32_t i = 0; i < count; i++) {
+            p = put_varint(p, zz((value_t)(in[i] - prev)));
+            prev = in[i];
+        }
+        return (size_t)(p - out);
+    case CODEC_PACK:
+        return pack_encode(in, count, out);
+#if VALUE_BITS == 32
+    case CODEC_SVB:
+        return svb_encode(in, count, out);
+#endif
+    default:
+        return 0;
+    }
+}
+
+int codec_decode(enum codec c, const unsigned char *in, size_t len, value_t *out,
+                 uint32_t count) {
+    switch (c) {
+    case CODEC_VARINT:
+        if (get_varints(in, len, out, count) < 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] = unzz(out[i]);
+        }
+        return 0;
+    case CODEC_DELTA:
+        if (get_varints(in, len, out, count) < 0) {
+            return -1;
+        }
+        undelta(out, count);
+        return 0;
+    case CODEC_PACK:
+        return pack_decode(in, len, out, count);
+#if VALUE_BITS == 32
+    case CODEC_SVB:
+        return svb_decode(in, len, out, count);
+#endif
+    default:
+        return -1;
+    }
+}
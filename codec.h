@@ -0,0 +1,67 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+/*
+ * Compact encodings for one frame's values (see FRAME_ENCODED in
+ * protocol.h). Every frame is coded on its own, starting from zero, so a
+ * frame can always fall back to raw values when coding would not save
+ * anything. zz() below is the zig-zag map that takes small negative and
+ * positive numbers to small unsigned ones. Delta-based codecs code
+ * zz(value - previous value), so sorted or slowly changing runs shrink
+ * to the width of their steps.
+ *
+ *   raw     network-order values (no encoding)
+ *   varint  LEB128 varints of zz(value): 1 byte below 64, CODEC_VARINT_MAX
+ *           at most
+ *   delta   LEB128 varints of the zig-zag deltas
+ *   pack    one width byte b, the first value as a varint, then every
+ *           later zig-zag delta in exactly b bits (bit packing, b = the
+ *           widest delta)
+ *   svb     Stream VByte of the zig-zag deltas: 2-bit length codes for
+ *           four values per control byte, then their 1-4 data bytes.
+ *           The decoder expands four values per shuffle (SSSE3 or NEON)
+ *           and undoes zig-zag and deltas four lanes at a time.
+ *           WIDTH=32 builds only (see value.h); others reject "svb".
+ */
+
+enum codec {
+    CODEC_RAW = 0,
+    CODEC_VARINT,
+    CODEC_DELTA,
+    CODEC_PACK,
+    CODEC_SVB,
+    CODEC_COUNT
+};
+
+#define CODEC_VARINT_MAX ((VALUE_BITS + 6) / 7)    // bytes in the longest varint
+
+// Parse a codec name ("raw", "varint", "delta", "pack", "svb"); -1 if
+// unknown or not built for this width
+int codec_parse(const char *name);
+const char *codec_name(enum codec c);
+
+// Whether this build can code c (CODEC_SVB needs WIDTH=32)
+static inline int codec_available(int c) {
+    return c >= 0 && c < CODEC_COUNT && (c != CODEC_SVB || VALUE_BITS == 32);
+}
+
+// Most bytes codec_encode() writes for count values, for any codec
+static inline size_t codec_bound(uint32_t count) {
+    return (size_t)count * CODEC_VARINT_MAX + 1 + CODEC_VARINT_MAX;
+}
+
+// Encode count host-order values into out (codec_bound(count) bytes of
+// room); returns the encoded length. Not for CODEC_RAW.
+size_t codec_encode(enum codec c, const value_t *in, uint32_t count, unsigned char *out);
+
+// Decode exactly count host-order values from the len bytes at in;
+// returns 0, or -1 if the input is malformed or not exactly that long
+int codec_decode(enum codec c, const unsigned char *in, size_t len, value_t *out,
+                 uint32_t count);
+
+#endif // CODEC_H
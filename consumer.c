@@ -1,171 +1,1874 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <pthread.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <signal.h>
-#include <string.h>
-#include <errno.h>
-
-/*
- * Consumer program responsibilities:
- *  - Start as a separate process exec'd by the producer
- *  - Create a listening TCP socket on localhost:PORT
- *  - accept() a connection from the producer
- *  - Create 2 threads that receive integers via the socket
- *  - Safely insert received integers into a shared global array
- *  - Print required status line for each insertion
- */
-
-#define NUM_THREADS 2
-#define PORT 12345
-#define MAX_DATA 100
-
-// Shared data array and insertion index
-int data_array[MAX_DATA];
-int data_index = 0;  // Next insertion index
-
-int conn_fd = -1; // Socket file descriptor for connection
-
-pthread_mutex_t array_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Timeout support so running ./consumer alone doesn't hang forever
-static volatile sig_atomic_t timed_out = 0;
-
-void alarm_handler(int sig) {
-    (void)sig;
-    timed_out = 1;
-}
-
-void *consumer_thread_func(void *arg) {
-    (void)arg;
-    // Stub function for consumer threads
-    // Should read from socket and insert into data_array
-    pid_t pid = getpid();
-    pthread_t tid = pthread_self();
-
-    while(1) {
-        pthread_mutex_lock(&array_mutex);
-
-        // Check if we've filled the array
-        if (data_index >= MAX_DATA) {
-            pthread_mutex_unlock(&array_mutex);
-            break;  // Array full
-        }
-
-        // Read an integer from the socket
-        uint32_t net_val;
-        ssize_t n  = recv(conn_fd, &net_val, sizeof(net_val), MSG_WAITALL);
-        if (n == 0) {
-            // Connection closed by producer
-            pthread_mutex_unlock(&array_mutex);
-            break;
-        } else if (n < 0) {
-            perror("recv failed");
-            pthread_mutex_unlock(&array_mutex);
-            break;
-        } else if (n != sizeof(net_val)) {
-            // Partial read, handle as needed
-            fprintf(stderr, "Partial read from socket\n");
-            pthread_mutex_unlock(&array_mutex);
-            break;
-        }
-        // Convert back from network byte order to host integer
-        int value = (int)ntohl(net_val);
-        // Insert into array and advance index
-        data_array[data_index++] = value;
-
-        printf("Consumer PID %d, Thread ID %lu inserted data element %d\n", pid, (unsigned long)tid, value);
-
-        pthread_mutex_unlock(&array_mutex);
-    }
-    return NULL;
-}
-
-int main() {
-    // Setup socket to accept connection from producer
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("socket creation failed");
-        exit(EXIT_FAILURE);
-    }
-
-    // Allow reuse of address
-    int opt_val = 1;
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val)) < 0) {
-        perror("setsockopt failed");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
-    }
-
-    // Bind and listen
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT);
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    #ifdef __APPLE__
-    addr.sin_len = sizeof(addr);
-    #endif
-    
-    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind failed");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
-    }
-    if (listen(listen_fd, 1) < 0) {
-        perror("listen failed");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
-    }
-
-    // Set up alarm for timeout
-    signal(SIGALRM, alarm_handler);
-    alarm(5); // Set timeout for 5 seconds
-
-    // Accept connection from producer
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len);
-    if (conn_fd < 0) {
-        if (timed_out) {
-            fprintf(stderr, "No producer connected within timeout period\n");
-            close(listen_fd);
-            pthread_mutex_destroy(&array_mutex);
-            return 0; // Exit gracefully
-        } else {
-            perror("accept failed");
-            close(listen_fd);
-            pthread_mutex_destroy(&array_mutex);
-            exit(EXIT_FAILURE);
-        }
-    }
-    alarm(0); // Cancel alarm
-    close(listen_fd); // No longer need the listening socket
-    // (Socket creation and accept code stub)
-
-    // Create consumer threads
-    pthread_t threads[NUM_THREADS];
-    int created = 0;
-
-    for (int i = 0; i < NUM_THREADS; i++) {
-        if (pthread_create(&threads[i], NULL, consumer_thread_func, NULL) != 0) {
-            perror("pthread_create");
-            break;
-        }
-        created++;
-    }
-    //appropriate code to handle thread exit
-    for (int i = 0; i < created; i++) {
-        pthread_join(threads[i], NULL);
-    }
-    // Close socket and cleanup
-    close(conn_fd);
-    pthread_mutex_destroy(&array_mutex);
-
-    return 0;
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#include "protocol.h"
+#include "transport.h"
+#include "poller.h"
+#include "arena.h"
+#include "pool.h"
+#include "stage.h"
+#include "sink.h"
+#include "hist.h"
+#include "codec.h"
+#include "log.h"
+#include "affinity.h"
+#include "stats.h"
+#include "lockprof.h"
+#include "bufpool.h"
+#include "metrics.h"
+
+/*
+ * Consumer program responsibilities:
+ *  - Start as a separate process exec'd by the producer
+ *  - Listen on the transport the producer picked (TCP on PORT, or the
+ *    --port it gives each shard, an AF_UNIX socket or shared memory, see
+ *    transport.h)
+ *  - accept() the producer's connections (one, or one per producer thread)
+ *  - Read the producer's hello (framing and value limit, see protocol.h)
+ *  - Receive integers on one dedicated receiver thread per connection,
+ *    handing credit back to the producer as frames move on (flow
+ *    control, see struct credit in protocol.h)
+ *  - Create 2 worker threads that insert received batches into a shared
+ *    chunked arena (see arena.h), each filling chunks it owns; with
+ *    --direct the receivers read payloads straight into their own chunks
+ *    instead
+ *  - Store values at their sequence number instead when the producer
+ *    asks for ordered delivery, so storage is in input order
+ *  - For a checkpointing producer, report in every credit how far the
+ *    input is stored without a gap (on disk with --persist), and take a
+ *    resumed session's values from where the last one left off
+ *  - Print required status line for each insertion through the async
+ *    logger (see log.h); --log/--log-every are passed on by the producer
+ *
+ * With --server the consumer instead stays up until SIGINT/SIGTERM and
+ * takes any number of producers at once: one event loop thread (epoll
+ * or kqueue, see poller.h) reads every connection without blocking into
+ * its own buffer and hands complete frames to the same worker pool.
+ *
+ * With --daemon it stays up as well, but serves one producer session
+ * after another exactly as a one-shot consumer would, each into a fresh
+ * arena, so a producer that finds it listening skips the fork and exec.
+ *
+ * --stage LIST runs processing stages over the stored values while they
+ * arrive (sum/min/max/histogram, radix sort, a binary file writer) on a
+ * work-stealing pool of --workers threads, see stage.h.
+ *
+ * --persist PATH streams every filled arena chunk to PATH on a background
+ * I/O thread (see sink.h); --reload PATH maps such a file instead of
+ * listening and runs the --stage operators over it.
+ *
+ * --metrics ADDR serves live counters (ingest rate, queue depths, bytes per
+ * connection, contention, arena memory) as a Prometheus text page on a
+ * side TCP port or UNIX socket, see metrics.h and write_metrics().
+ *
+ * --io uring receives through io_uring (see uring.h) instead of blocking
+ * recv(); server mode keeps its readiness loop either way.
+ *
+ * --ready-fd N (passed by the producer) names an inherited pipe: one byte
+ * is written to it as soon as the socket listens, so the producer can
+ * connect at once instead of polling.
+ *
+ * --workers sets the worker count; --cpus pins receivers, then workers,
+ * to the listed CPUs in turn (see affinity.h), and --numa places each
+ * thread's arena chunks on its own NUMA node.
+ */
+
+#define DEFAULT_WORKERS 2
+#define MAX_WORKERS 64
+
+#define QUEUE_DEPTH 16   // Batches in flight between receiver and workers
+#define CLIENT_BUF_MIN 4096   // --server: smallest per-connection read buffer
+
+// Shared storage for received values; each worker fills its own chunks
+struct arena data_arena;
+
+// Accepted connections of the producer session, indexed by conn_id
+struct transport conns[MAX_CONNS];
+int num_conns = 0;
+int batch_size = DEFAULT_BATCH; // From the hello, 0 = single mode
+static int session_codec = CODEC_RAW;   // Accepted for this session's frames
+static uint32_t session_window = 0;     // Credit granted per connection, 0 = none
+static int direct_mode = 0;     // --direct: receivers fill the arena themselves
+static int ordered_mode = 0;    // HELLO_ORDERED: values stored at their seq
+static int session_acks = 0;    // HELLO_ACKS: credits carry stored progress
+static uint64_t session_start = 0;  // hello.start: position of arena slot 0
+static int server_mode = 0;     // --server: long-lived event loop
+static int daemon_mode = 0;     // --daemon: one session after another
+static int num_workers = DEFAULT_WORKERS;
+static struct cpu_list cpus;    // --cpus, empty = unpinned
+static const char *stage_list = NULL;   // --stage, NULL = none
+static struct pool stage_pool;  // runs the stages' work, when there are any
+static struct pipeline pipeline;
+static int staged = 0;          // pipeline is open for the current arena
+static const char *persist_path = NULL; // --persist, NULL = none
+static struct sink sink;
+static int persisting = 0;      // sink is open for the current arena
+
+// --metrics: what a scrape may look at besides atomics, see write_metrics()
+static const char *metrics_addr = NULL;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int metrics_live = 0;            // data_arena and conns belong to a running session
+static unsigned long sessions_started = 0;
+static uint64_t values_before = 0;      // taken in by finished sessions
+static uint64_t cas_lost_before = 0;
+static uint64_t scraped_ns = 0;         // previous scrape, or when --metrics started
+static uint64_t scraped_total = 0;      // values taken in by then
+
+// Receivers still running; the last one out closes ready_queue
+static atomic_int active_receivers = 0;
+
+// One received frame, values already converted to host order
+struct batch {
+    uint32_t count;
+    uint64_t seq;       // sequence number of values[0], from the frame header
+    uint64_t stamp;     // producer's FRAME_STAMPED time, 0 if not stamped
+    value_t values[];
+};
+
+// What a batch for count values takes from the buffer pool
+static inline size_t batch_bytes(size_t count) {
+    return sizeof(struct batch) + count * sizeof(value_t);
+}
+
+// Read-to-insert latency of stamped values, merged from every thread
+static struct hist latency;
+static pthread_mutex_t latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Count count values inserted now that the producer took at stamp
+static void record_latency(struct hist *h, uint64_t stamp, uint32_t count) {
+    if (stamp != 0) {
+        uint64_t now = now_ns();
+        hist_add(h, now > stamp ? now - stamp : 0, count);
+    }
+}
+
+static void merge_latency(const struct hist *h) {
+    pthread_mutex_lock(&latency_mutex);
+    hist_merge(&latency, h);
+    pthread_mutex_unlock(&latency_mutex);
+}
+
+static void report_latency(void) {
+    if (latency.count > 0) {
+        log_summary("Consumer PID %d latency ns p50 %llu p99 %llu p999 %llu max %llu\n", getpid(),
+                    (unsigned long long)hist_quantile(&latency, 0.50),
+                    (unsigned long long)hist_quantile(&latency, 0.99),
+                    (unsigned long long)hist_quantile(&latency, 0.999),
+                    (unsigned long long)latency.max);
+    }
+}
+
+/*
+ * Check a frame's count and flags against the session's batch size and
+ * codec; returns 0, or -1 after reporting a bad frame.
+ */
+static int check_frame(uint32_t count, uint32_t flags, int batch, int codec) {
+    if (count == 0 || count > (uint32_t)batch || (flags & ~FRAME_KNOWN_FLAGS) ||
+        ((flags & FRAME_ENCODED) && codec == CODEC_RAW)) {
+        fprintf(stderr, "Bad frame: %u values, flags %#x (batch size %d, codec %s)\n", count,
+                flags, batch, codec_name((enum codec)codec));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pick the stamp and coded length out of the frame_extra(flags) bytes
+ * at p. *coded_len is 0 for raw values; returns -1 after reporting a
+ * length no encoder would produce for count values.
+ */
+static int parse_frame_extra(const unsigned char *p, uint32_t flags, uint32_t count,
+                             uint64_t *stamp, uint32_t *coded_len) {
+    *stamp = 0;
+    *coded_len = 0;
+    if (flags & FRAME_STAMPED) {
+        memcpy(stamp, p, sizeof(*stamp));
+        *stamp = ntoh64(*stamp);
+        p += sizeof(*stamp);
+    }
+    if (flags & FRAME_ENCODED) {
+        memcpy(coded_len, p, sizeof(*coded_len));
+        *coded_len = ntohl(*coded_len);
+        if (*coded_len == 0 || *coded_len > codec_bound(count)) {
+            fprintf(stderr, "Bad frame: %u coded bytes for %u values\n", *coded_len, count);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Check a frame header against the batch size and read whatever the
+ * flags say follows it (stamp, coded length). Returns the value count,
+ * or 0 after reporting a bad frame or a failed read.
+ */
+static uint32_t read_frame_extra(struct transport *conn, const struct frame_hdr *hdr,
+                                 uint64_t *stamp, uint32_t *coded_len) {
+    uint32_t count = ntohl(hdr->count);
+    uint32_t flags = ntohl(hdr->flags);
+    if (check_frame(count, flags, batch_size, session_codec) < 0) {
+        return 0;
+    }
+    unsigned char extra[FRAME_EXTRA_MAX];
+    size_t len = frame_extra(flags);
+    ssize_t n = len > 0 ? transport_recv(conn, extra, len) : 0;
+    if (n != (ssize_t)len) {
+        if (n < 0) {
+            perror("recv failed");
+        } else {
+            fprintf(stderr, "Partial read from socket\n");
+        }
+        return 0;
+    }
+    if (parse_frame_extra(extra, flags, count, stamp, coded_len) < 0) {
+        return 0;
+    }
+    return count;
+}
+
+/*
+ * Receive a frame's coded_len bytes into scratch and decode them into
+ * count host-order values at out. Returns 0, or -1 after reporting.
+ */
+static int receive_coded(struct transport *conn, unsigned char *scratch, uint32_t coded_len,
+                         value_t *out, uint32_t count) {
+    ssize_t n = transport_recv(conn, scratch, coded_len);
+    if (n != (ssize_t)coded_len) {
+        if (n < 0) {
+            perror("recv failed");
+        } else {
+            fprintf(stderr, "Partial read from socket\n");
+        }
+        return -1;
+    }
+    if (codec_decode((enum codec)session_codec, scratch, coded_len, out, count) < 0) {
+        fprintf(stderr, "Bad %s frame: %u bytes do not decode to %u values\n",
+                codec_name((enum codec)session_codec), coded_len, count);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Credit owed to one producer connection (see struct credit). Frames
+ * earn their credit back once they are handed to the workers or stored;
+ * it is granted half a window at a time and never past the storage left.
+ */
+struct credit_state {
+    uint32_t window;    // 0 = no flow control
+    uint32_t owed;      // frames taken in and not granted back yet
+    int stopped;        // CREDIT_STOP sent
+};
+
+static void credit_init(struct credit_state *cs, uint32_t window) {
+    cs->window = window;
+    cs->owed = 0;
+    cs->stopped = 0;
+}
+
+_Static_assert(CHECKPOINT_VALUES == ARENA_CHUNK_VALUES, "acks count whole arena chunks");
+
+// How far the input is stored with no gap, for HELLO_ACKS: synced to
+// the --persist file, in whole blocks. Memory alone is no ack, it goes
+// with the process
+static uint64_t acked_values(void) {
+    if (!session_acks || !persisting) {
+        return 0;
+    }
+    return session_start + sink_durable(&sink) / CHECKPOINT_VALUES * CHECKPOINT_VALUES;
+}
+
+static int send_credit(struct transport *conn, uint32_t frames, uint32_t flags) {
+    struct credit c;
+    c.frames = htonl(frames);
+    c.flags = htonl(flags);
+    c.acked = hton64(acked_values());
+    // Grants must not wait behind other queued data (io_uring)
+    if (transport_send(conn, &c, sizeof(c)) < 0 || transport_flush(conn) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Count one frame of batch values taken in and grant what is due;
+// returns 0, or -1 if the grant can't be sent
+static int credit_frame(struct transport *conn, struct credit_state *cs, int batch) {
+    if (cs->window == 0 || ++cs->owed < (cs->window + 1) / 2) {
+        return 0;
+    }
+    uint64_t room = (arena_room(&data_arena) + (uint64_t)batch - 1) / (uint64_t)batch;
+    uint32_t frames = room < cs->owed ? (uint32_t)room : cs->owed;
+    if (frames == 0) {
+        return 0;   // Full: the caller stops reading and says so
+    }
+    cs->owed -= frames;
+    if (send_credit(conn, frames, 0) < 0) {
+        perror("send credit");
+        return -1;
+    }
+    return 0;
+}
+
+// No storage left: tell the producer to stop sending rather than leave
+// it writing into a connection nobody reads
+static void credit_stop(struct transport *conn, struct credit_state *cs) {
+    if (cs->window > 0 && !cs->stopped) {
+        cs->stopped = 1;
+        send_credit(conn, 0, CREDIT_STOP);  // It may have finished and gone
+    }
+}
+
+/*
+ * Bounded FIFO of batch pointers; the lock only covers the pointer hand-off.
+ * depth, contended and waits are for --metrics: only the lock holder
+ * writes them, so they are plain loads and stores, and the metrics thread
+ * reads them without the lock.
+ */
+struct batch_queue {
+    const char *name;   // lock class for the contention profiler
+    struct batch *slots[QUEUE_DEPTH];
+    int head;
+    int count;
+    int closed;
+    atomic_int depth;               // count, published
+    _Atomic uint64_t contended;     // lock found taken
+    _Atomic uint64_t waits;         // push found it full, pop found it empty
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+#define BATCH_QUEUE_INITIALIZER(name) \
+    { name, {0}, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
+      PTHREAD_COND_INITIALIZER }
+
+// Bump a counter only the current lock holder writes
+static inline void held_add(_Atomic uint64_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void queue_lock(struct batch_queue *q) {
+    if (LOCK_WAITED(&q->mutex, q->name)) {
+        held_add(&q->contended, 1);
+    }
+}
+
+static void queue_publish(struct batch_queue *q) {
+    atomic_store_explicit(&q->depth, q->count, memory_order_relaxed);
+}
+
+// Filled batches travel receiver -> workers, empty ones back again
+static struct batch_queue ready_queue = BATCH_QUEUE_INITIALIZER("ready_queue");
+static struct batch_queue free_queue = BATCH_QUEUE_INITIALIZER("free_queue");
+
+static void queue_push(struct batch_queue *q, struct batch *b) {
+    STAT_TIMER(start);
+    queue_lock(q);
+    if (q->count == QUEUE_DEPTH) {
+        held_add(&q->waits, 1);
+    }
+    while (q->count == QUEUE_DEPTH) {
+        COND_WAIT(&q->not_full, &q->mutex);
+    }
+    STAT_SINCE(STAT_LOCK_WAIT_NS, start);
+    q->slots[(q->head + q->count) % QUEUE_DEPTH] = b;
+    q->count++;
+    queue_publish(q);
+    pthread_cond_signal(&q->not_empty);
+    UNLOCK(&q->mutex);
+}
+
+// Returns NULL once the queue is closed and drained
+static struct batch *queue_pop(struct batch_queue *q) {
+    STAT_TIMER(start);
+    queue_lock(q);
+    if (q->count == 0 && !q->closed) {
+        held_add(&q->waits, 1);
+    }
+    while (q->count == 0 && !q->closed) {
+        COND_WAIT(&q->not_empty, &q->mutex);
+    }
+    STAT_SINCE(STAT_LOCK_WAIT_NS, start);
+    struct batch *b = NULL;
+    if (q->count > 0) {
+        b = q->slots[q->head];
+        q->head = (q->head + 1) % QUEUE_DEPTH;
+        q->count--;
+        queue_publish(q);
+        pthread_cond_signal(&q->not_full);
+    }
+    UNLOCK(&q->mutex);
+    return b;
+}
+
+static void queue_close(struct batch_queue *q) {
+    LOCK(&q->mutex, q->name);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    UNLOCK(&q->mutex);
+}
+
+// Empty and reopen a queue for the next session; no thread may be using it
+static void queue_reset(struct batch_queue *q) {
+    LOCK(&q->mutex, q->name);
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    queue_publish(q);
+    UNLOCK(&q->mutex);
+}
+
+static void queue_destroy(struct batch_queue *q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+// Timeout support so running ./consumer alone doesn't hang forever
+static volatile sig_atomic_t timed_out = 0;
+
+void alarm_handler(int sig) {
+    (void)sig;
+    timed_out = 1;
+}
+
+// Tell the producer we are listening: one byte down its pipe, then close
+// it so a producer that outlives us never waits on it
+static void signal_ready(int fd) {
+    if (fd < 0) {
+        return;
+    }
+    char c = 1;
+    ssize_t n;
+    do {
+        n = write(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("ready pipe");
+    }
+    close(fd);
+}
+
+// Ordered mode: a frame has to lie within this session's positions,
+// start .. start + the arena's limit. Anything else is a protocol error:
+// it has no place in the arena, and a frame only partly reserved while
+// the arena is not full would leave the rest of its payload unread
+static int frame_in_session(uint64_t seq, uint32_t count) {
+    if (!ordered_mode) {
+        return 1;   // seq only orders frames we store in arrival order
+    }
+    uint64_t limit = data_arena.limit;
+    if (seq < session_start || seq - session_start > limit ||
+        count > limit - (seq - session_start)) {
+        fprintf(stderr, "Bad frame: %u values at position %llu, outside the session\n", count,
+                (unsigned long long)seq);
+        return 0;
+    }
+    return 1;
+}
+
+// Read one batch off the connection; returns 1 on success, 0 on EOF/error.
+// Coded frames go through scratch (codec_bound(batch_size) bytes)
+static int receive_batch(struct transport *conn, struct batch *b, unsigned char *scratch) {
+    if (batch_size == 0) {
+        // Original protocol: one bare value per recv(), no sequence numbers
+        value_t net_val;
+        ssize_t n  = transport_recv(conn, &net_val, sizeof(net_val));
+        if (n == 0) {
+            return 0;  // Connection closed by producer
+        } else if (n < 0) {
+            perror("recv failed");
+            return 0;
+        } else if (n != sizeof(net_val)) {
+            fprintf(stderr, "Partial read from socket\n");
+            return 0;
+        }
+        b->count = 1;
+        b->seq = UINT64_MAX;
+        b->stamp = 0;
+        b->values[0] = value_ntoh(net_val);
+        return 1;
+    }
+
+    // Framed protocol: header, then exactly count values
+    struct frame_hdr hdr;
+    ssize_t n = transport_recv(conn, &hdr, sizeof(hdr));
+    if (n == 0) {
+        return 0;  // Connection closed by producer
+    } else if (n < 0) {
+        perror("recv failed");
+        return 0;
+    } else if (n != sizeof(hdr)) {
+        fprintf(stderr, "Partial read from socket\n");
+        return 0;
+    }
+    uint32_t coded_len;
+    uint32_t count = read_frame_extra(conn, &hdr, &b->stamp, &coded_len);
+    if (count == 0) {
+        return 0;
+    }
+    if (!frame_in_session(ntoh64(hdr.seq), count)) {
+        return 0;
+    }
+    b->count = count;
+    b->seq = ntoh64(hdr.seq) - session_start;  // Position in this session's arena
+    if (coded_len > 0) {
+        return receive_coded(conn, scratch, coded_len, b->values, count) == 0;
+    }
+    size_t len = count * sizeof(value_t);
+    n = transport_recv(conn, b->values, len);
+    if (n != (ssize_t)len) {
+        if (n < 0) {
+            perror("recv failed");
+        } else {
+            fprintf(stderr, "Partial read from socket\n");
+        }
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        b->values[i] = value_ntoh(b->values[i]);
+    }
+    return 1;
+}
+
+// Reserve room for count values starting at sequence number seq; returns
+// how many of them may be stored
+static uint32_t reserve_values(uint64_t seq, uint32_t count) {
+    return ordered_mode ? arena_reserve_at(&data_arena, seq, count)
+                        : arena_reserve(&data_arena, count);
+}
+
+// Store reserved values: at their position in ordered mode, else at the
+// end of this thread's chunks. Returns 0, or -1 if a chunk can't be had
+static int store_values(struct arena_writer *w, uint64_t seq, const value_t *values,
+                        uint32_t count) {
+    return ordered_mode ? arena_place(&data_arena, seq, values, count)
+                        : arena_append(w, values, count);
+}
+
+// Per-thread status stream carrying the lab's "inserted data element" prefix
+static struct log_stream *open_log_stream(void) {
+    char prefix[96];
+    snprintf(prefix, sizeof(prefix), "Consumer PID %d, Thread ID %lu inserted data element ",
+             getpid(), (unsigned long)pthread_self());
+    return log_stream_open(prefix);
+}
+
+/*
+ * --direct receive: read each frame's payload straight into this
+ * receiver's own arena chunks (or, ordered, its place in the arena) and
+ * byte-swap it there, so values are never copied between buffers and
+ * no hand-off to the workers happens.
+ * Payloads that straddle a chunk end are read in two pieces. Coded
+ * frames can't land in place: they are decoded into a buffer and copied
+ * in. Returns once the connection ends or the arena is full.
+ */
+static void receive_direct(struct transport *conn, unsigned char *scratch, value_t *decoded,
+                           struct credit_state *cs) {
+    struct log_stream *log = open_log_stream();
+    struct arena_writer writer;
+    arena_writer_init(&writer, &data_arena);
+    struct hist lat;
+    hist_reset(&lat);
+
+    while (!arena_full(&data_arena)) {
+        struct frame_hdr hdr;
+        ssize_t n = transport_recv(conn, &hdr, sizeof(hdr));
+        if (n != (ssize_t)sizeof(hdr)) {
+            if (n < 0) {
+                perror("recv failed");
+            } else if (n > 0) {
+                fprintf(stderr, "Partial read from socket\n");
+            }
+            break;
+        }
+        uint64_t stamp;
+        uint32_t coded_len;
+        uint32_t count = read_frame_extra(conn, &hdr, &stamp, &coded_len);
+        if (count == 0) {
+            break;
+        }
+        // Past that check fewer than count are reserved only when the
+        // arena is full, and we stop reading then anyway
+        if (!frame_in_session(ntoh64(hdr.seq), count)) {
+            break;
+        }
+        uint64_t seq = ntoh64(hdr.seq) - session_start;
+        uint32_t left = reserve_values(seq, count);
+        if (coded_len > 0) {
+            if (receive_coded(conn, scratch, coded_len, decoded, count) < 0) {
+                break;
+            }
+            if (store_values(&writer, seq, decoded, left) < 0) {
+                perror("arena chunk");
+                break;
+            }
+            STAT_ADD(STAT_ELEMENTS, left);
+            log_values(log, decoded, left);
+            record_latency(&lat, stamp, count);
+            if (credit_frame(conn, cs, batch_size) < 0) {
+                break;
+            }
+            continue;
+        }
+        while (left > 0) {
+            uint32_t room;
+            value_t *dst = ordered_mode ? arena_at(&data_arena, seq, left, &room)
+                                         : arena_window(&writer, left, &room);
+            if (!dst) {
+                perror("arena chunk");
+                goto out;
+            }
+            size_t len = room * sizeof(value_t);
+            n = transport_recv(conn, dst, len);
+            if (n != (ssize_t)len) {
+                if (n < 0) {
+                    perror("recv failed");
+                } else {
+                    fprintf(stderr, "Partial read from socket\n");
+                }
+                goto out;
+            }
+            for (uint32_t i = 0; i < room; i++) {
+                dst[i] = value_ntoh(dst[i]);
+            }
+            if (ordered_mode) {
+                arena_filled(&data_arena, seq, room);
+            } else {
+                arena_commit(&writer, room);
+            }
+            STAT_ADD(STAT_ELEMENTS, room);
+            log_values(log, dst, room);
+            seq += room;
+            left -= room;
+        }
+        record_latency(&lat, stamp, count);
+        if (credit_frame(conn, cs, batch_size) < 0) {
+            break;
+        }
+    }
+out:
+    arena_writer_finish(&writer);
+    merge_latency(&lat);
+}
+
+/*
+ * Receiver thread: one per connection and the only thread that touches
+ * its socket. It does all socket reads without holding any lock and
+ * hands complete batches to the worker threads through ready_queue.
+ * A batch's credit goes back to the producer once ready_queue takes it,
+ * so while the workers are behind the producer gets none.
+ */
+void *receiver_thread_func(void *arg) {
+    struct transport *conn = arg;
+    STATS_REGISTER("receiver");
+    LOCKPROF_THREAD("receiver");
+
+    // Coded frames are received whole, then decoded
+    unsigned char *scratch = NULL;
+    value_t *decoded = NULL;
+    int ok = 1;
+    if (session_codec != CODEC_RAW) {
+        scratch = buf_alloc(codec_bound((uint32_t)batch_size));
+        decoded = direct_mode ? buf_alloc((size_t)batch_size * sizeof(value_t)) : NULL;
+        if (!scratch || (direct_mode && !decoded)) {
+            perror("malloc decode buffer");
+            ok = 0;
+        }
+    }
+
+    struct credit_state cs;
+    credit_init(&cs, session_window);
+    if (ok && direct_mode) {
+        receive_direct(conn, scratch, decoded, &cs);
+    }
+    while (ok && !direct_mode && !arena_full(&data_arena)) {
+        struct batch *b = queue_pop(&free_queue);
+        if (!receive_batch(conn, b, scratch)) {
+            queue_push(&free_queue, b);
+            break;
+        }
+        queue_push(&ready_queue, b);
+        if (credit_frame(conn, &cs, batch_size) < 0) {
+            break;
+        }
+    }
+    if (arena_full(&data_arena)) {
+        credit_stop(conn, &cs);
+    }
+    if (session_codec != CODEC_RAW) {
+        buf_free(scratch, codec_bound((uint32_t)batch_size));
+        buf_free(decoded, direct_mode ? (size_t)batch_size * sizeof(value_t) : 0);
+    }
+    // Once every receiver is done, let the workers drain the queue and exit
+    if (atomic_fetch_sub(&active_receivers, 1) == 1) {
+        queue_close(&ready_queue);
+    }
+    return NULL;
+}
+
+/*
+ * Worker threads: reserve room for a batch with one atomic add, then copy
+ * it into chunks this thread owns, so inserts from different threads
+ * proceed in parallel without sharing cache lines. Ordered, each batch
+ * is copied to its position instead, whichever worker gets it.
+ */
+void *consumer_thread_func(void *arg) {
+    (void)arg;
+    STATS_REGISTER("worker");
+    LOCKPROF_THREAD("worker");
+    struct log_stream *log = open_log_stream();
+    struct arena_writer writer;
+    arena_writer_init(&writer, &data_arena);
+    struct hist lat;
+    hist_reset(&lat);
+
+    struct batch *b;
+    while ((b = queue_pop(&ready_queue)) != NULL) {
+        uint32_t count = reserve_values(b->seq, b->count);
+        if (store_values(&writer, b->seq, b->values, count) < 0) {
+            perror("arena chunk");
+            count = 0;
+        }
+        log_values(log, b->values, count);
+        STAT_ADD(STAT_ELEMENTS, count);
+        record_latency(&lat, b->stamp, count);
+        // The event loop sizes every batch to its frame: back to the pool
+        if (server_mode) {
+            buf_free(b, batch_bytes(b->count));
+        } else {
+            queue_push(&free_queue, b);
+        }
+    }
+    arena_writer_finish(&writer);
+    merge_latency(&lat);
+    return NULL;
+}
+
+// The codec we take for a hello: the one asked for if we know it and
+// there are frames to code
+static int accepted_codec(const struct hello *h) {
+    uint32_t codec = ntohl(h->codec);
+    return codec_available((int)codec) && h->batch_size != 0 ? (int)codec : CODEC_RAW;
+}
+
+// The credit window we grant for a hello: what it asks for, within
+// MAX_WINDOW; bare values have no frames to count
+static uint32_t accepted_window(const struct hello *h) {
+    uint32_t window = ntohl(h->window);
+    return h->batch_size == 0 ? 0 : window < MAX_WINDOW ? window : MAX_WINDOW;
+}
+
+// The HELLO_* requests we honour: ordered storage needs frames and one
+// producer per arena, so not in server mode; acks need ordered storage,
+// credits to ride on and a --persist file to make them durable
+static uint32_t accepted_flags(const struct hello *h) {
+    uint32_t flags = ntohl(h->flags);
+    if (h->batch_size == 0 || server_mode || !(flags & HELLO_ORDERED)) {
+        return 0;
+    }
+    return accepted_window(h) > 0 && persist_path ? flags & (HELLO_ORDERED | HELLO_ACKS)
+                                                  : HELLO_ORDERED;
+}
+
+// Check a received hello; returns 0 or -1
+static int check_hello(const struct hello *h) {
+    if (ntohl(h->magic) != PROTO_MAGIC || ntohl(h->version) != PROTO_VERSION) {
+        fprintf(stderr, "Bad or missing hello from producer\n");
+        return -1;
+    }
+    if (ntohl(h->value_bits) != VALUE_BITS) {
+        fprintf(stderr, "Producer sends %u-bit values, this consumer takes %d-bit ones "
+                "(make WIDTH=)\n", ntohl(h->value_bits), VALUE_BITS);
+        return -1;
+    }
+    uint32_t batch = ntohl(h->batch_size);
+    uint16_t count = ntohs(h->conn_count);
+    if (batch > MAX_BATCH || count == 0 || count > MAX_CONNS || ntohs(h->conn_id) >= count) {
+        fprintf(stderr, "Bad hello: batch size %u, connection %u of %u\n",
+                batch, ntohs(h->conn_id), count);
+        return -1;
+    }
+    // A resumed session continues a checkpointed one, at a block boundary
+    uint64_t start = ntoh64(h->start);
+    uint64_t limit = ntoh64(h->limit);
+    if (start > 0 && (start % CHECKPOINT_VALUES != 0 || (limit != 0 && start >= limit) ||
+                      !(accepted_flags(h) & HELLO_ACKS))) {
+        fprintf(stderr, "Bad hello: can't resume at %llu (checkpointing needs ordered frames, "
+                "a credit window, --persist and no --server)\n", (unsigned long long)start);
+        return -1;
+    }
+    return 0;
+}
+
+// Answer a checked hello; returns 0 or -1
+static int ack_hello(struct transport *conn, const struct hello *h) {
+    struct hello_ack ack;
+    ack.magic = htonl(PROTO_MAGIC);
+    ack.codec = htonl((uint32_t)accepted_codec(h));
+    ack.window = htonl(accepted_window(h));
+    ack.flags = htonl(accepted_flags(h));
+    if (transport_send(conn, &ack, sizeof(ack)) < 0) {
+        perror("send hello ack");
+        return -1;
+    }
+    return 0;
+}
+
+// Read, check and answer a connection's hello; returns 0 or -1
+static int read_hello(struct transport *conn, struct hello *h) {
+    if (transport_recv(conn, h, sizeof(*h)) != (ssize_t)sizeof(*h)) {
+        fprintf(stderr, "Bad or missing hello from producer\n");
+        return -1;
+    }
+    return check_hello(h) < 0 ? -1 : ack_hello(conn, h);
+}
+
+static void close_conns(void) {
+    for (int i = 0; i < MAX_CONNS; i++) {
+        if (conns[i].fd >= 0) {
+            transport_close(&conns[i]);
+        }
+    }
+}
+
+// --daemon: connections of other producer sessions that came in while one
+// was being assembled. Their hellos are read and answered; the producers
+// wait for their turn in the socket buffers and are served next
+static struct parked_conn {
+    struct transport conn;
+    struct hello hello;
+} parked[MAX_CONNS];
+static int num_parked = 0;
+
+// Take a parked connection of match's session (any if match is NULL)
+static int unpark(const struct hello *match, struct transport *conn, struct hello *h) {
+    for (int i = 0; i < num_parked; i++) {
+        if (!match || parked[i].hello.session == match->session) {
+            *conn = parked[i].conn;
+            *h = parked[i].hello;
+            parked[i] = parked[--num_parked];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void close_parked(void) {
+    while (num_parked > 0) {
+        transport_close(&parked[--num_parked].conn);
+    }
+}
+
+// Next connection of match's session: a parked one, else newly accepted
+// ones until it turns up. Those of other sessions are parked with
+// --daemon and turned away otherwise, where only one session is served.
+// Returns 0, or -1 if accept or a hello failed
+static int next_conn(struct transport_listener *l, const struct hello *match,
+                     struct transport *conn, struct hello *h) {
+    if (unpark(match, conn, h) == 0) {
+        return 0;
+    }
+    while (1) {
+        if (transport_accept(l, conn) < 0) {
+            perror(timed_out ? "accept timed out" : "accept failed");
+            return -1;
+        }
+        if (read_hello(conn, h) < 0) {
+            transport_close(conn);
+            return -1;
+        }
+        if (h->session == match->session) {
+            return 0;
+        }
+        if (daemon_mode && num_parked < MAX_CONNS) {
+            parked[num_parked].conn = *conn;
+            parked[num_parked++].hello = *h;
+        } else {
+            fprintf(stderr, "Connection does not belong to this producer session\n");
+            transport_close(conn);
+        }
+    }
+}
+
+// Start the worker pool; returns how many threads are running. Workers
+// get the CPUs after the receivers'
+static int start_workers(pthread_t *threads) {
+    int created = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (thread_create_on(&threads[i], cpu_list_pick(&cpus, num_conns + i),
+                             consumer_thread_func, NULL) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        created++;
+    }
+    return created;
+}
+
+/*
+ * --server: one producer connection owned by the event loop. Bytes are
+ * read into buf as they arrive; every complete frame is cut out, turned
+ * into a batch for the workers and the remainder moved to the front.
+ */
+struct client {
+    struct transport t;
+    int greeted;            // hello seen, batch_size, codec and credit valid
+    int batch_size;
+    int codec;
+    struct credit_state credit;
+    unsigned long id;       // order of arrival, labels its --metrics counters
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    struct client *prev;
+    struct client *next;
+};
+
+static struct client *clients = NULL;   // every open connection
+static unsigned long clients_served = 0;
+static volatile sig_atomic_t stop_server = 0;
+
+void stop_handler(int sig) {
+    (void)sig;
+    stop_server = 1;
+}
+
+// A batch sized for count host-order values converted from net (left
+// for the caller to fill if net is NULL)
+static struct batch *make_batch(const unsigned char *net, uint32_t count, uint64_t seq,
+                                uint64_t stamp) {
+    struct batch *b = buf_alloc(batch_bytes(count));
+    if (!b) {
+        perror("malloc batch");
+        return NULL;
+    }
+    if (net) {
+        memcpy(b->values, net, count * sizeof(value_t));
+        for (uint32_t i = 0; i < count; i++) {
+            b->values[i] = value_ntoh(b->values[i]);
+        }
+    }
+    b->count = count;
+    b->seq = seq;
+    b->stamp = stamp;
+    return b;
+}
+
+// Hand every complete frame in the buffer to the workers; returns 0, or
+// -1 if the client has to be dropped
+static int client_parse(struct client *c) {
+    size_t pos = 0;
+    if (!c->greeted) {
+        if (c->len < sizeof(struct hello)) {
+            return 0;
+        }
+        struct hello h;
+        memcpy(&h, c->buf, sizeof(h));
+        if (check_hello(&h) < 0 || ack_hello(&c->t, &h) < 0) {
+            return -1;
+        }
+        c->greeted = 1;
+        c->batch_size = (int)ntohl(h.batch_size);
+        c->codec = accepted_codec(&h);
+        credit_init(&c->credit, accepted_window(&h));
+        pos = sizeof(h);
+        // Room for at least one whole frame, raw or coded
+        size_t payload = (size_t)c->batch_size * sizeof(value_t);
+        if (c->codec != CODEC_RAW && codec_bound((uint32_t)c->batch_size) > payload) {
+            payload = codec_bound((uint32_t)c->batch_size);
+        }
+        size_t want = sizeof(struct frame_hdr) + FRAME_EXTRA_MAX + payload;
+        if (want > c->cap) {
+            unsigned char *buf = realloc(c->buf, want);
+            if (!buf) {
+                perror("realloc client buffer");
+                return -1;
+            }
+            c->buf = buf;
+            c->cap = want;
+        }
+    }
+
+    if (c->batch_size == 0) {
+        // Bare values: take whatever whole values have arrived
+        uint32_t count = (uint32_t)((c->len - pos) / sizeof(value_t));
+        if (count > 0) {
+            struct batch *b = make_batch(c->buf + pos, count, UINT64_MAX, 0);
+            if (!b) {
+                return -1;
+            }
+            queue_push(&ready_queue, b);
+            pos += count * sizeof(value_t);
+        }
+    }
+    while (c->batch_size > 0 && c->len - pos >= sizeof(struct frame_hdr)) {
+        struct frame_hdr hdr;
+        memcpy(&hdr, c->buf + pos, sizeof(hdr));
+        uint32_t count = ntohl(hdr.count);
+        uint32_t flags = ntohl(hdr.flags);
+        if (check_frame(count, flags, c->batch_size, c->codec) < 0) {
+            return -1;
+        }
+        size_t extra = frame_extra(flags);
+        if (c->len - pos < sizeof(hdr) + extra) {
+            break;
+        }
+        uint64_t stamp;
+        uint32_t coded_len;
+        if (parse_frame_extra(c->buf + pos + sizeof(hdr), flags, count, &stamp, &coded_len) < 0) {
+            return -1;
+        }
+        size_t need = sizeof(hdr) + extra + (coded_len > 0 ? coded_len : count * sizeof(value_t));
+        if (c->len - pos < need) {
+            break;
+        }
+        const unsigned char *payload = c->buf + pos + sizeof(hdr) + extra;
+        struct batch *b = coded_len > 0 ? make_batch(NULL, count, ntoh64(hdr.seq), stamp)
+                                        : make_batch(payload, count, ntoh64(hdr.seq), stamp);
+        if (!b) {
+            return -1;
+        }
+        if (coded_len > 0 && codec_decode((enum codec)c->codec, payload, coded_len,
+                                          b->values, count) < 0) {
+            fprintf(stderr, "Bad %s frame: %u bytes do not decode to %u values\n",
+                    codec_name((enum codec)c->codec), coded_len, count);
+            buf_free(b, batch_bytes(count));
+            return -1;
+        }
+        queue_push(&ready_queue, b);
+        pos += need;
+        if (credit_frame(&c->t, &c->credit, c->batch_size) < 0) {
+            return -1;
+        }
+    }
+    memmove(c->buf, c->buf + pos, c->len - pos);
+    c->len -= pos;
+    if (arena_full(&data_arena)) {
+        fprintf(stderr, "Storage full, stopping producer\n");
+        credit_stop(&c->t, &c->credit);
+        return -1;
+    }
+    return 0;
+}
+
+static void client_drop(int pfd, struct client *c) {
+    poller_del(pfd, c->t.fd);
+    transport_close(&c->t);
+    // A scrape walks the list
+    LOCK(&metrics_mutex, "metrics_mutex");
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        clients = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    UNLOCK(&metrics_mutex);
+    free(c->buf);
+    free(c);
+}
+
+// One read per readiness event keeps the loop fair across clients
+static void client_readable(int pfd, struct client *c) {
+    STAT_TIMER(start);
+    STAT_ADD(STAT_SYSCALLS, 1);
+    ssize_t n = read(c->t.fd, c->buf + c->len, c->cap - c->len);
+    STAT_SINCE(STAT_RECV_NS, start);
+    STAT_ADD(STAT_BYTES_RECEIVED, n > 0 ? n : 0);
+    transport_count_received(&c->t, n > 0 ? (size_t)n : 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        if (n < 0) {
+            perror("recv failed");
+        } else if (c->len > 0) {
+            fprintf(stderr, "Partial read from socket\n");
+        }
+        client_drop(pfd, c);
+        return;
+    }
+    c->len += (size_t)n;
+    if (client_parse(c) < 0) {
+        client_drop(pfd, c);
+    }
+}
+
+// Take every pending connection off the non-blocking listener
+static void accept_clients(int pfd, struct transport_listener *l) {
+    while (1) {
+        struct client *c = calloc(1, sizeof(*c));
+        if (!c || !(c->buf = malloc(CLIENT_BUF_MIN))) {
+            perror("malloc client");
+            free(c);
+            return;
+        }
+        c->cap = CLIENT_BUF_MIN;
+        if (transport_accept(l, &c->t) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept failed");
+            }
+            free(c->buf);
+            free(c);
+            return;
+        }
+        fcntl(c->t.fd, F_SETFL, fcntl(c->t.fd, F_GETFL) | O_NONBLOCK);
+        if (poller_add(pfd, c->t.fd, c) < 0) {
+            perror("poller_add");
+            transport_close(&c->t);
+            free(c->buf);
+            free(c);
+            continue;
+        }
+        LOCK(&metrics_mutex, "metrics_mutex");
+        c->next = clients;
+        if (clients) {
+            clients->prev = c;
+        }
+        clients = c;
+        c->id = clients_served++;
+        UNLOCK(&metrics_mutex);
+    }
+}
+
+// SIGINT/SIGTERM set stop_server. No SA_RESTART: a signal has to
+// interrupt the wait
+static void catch_stop_signals(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+/*
+ * --server event loop: runs on the main thread until SIGINT/SIGTERM.
+ * Only this thread reads sockets; parsed frames go to the workers
+ * through ready_queue, which also throttles reading when they fall
+ * behind. Returns 0, or -1 if the poller can't be set up.
+ */
+static int run_server(struct transport_listener *l) {
+    // Thousands of producers need as many descriptors as we may have
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    catch_stop_signals();
+
+    int pfd = poller_create();
+    if (pfd < 0) {
+        perror("poller_create");
+        return -1;
+    }
+    fcntl(l->fd, F_SETFL, fcntl(l->fd, F_GETFL) | O_NONBLOCK);
+    if (poller_add(pfd, l->fd, l) < 0) {
+        perror("poller_add");
+        close(pfd);
+        return -1;
+    }
+
+    struct poller_event events[POLLER_MAX_EVENTS];
+    while (!stop_server) {
+        // The timeout bounds how long a signal just before the wait goes unseen
+        int n = poller_wait(pfd, events, POLLER_MAX_EVENTS, 500);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poller_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].ptr == l) {
+                accept_clients(pfd, l);
+            } else {
+                client_readable(pfd, events[i].ptr);
+            }
+        }
+    }
+    while (clients) {
+        client_drop(pfd, clients);
+    }
+    close(pfd);
+    return 0;
+}
+
+/*
+ * Show scrapes the running session's arena and connections (live), or
+ * hide them before they go away; a finished session's totals carry over.
+ * Runs on session setup and teardown only.
+ */
+static void metrics_session(int live) {
+    LOCK(&metrics_mutex, "metrics_mutex");
+    if (live) {
+        sessions_started++;
+    } else if (metrics_live) {
+        values_before += arena_taken(&data_arena);
+        cas_lost_before += arena_cas_lost(&data_arena);
+    }
+    metrics_live = live;
+    UNLOCK(&metrics_mutex);
+}
+
+static uint64_t queue_depth(struct batch_queue *q) {
+    return (uint64_t)atomic_load_explicit(&q->depth, memory_order_relaxed);
+}
+
+static uint64_t queue_contended(struct batch_queue *q) {
+    return atomic_load_explicit(&q->contended, memory_order_relaxed);
+}
+
+static uint64_t queue_waits(struct batch_queue *q) {
+    return atomic_load_explicit(&q->waits, memory_order_relaxed);
+}
+
+// One metric with a sample per hand-off queue
+static void queue_metric(FILE *out, const char *metric, const char *type, const char *help,
+                         uint64_t (*get)(struct batch_queue *)) {
+    struct batch_queue *queues[] = { &ready_queue, &free_queue };
+    metrics_describe(out, metric, type, help);
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++) {
+        fprintf(out, "%s{queue=\"%s\"} %llu\n", metric, queues[i]->name,
+                (unsigned long long)get(queues[i]));
+    }
+}
+
+/*
+ * The --metrics page, on the metrics thread. It reads atomics the hot
+ * paths publish (arena reservations, queue depths, byte counts) and
+ * takes only metrics_mutex, which receivers and workers never touch:
+ * sessions take it to start and end, the event loop to add and drop
+ * clients. The ingest rate is over the time since the previous scrape.
+ */
+static void write_metrics(FILE *out, void *ctx) {
+    (void)ctx;
+    LOCK(&metrics_mutex, "metrics_mutex");
+    uint64_t total = values_before + (metrics_live ? arena_taken(&data_arena) : 0);
+    uint64_t now = now_ns();
+    double rate = now > scraped_ns
+        ? (double)(total - scraped_total) * 1e9 / (double)(now - scraped_ns) : 0.0;
+    scraped_ns = now;
+    scraped_total = total;
+
+    metrics_describe(out, "consumer_values_received_total", "counter",
+                     "Values taken into storage.");
+    fprintf(out, "consumer_values_received_total %llu\n", (unsigned long long)total);
+    metrics_describe(out, "consumer_ingest_values_per_second", "gauge",
+                     "Values taken in per second since the previous scrape.");
+    fprintf(out, "consumer_ingest_values_per_second %.1f\n", rate);
+    if (!server_mode) {
+        metrics_describe(out, "consumer_sessions_total", "counter", "Producer sessions started.");
+        fprintf(out, "consumer_sessions_total %lu\n", sessions_started);
+    }
+
+    metrics_describe(out, "consumer_queue_capacity", "gauge",
+                     "Batches a receiver/worker hand-off queue holds.");
+    fprintf(out, "consumer_queue_capacity %d\n", QUEUE_DEPTH);
+    queue_metric(out, "consumer_queue_depth", "gauge",
+                 "Batches in a receiver/worker hand-off queue.", queue_depth);
+    queue_metric(out, "consumer_queue_lock_contended_total", "counter",
+                 "Queue mutex acquisitions that found it taken.", queue_contended);
+    queue_metric(out, "consumer_queue_waits_total", "counter",
+                 "Pushes that found the queue full and pops that found it empty.", queue_waits);
+
+    metrics_describe(out, "consumer_connection_received_bytes_total", "counter",
+                     "Bytes received on each producer connection.");
+    unsigned long open = 0;
+    if (server_mode) {
+        for (struct client *c = clients; c; c = c->next, open++) {
+            fprintf(out, "consumer_connection_received_bytes_total{conn=\"%lu\"} %llu\n", c->id,
+                    (unsigned long long)transport_received(&c->t));
+        }
+    } else if (metrics_live) {
+        for (int i = 0; i < num_conns; i++, open++) {
+            fprintf(out, "consumer_connection_received_bytes_total{conn=\"%d\"} %llu\n", i,
+                    (unsigned long long)transport_received(&conns[i]));
+        }
+    }
+    metrics_describe(out, "consumer_connections", "gauge", "Open producer connections.");
+    fprintf(out, "consumer_connections %lu\n", open);
+
+    metrics_describe(out, "consumer_arena_bytes", "gauge",
+                     "Memory held by the storage arena's chunks.");
+    fprintf(out, "consumer_arena_bytes %zu\n", metrics_live ? arena_bytes(&data_arena) : 0);
+    metrics_describe(out, "consumer_arena_cas_lost_total", "counter",
+                     "Ordered-storage CASes lost to another writer.");
+    fprintf(out, "consumer_arena_cas_lost_total %llu\n",
+            (unsigned long long)(cas_lost_before + (metrics_live ? arena_cas_lost(&data_arena) : 0)));
+    if (metrics_live && persisting) {
+        metrics_describe(out, "consumer_persisted_values", "gauge",
+                         "Values of this session synced to the --persist file.");
+        fprintf(out, "consumer_persisted_values %llu\n", (unsigned long long)sink_durable(&sink));
+    }
+    UNLOCK(&metrics_mutex);
+}
+
+// arena_on_full() hook: every full chunk goes to the stages and the sink
+static void chunk_full(void *ctx, size_t slot, const value_t *values, uint32_t count) {
+    (void)ctx;
+    if (persisting) {
+        sink_chunk(&sink, slot, values, count);
+    }
+    if (staged) {
+        pipeline_chunk(&pipeline, slot, values, count);
+    }
+}
+
+// Open --stage and --persist for a fresh arena whose slot 0 holds position
+// start; returns 0 or -1
+static int downstream_open(struct arena *a, int ordered, uint64_t start, int acks) {
+    if (stage_list) {
+        if (pipeline_open(&pipeline, stage_list, &stage_pool, ordered) < 0) {
+            return -1;
+        }
+        staged = 1;
+    }
+    if (persist_path) {
+        if (sink_open(&sink, persist_path, ordered, start, acks) < 0) {
+            perror(persist_path);
+            if (staged) {
+                pipeline_close(&pipeline);
+                staged = 0;
+            }
+            return -1;
+        }
+        persisting = 1;
+    }
+    arena_on_full(a, staged || persisting ? chunk_full : NULL, NULL);
+    return 0;
+}
+
+// Once every value is in a: finish and close both; returns 0, or -1 if
+// either failed
+static int downstream_close(struct arena *a) {
+    int rc = 0;
+    if (persisting && sink_finish(&sink, a) < 0) {
+        rc = -1;
+    }
+    if (staged && pipeline_finish(&pipeline, a) < 0) {
+        rc = -1;
+    }
+    if (staged) {
+        pipeline_close(&pipeline);
+    }
+    staged = 0;
+    persisting = 0;
+    arena_on_full(a, NULL, NULL);
+    return rc;
+}
+
+// --reload: run the stages over a --persist file, mapped in place
+static int run_reload(const char *path, int log_level, unsigned long long log_every) {
+    struct sink_view v;
+    if (sink_map(&v, path) < 0) {
+        return -1;
+    }
+    if (log_init((enum log_level)log_level, log_every) < 0) {
+        perror("log_init");
+        sink_unmap(&v);
+        return -1;
+    }
+    log_summary("Consumer PID %d reloaded %llu data elements from %s\n", getpid(),
+                (unsigned long long)v.count, path);
+    int rc = 0;
+    if (stage_list) {
+        if (pipeline_open(&pipeline, stage_list, &stage_pool, v.ordered) < 0) {
+            rc = -1;
+        } else {
+            for (uint64_t pos = 0; pos < v.count; pos += ARENA_CHUNK_VALUES) {
+                uint64_t left = v.count - pos;
+                pipeline_chunk(&pipeline, (size_t)(pos / ARENA_CHUNK_VALUES), v.values + pos,
+                               left < ARENA_CHUNK_VALUES ? (uint32_t)left : ARENA_CHUNK_VALUES);
+            }
+            rc = pipeline_finish(&pipeline, NULL);
+            pipeline_close(&pipeline);
+        }
+    }
+    log_shutdown();
+    sink_unmap(&v);
+    return rc;
+}
+
+// What every session of this consumer runs with, from the command line
+struct session_opts {
+    int io;
+    int numa_local;
+    int direct;
+    int log_level;
+    unsigned long long log_every;
+};
+
+/*
+ * Serve one producer session from l: accept its connections, receive
+ * and store everything it sends into a fresh arena, print the summary
+ * and free it all again, so nothing carries over into the next session.
+ * The listener stays open with --daemon and is closed otherwise once the
+ * session's connections are in. Returns 0, 1 if no producer came (the
+ * one-shot timeout, or a stop signal with --daemon), or -1 on failure.
+ */
+static int run_session(struct transport_listener *l, const struct session_opts *o) {
+    // A one-shot consumer gives its producer 5 seconds to connect; with
+    // --daemon the wait for the first connection is open-ended and only
+    // the rest of the session has to follow within the timeout
+    timed_out = 0;
+    if (!daemon_mode) {
+        alarm(5);
+    }
+    // The timeout bounds how long a stop signal just before the wait goes unseen
+    // A session parked during the last one is already waiting
+    struct pollfd p = { .fd = l->fd, .events = POLLIN };
+    while (daemon_mode && num_parked == 0 && poll(&p, 1, 500) <= 0) {
+        if (stop_server) {
+            return 1;
+        }
+    }
+
+    // Accept connection from producer, then the rest of its session
+    struct hello hello;
+    for (int i = 0; i < MAX_CONNS; i++) {
+        conns[i].fd = -1;
+    }
+    struct transport conn;
+    if (unpark(NULL, &conn, &hello) == 0) {
+        // Hello already read and answered
+    } else if (transport_accept(l, &conn) < 0) {
+        if (timed_out) {
+            fprintf(stderr, "No producer connected within timeout period\n");
+            return 1; // Exit gracefully
+        } else if (daemon_mode && errno == EINTR) {
+            return 1;
+        }
+        perror("accept failed");
+        if (daemon_mode) {
+            usleep(10000);  // Don't spin on a persistent error (EMFILE)
+        }
+        return -1;
+    } else if (read_hello(&conn, &hello) < 0) {
+        // The hello tells us the framing, how much data to expect and how
+        // many connections the producer opens
+        transport_close(&conn);
+        return -1;
+    }
+    if (daemon_mode) {
+        alarm(5);
+    }
+    num_conns = ntohs(hello.conn_count);
+    conns[ntohs(hello.conn_id)] = conn;
+    for (int i = 1; i < num_conns; i++) {
+        struct hello more;
+        if (next_conn(l, &hello, &conn, &more) < 0) {
+            alarm(0);
+            close_conns();
+            return -1;
+        }
+        int id = ntohs(more.conn_id);
+        if (more.conn_count != hello.conn_count ||
+            more.batch_size != hello.batch_size || more.codec != hello.codec ||
+            more.window != hello.window || more.flags != hello.flags ||
+            more.start != hello.start || conns[id].fd >= 0) {
+            fprintf(stderr, "Connection does not belong to this producer session\n");
+            alarm(0);
+            transport_close(&conn);
+            close_conns();
+            return -1;
+        }
+        conns[id] = conn;
+    }
+    alarm(0); // Cancel alarm
+    if (!daemon_mode) {
+        transport_listener_close(l); // No longer need the listening socket
+    }
+    for (int i = 0; i < num_conns; i++) {
+        transport_set_io(&conns[i], (enum transport_io)o->io);
+    }
+
+    batch_size = (int)ntohl(hello.batch_size);
+    session_codec = accepted_codec(&hello);
+    session_window = accepted_window(&hello);
+    ordered_mode = (accepted_flags(&hello) & HELLO_ORDERED) != 0;
+    session_acks = (accepted_flags(&hello) & HELLO_ACKS) != 0;
+    session_start = ntoh64(hello.start);
+    direct_mode = batch_size > 0 && o->direct;   // Bare values: nothing to place in bulk
+    // The limit counts positions from 0, the arena only this session's
+    uint64_t limit = ntoh64(hello.limit);
+    if (arena_init(&data_arena, limit > 0 ? limit - session_start : 0) < 0) {
+        perror("arena_init");
+        close_conns();
+        return -1;
+    }
+    arena_set_local(&data_arena, o->numa_local);
+    arena_set_ordered(&data_arena, ordered_mode);
+    metrics_session(1);
+    hist_reset(&latency);
+    queue_reset(&ready_queue);
+    queue_reset(&free_queue);
+
+    // Preallocate the batches that circulate between receiver and workers
+    size_t batch_values = batch_size > 0 ? (size_t)batch_size : 1;
+    struct batch *batches[QUEUE_DEPTH] = { NULL };
+    int rc = -1;
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        batches[i] = buf_alloc(batch_bytes(batch_values));
+        if (!batches[i]) {
+            perror("malloc batch");
+            goto out;
+        }
+        queue_push(&free_queue, batches[i]);
+    }
+    if (downstream_open(&data_arena, ordered_mode, session_start, session_acks) < 0) {
+        goto out;
+    }
+
+    // Background writer for the status lines
+    if (log_init((enum log_level)o->log_level, o->log_every) < 0) {
+        perror("log_init");
+        goto out;
+    }
+
+    // Create consumer threads
+    pthread_t threads[MAX_WORKERS];
+    int created = start_workers(threads);
+    if (created == 0) {
+        log_shutdown();
+        goto out;
+    }
+
+    // One receiver owns each socket; without any, just let workers exit
+    pthread_t receivers[MAX_CONNS];
+    int receiving = 0;
+    atomic_store(&active_receivers, num_conns);
+    for (int i = 0; i < num_conns; i++) {
+        if (thread_create_on(&receivers[receiving], cpu_list_pick(&cpus, i),
+                             receiver_thread_func, &conns[i]) != 0) {
+            perror("pthread_create");
+            // Stand in for the receiver that never ran
+            if (atomic_fetch_sub(&active_receivers, 1) == 1) {
+                queue_close(&ready_queue);
+            }
+            continue;
+        }
+        receiving++;
+    }
+    for (int i = 0; i < receiving; i++) {
+        pthread_join(receivers[i], NULL);
+    }
+    //appropriate code to handle thread exit
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    log_shutdown();
+    log_summary("Consumer PID %d inserted %llu data elements\n", getpid(),
+                (unsigned long long)arena_count(&data_arena));
+    report_latency();
+    if (ordered_mode && arena_in_order(&data_arena) != arena_end(&data_arena)) {
+        // A connection ended early: positions are missing
+        fprintf(stderr, "Ordered storage has gaps: %llu values in order, then holes up to %llu\n",
+                (unsigned long long)arena_in_order(&data_arena),
+                (unsigned long long)arena_end(&data_arena));
+    }
+    rc = 0;
+out:
+    // Close sockets and cleanup
+    metrics_session(0);
+    close_conns();
+    if ((staged || persisting) && downstream_close(&data_arena) < 0) {
+        rc = -1;
+    }
+    arena_destroy(&data_arena);
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        buf_free(batches[i], batch_bytes(batch_values));
+    }
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN); // A producer may be gone before our last credit reaches it
+    int log_level = LOG_ALL;
+    unsigned long long log_every = LOG_DEFAULT_EVERY;
+    int kind = TRANSPORT_TCP;
+    int io = TRANSPORT_IO_BLOCKING;
+    const char *socket_path = TRANSPORT_DEFAULT_PATH;
+    char tcp_addr[16] = "";     // --port, as a transport address
+    int numa_local = 0;
+    int ready_fd = -1;
+    const char *reload_path = NULL;
+    static const struct option long_opts[] = {
+        { "log", required_argument, NULL, 'L' },
+        { "log-every", required_argument, NULL, 'E' },
+        { "transport", required_argument, NULL, 'T' },
+        { "socket", required_argument, NULL, 'S' },
+        { "port", required_argument, NULL, 'p' },
+        { "direct", no_argument, NULL, 'D' },
+        { "io", required_argument, NULL, 'I' },
+        { "server", no_argument, NULL, 'R' },
+        { "daemon", no_argument, NULL, 'd' },
+        { "workers", required_argument, NULL, 'W' },
+        { "cpus", required_argument, NULL, 'C' },
+        { "numa", no_argument, NULL, 'N' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "ready-fd", required_argument, NULL, 'Y' },
+        { "stage", required_argument, NULL, 'P' },
+        { "persist", required_argument, NULL, 'O' },
+        { "reload", required_argument, NULL, 'Z' },
+        { "metrics", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'L':
+            log_level = log_parse_level(optarg);
+            if (log_level < 0) {
+                fprintf(stderr, "Invalid log level '%s' (quiet, summary, sample, all)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'E': {
+            long long every = parse_count(optarg, 1, INT64_MAX);
+            if (every < 0) {
+                fprintf(stderr, "Invalid log interval '%s' (1 or more)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            log_every = (unsigned long long)every;
+            break;
+        }
+        case 'T':
+            kind = transport_parse_kind(optarg);
+            if (kind < 0) {
+                fprintf(stderr, "Invalid transport '%s' (tcp, unix, shm)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'p': {
+            char *end;
+            long port = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || port < 1 || port > 65535) {
+                fprintf(stderr, "Invalid port '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            snprintf(tcp_addr, sizeof(tcp_addr), ":%ld", port);
+            break;
+        }
+        case 'D':
+            direct_mode = 1;
+            break;
+        case 'I':
+            io = transport_parse_io(optarg);
+            if (io < 0) {
+                fprintf(stderr, "Invalid I/O engine '%s' (blocking, uring)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            server_mode = 1;
+            break;
+        case 'd':
+            daemon_mode = 1;
+            break;
+        case 'W':
+            num_workers = (int)parse_count(optarg, 1, MAX_WORKERS);
+            if (num_workers < 1 || num_workers > MAX_WORKERS) {
+                fprintf(stderr, "Invalid worker count '%s' (1..%d)\n", optarg, MAX_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            if (cpu_list_parse(&cpus, optarg) < 0) {
+                fprintf(stderr, "Invalid CPU list '%s' (e.g. 0-3,8)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'N':
+            numa_local = 1;
+            break;
+        case 'H':
+            bufpool_init(1);
+            break;
+        case 'Y':
+            // Only ever a pipe the producer left open for us
+            ready_fd = (int)parse_count(optarg, 0, INT32_MAX);
+            if (ready_fd < 0 || fcntl(ready_fd, F_GETFD) < 0) {
+                fprintf(stderr, "Invalid ready descriptor '%s' (an open file descriptor)\n",
+                        optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            if (pipeline_check(optarg) < 0) {
+                exit(EXIT_FAILURE);
+            }
+            stage_list = optarg;
+            break;
+        case 'O':
+            persist_path = optarg;
+            break;
+        case 'Z':
+            reload_path = optarg;
+            break;
+        case 'M':
+            metrics_addr = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--log level] [--log-every N] [--transport tcp|unix|shm]\n"
+                    "       [--socket path] [--port N] [--direct] [--io blocking|uring] [--server | --daemon]\n"
+                    "       [--workers N] [--cpus list] [--numa] [--huge-pages] [--ready-fd N] [--stage list]\n"
+                    "       [--persist path | --reload path] [--metrics addr]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    STATS_START("Consumer");
+    LOCKPROF_THREAD("main");
+
+    if (server_mode && daemon_mode) {
+        fprintf(stderr, "--server and --daemon exclude each other\n");
+        exit(EXIT_FAILURE);
+    }
+    if (server_mode && kind == TRANSPORT_SHM) {
+        fprintf(stderr, "--server needs a socket transport (tcp or unix)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (reload_path && (persist_path || server_mode || daemon_mode || metrics_addr)) {
+        fprintf(stderr, "--reload excludes --persist, --server, --daemon and --metrics\n");
+        exit(EXIT_FAILURE);
+    }
+    // Unpinned: pool threads go wherever the receivers and workers leave room
+    if (stage_list && pool_init(&stage_pool, num_workers) < 0) {
+        perror("pool_init");
+        exit(EXIT_FAILURE);
+    }
+    if (reload_path) {
+        int rc = run_reload(reload_path, log_level, log_every);
+        if (stage_list) {
+            pool_destroy(&stage_pool);
+        }
+        STATS_STOP();
+        return rc < 0 ? EXIT_FAILURE : 0;
+    }
+
+    // Setup socket to accept connection from producer
+    struct transport_listener listener;
+    const char *where = kind != TRANSPORT_TCP ? socket_path : tcp_addr[0] ? tcp_addr : NULL;
+    if (transport_listen(&listener, (enum transport_kind)kind, where,
+                         server_mode ? SOMAXCONN : MAX_CONNS) < 0) {
+        perror("listen failed");
+        exit(EXIT_FAILURE);
+    }
+    scraped_ns = now_ns();
+    if (metrics_addr && metrics_start(metrics_addr, write_metrics, NULL) < 0) {
+        perror(metrics_addr);
+        transport_listener_close(&listener);
+        exit(EXIT_FAILURE);
+    }
+    signal_ready(ready_fd);
+
+    if (server_mode) {
+        // Long-lived: store everything any producer sends until stopped
+        pthread_t threads[MAX_WORKERS];
+        direct_mode = 0;
+        if (arena_init(&data_arena, 0) < 0) {
+            perror("arena_init");
+            exit(EXIT_FAILURE);
+        }
+        arena_set_local(&data_arena, numa_local);
+        metrics_session(1);
+        if (downstream_open(&data_arena, 0, 0, 0) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (log_init((enum log_level)log_level, log_every) < 0) {
+            perror("log_init");
+            exit(EXIT_FAILURE);
+        }
+        int created = start_workers(threads);
+        int rc = created > 0 ? run_server(&listener) : -1;
+        transport_listener_close(&listener);
+        queue_close(&ready_queue);
+        for (int i = 0; i < created; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        log_shutdown();
+        log_summary("Consumer PID %d inserted %llu data elements from %lu connections\n",
+                    getpid(), (unsigned long long)arena_count(&data_arena), clients_served);
+        report_latency();
+        if (downstream_close(&data_arena) < 0) {
+            rc = -1;
+        }
+        if (stage_list) {
+            pool_destroy(&stage_pool);
+        }
+        metrics_stop();
+        metrics_session(0);
+        STATS_STOP();
+        LOCKPROF_REPORT("Consumer");
+        arena_destroy(&data_arena);
+        queue_destroy(&ready_queue);
+        queue_destroy(&free_queue);
+        return rc < 0 ? EXIT_FAILURE : 0;
+    }
+
+    struct session_opts opts = { io, numa_local, direct_mode, log_level, log_every };
+    // Not SA_RESTART (which signal() implies on Linux and macOS): accept()
+    // has to fail with EINTR or the timeout never ends it
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = alarm_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+
+    if (daemon_mode) {
+        // One producer session after another until SIGINT/SIGTERM; the
+        // signal ends the wait for the next one
+        catch_stop_signals();
+        unsigned long sessions = 0;
+        while (!stop_server) {
+            if (run_session(&listener, &opts) == 0) {
+                sessions++;
+            }
+        }
+        close_parked();
+        transport_listener_close(&listener);
+        log_summary("Consumer PID %d served %lu sessions\n", getpid(), sessions);
+        metrics_stop();
+        if (stage_list) {
+            pool_destroy(&stage_pool);
+        }
+        STATS_STOP();
+        LOCKPROF_REPORT("Consumer");
+        return 0;
+    }
+
+    int rc = run_session(&listener, &opts);
+    transport_listener_close(&listener);
+    metrics_stop();
+    if (stage_list) {
+        pool_destroy(&stage_pool);
+    }
+    if (rc == 0) {
+        STATS_STOP();
+        LOCKPROF_REPORT("Consumer");
+    }
+    return rc < 0 ? EXIT_FAILURE : 0;
+}
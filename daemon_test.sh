@@ -0,0 +1,98 @@
+#!/bin/bash
+
+# Daemon test: starts ./consumer --daemon and runs several producer
+# sessions against it one after another. Every session logs each value,
+# far more than one log ring holds, so a session whose log writer is not
+# running stalls; each must store and print every value it was sent, and
+# the daemon must still stop on SIGTERM afterwards. With -p, every round
+# starts several producers at once, whose connections reach the daemon
+# interleaved; each is still served as a session of its own. Exit status 1 if
+# anything went wrong.
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -s SESSIONS    sessions to run (default 3)
+  -n VALUES      values per session (default 20000)
+  -p PRODUCERS   producers started at once per round (default 1)
+  -a ARGS        extra producer options, e.g. "-c -t 4" (default none)
+EOF
+    exit 1
+}
+
+SESSIONS=3
+VALUES=20000
+PRODUCERS=1
+ARGS=""
+while getopts "s:n:p:a:h" opt; do
+    case $opt in
+    s) SESSIONS=$OPTARG ;;
+    n) VALUES=$OPTARG ;;
+    p) PRODUCERS=$OPTARG ;;
+    a) ARGS=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+if [ ! -x ./producer ] || [ ! -x ./consumer ] || [ ! -x ./gen ]; then
+    echo "Error: build producer, consumer and gen first (make)" >&2
+    exit 1
+fi
+
+DIR=$(mktemp -d)
+SOCK="$DIR/daemon.sock"
+trap 'kill $DAEMON 2>/dev/null; rm -rf "$DIR"' EXIT
+
+./gen -n "$VALUES" -o "$DIR/input.txt" 2>/dev/null || exit 1
+./consumer --daemon --transport unix --socket "$SOCK" --log all > "$DIR/daemon.out" 2>&1 &
+DAEMON=$!
+for _ in $(seq 50); do
+    [ -S "$SOCK" ] && break
+    sleep 0.1
+done
+
+FAILED=0
+for i in $(seq "$SESSIONS"); do
+    PIDS=()
+    for j in $(seq "$PRODUCERS"); do
+        timeout 60 ./producer --connect -T unix --socket "$SOCK" -n 0 --log quiet $ARGS \
+            "$DIR/input.txt" > "$DIR/producer$j.out" 2>&1 &
+        PIDS+=($!)
+    done
+    for j in $(seq "$PRODUCERS"); do
+        wait "${PIDS[$((j - 1))]}"
+        rc=$?
+        if [ $rc -ne 0 ]; then
+            echo "Round $i: producer $j exited with $rc" >&2
+            tail -3 "$DIR/producer$j.out" >&2
+            FAILED=1
+        fi
+    done
+    [ $FAILED -eq 0 ] || break
+    # The daemon's writer may still be draining the sessions' lines
+    want=$((VALUES * PRODUCERS * i))
+    for _ in $(seq 50); do
+        lines=$(grep -c 'inserted data element' "$DIR/daemon.out")
+        [ "$lines" -ge "$want" ] && break
+        sleep 0.1
+    done
+    if [ "$lines" != "$want" ]; then
+        echo "Round $i: $lines status lines so far, expected $want" >&2
+        FAILED=1
+        break
+    fi
+    echo "Round $i: $PRODUCERS x $VALUES values stored and logged"
+done
+
+kill -TERM $DAEMON
+for _ in $(seq 50); do
+    kill -0 $DAEMON 2>/dev/null || break
+    sleep 0.1
+done
+if kill -0 $DAEMON 2>/dev/null; then
+    echo "Daemon did not stop on SIGTERM" >&2
+    kill -KILL $DAEMON
+    FAILED=1
+fi
+wait $DAEMON 2>/dev/null
+[ $FAILED -eq 0 ] && echo "ok" || echo "FAILED"
+exit $FAILED
@@ -0,0 +1,25 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdint.h>
+
+/*
+ * Order-independent digest of a multiset of values, shared by the input
+ * generator (gen.c) and the consumer's stats stage.
+ *
+ * Each value, as its unsigned value_t bits, is run through a 64-bit
+ * mixer (the splitmix64 finalizer) and the results are added modulo
+ * 2^64, so the digest does not depend on the order values arrive in,
+ * partial digests of any split of the values (pool threads, shards)
+ * simply add up, and a lost, duplicated or corrupted value changes it
+ * with probability about 1 - 2^-64.
+ */
+
+static inline uint64_t digest_mix(uint64_t v) {
+    uint64_t z = v + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#endif // DIGEST_H
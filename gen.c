@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "value.h"
+#include "digest.h"
+
+/*
+ * Test input generator.
+ *
+ * Usage: ./gen [-n count] [-B] [--dist random|sorted|skewed] [--seed N]
+ *              [--min V] [--max V] [--keys K] [-o output_file]
+ *        ./gen --digest [-B] input_file
+ *
+ * Writes count values (default 1M, "1e9" is accepted) as a producer
+ * input: one decimal per line, or with -B network-order values of the
+ * build's width (--binary, see value.h). Distributions, all over
+ * [--min, --max] (default 0 .. the largest signed value):
+ *   random  independent uniform values
+ *   sorted  non-decreasing values with random gaps spread over the range
+ *   skewed  Zipf-like: the k-th most common of --keys distinct values
+ *           (default 65536) turns up with probability about 1/k
+ * The same arguments and seed give the same file on every machine.
+ * Output goes through one large buffer with write(2), so the disk is
+ * the limit even for tens of GB.
+ *
+ * On completion the count, sum, min, max and multiset digest (digest.h)
+ * of what was written go to stderr, in the form the consumer's stats
+ * stage prints them, so a run can be checked against its input without
+ * reading the file again. --digest prints the same for an existing file.
+ */
+
+#define GEN_BUF_SIZE (1 << 20)
+#define GEN_DEFAULT_COUNT 1000000ULL
+#define GEN_DEFAULT_KEYS 65536ULL
+
+enum gen_dist { DIST_RANDOM, DIST_SORTED, DIST_SKEWED };
+
+struct summary {
+    uint64_t count;
+    uint64_t sum;       // of the signed values, wrapping like the stage's
+    svalue_t min;
+    svalue_t max;
+    uint64_t digest;
+};
+
+static void summary_add(struct summary *s, value_t v) {
+    svalue_t x = (svalue_t)v;
+    s->count++;
+    s->sum += (uint64_t)(int64_t)x;
+    s->min = x < s->min ? x : s->min;
+    s->max = x > s->max ? x : s->max;
+    s->digest += digest_mix(v);
+}
+
+static void summary_print(const struct summary *s) {
+    if (s->count == 0) {
+        fprintf(stderr, "0 values\n");
+        return;
+    }
+    fprintf(stderr, "%llu values, sum %lld, min %" PRIdVALUE ", max %" PRIdVALUE
+            ", digest %016llx\n",
+            (unsigned long long)s->count, (long long)s->sum, s->min, s->max,
+            (unsigned long long)s->digest);
+}
+
+// splitmix64: one multiply-xorshift step per value, good enough for test data
+static uint64_t next_random(uint64_t *state) {
+    *state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = *state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, span] from r, for any span up to 2^64 - 1
+static uint64_t scale(uint64_t r, uint64_t span) {
+    return (uint64_t)(((unsigned __int128)r * ((unsigned __int128)span + 1)) >> 64);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Decimal form of v and a newline at p; returns the bytes written (at
+// most VALUE_DIGITS + 1)
+static size_t format_value(char *p, svalue_t v) {
+    char digits[VALUE_DIGITS];
+    size_t len = 0;
+    value_t u = v < 0 ? (value_t)(0 - (value_t)v) : (value_t)v;
+    do {
+        digits[len++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    char *q = p;
+    if (v < 0) {
+        *q++ = '-';
+    }
+    while (len > 0) {
+        *q++ = digits[--len];
+    }
+    *q++ = '\n';
+    return (size_t)(q - p);
+}
+
+static unsigned long long parse_count(const char *arg, const char *what) {
+    char *end;
+    double v = strtod(arg, &end);
+    if (*arg == '\0' || *end != '\0' || v < 0 || v > 1e19 || v != floor(v)) {
+        fprintf(stderr, "Invalid %s '%s'\n", what, arg);
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned long long)v;
+}
+
+static svalue_t parse_value(const char *arg, const char *what) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || errno == ERANGE || v < SVALUE_MIN || v > SVALUE_MAX) {
+        fprintf(stderr, "Invalid %s '%s' (%d-bit values)\n", what, arg, VALUE_BITS);
+        exit(EXIT_FAILURE);
+    }
+    return (svalue_t)v;
+}
+
+static int digest_file(const char *path, int binary, struct summary *s) {
+    if (!binary) {
+        struct parser p;
+        if (parser_open(&p, path) < 0) {
+            perror("open");
+            return -1;
+        }
+        value_t values[4096];
+        size_t n;
+        while ((n = parse_values(&p, values, 4096)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                summary_add(s, values[i]);
+            }
+        }
+        enum parse_status status = p.status;
+        parser_close(&p);
+        if (status == PARSE_ERR) {
+            perror("read");
+            return -1;
+        }
+        if (status == PARSE_BAD) {
+            fprintf(stderr, "%s: malformed value after %llu values\n", path,
+                    (unsigned long long)s->count);
+            return -1;
+        }
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    static value_t buf[GEN_BUF_SIZE / VALUE_BYTES];
+    size_t have = 0;    // bytes in buf
+    for (;;) {
+        ssize_t n = read(fd, (char *)buf + have, sizeof(buf) - have);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            close(fd);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        have += (size_t)n;
+        size_t whole = have / VALUE_BYTES;
+        for (size_t i = 0; i < whole; i++) {
+            summary_add(s, value_ntoh(buf[i]));
+        }
+        memmove(buf, buf + whole, have % VALUE_BYTES);
+        have %= VALUE_BYTES;
+    }
+    close(fd);
+    if (have != 0) {
+        fprintf(stderr, "%s: size is not a multiple of %d bytes\n", path, VALUE_BYTES);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long count = GEN_DEFAULT_COUNT;
+    unsigned long long keys = GEN_DEFAULT_KEYS;
+    unsigned long long seed = 42;
+    svalue_t lo = 0;
+    svalue_t hi = SVALUE_MAX;
+    int binary = 0;
+    int digest_only = 0;
+    enum gen_dist dist = DIST_RANDOM;
+    const char *output = NULL;
+    static const struct option long_opts[] = {
+        { "count", required_argument, NULL, 'n' },
+        { "binary", no_argument, NULL, 'B' },
+        { "dist", required_argument, NULL, 'd' },
+        { "seed", required_argument, NULL, 'S' },
+        { "min", required_argument, NULL, 'L' },
+        { "max", required_argument, NULL, 'H' },
+        { "keys", required_argument, NULL, 'K' },
+        { "output", required_argument, NULL, 'o' },
+        { "digest", no_argument, NULL, 'D' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:Bd:o:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            count = parse_count(optarg, "count");
+            break;
+        case 'B':
+            binary = 1;
+            break;
+        case 'd':
+            if (strcmp(optarg, "random") == 0) {
+                dist = DIST_RANDOM;
+            } else if (strcmp(optarg, "sorted") == 0) {
+                dist = DIST_SORTED;
+            } else if (strcmp(optarg, "skewed") == 0) {
+                dist = DIST_SKEWED;
+            } else {
+                fprintf(stderr, "Unknown distribution '%s' (random, sorted, skewed)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            seed = parse_count(optarg, "seed");
+            break;
+        case 'L':
+            lo = parse_value(optarg, "minimum");
+            break;
+        case 'H':
+            hi = parse_value(optarg, "maximum");
+            break;
+        case 'K':
+            keys = parse_count(optarg, "key count");
+            if (keys == 0) {
+                fprintf(stderr, "Invalid key count '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'D':
+            digest_only = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n count] [-B] [--dist random|sorted|skewed] [--seed N]\n"
+                    "       [--min V] [--max V] [--keys K] [-o output_file]\n"
+                    "       %s --digest [-B] input_file\n",
+                    argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct summary s = { 0, 0, SVALUE_MAX, SVALUE_MIN, 0 };
+    if (digest_only) {
+        if (optind != argc - 1) {
+            fprintf(stderr, "--digest takes one input file\n");
+            exit(EXIT_FAILURE);
+        }
+        if (digest_file(argv[optind], binary, &s) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        summary_print(&s);
+        return 0;
+    }
+    if (optind != argc) {
+        fprintf(stderr, "Unexpected argument '%s' (output goes to -o FILE or stdout)\n",
+                argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    if (lo > hi) {
+        fprintf(stderr, "--min %" PRIdVALUE " is above --max %" PRIdVALUE "\n", lo, hi);
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = STDOUT_FILENO;
+    if (output) {
+        fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("open");
+            exit(EXIT_FAILURE);
+        }
+    }
+    char *buf = malloc(GEN_BUF_SIZE);
+    if (!buf) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t span = (uint64_t)hi - (uint64_t)lo;     // the range less one; wraps to fit
+    uint64_t state = seed;
+    double log_keys = log((double)keys + 1.0);
+    uint64_t key_salt = next_random(&state);
+    double pos = 0.0;       // sorted: offset of the current value in the range
+    double step = ((double)span + 1.0) / (double)(count ? count : 1);
+    size_t used = 0;
+    for (unsigned long long i = 0; i < count; i++) {
+        uint64_t r = next_random(&state);
+        uint64_t off;
+        switch (dist) {
+        case DIST_SORTED:
+            // Gaps uniform in [0, 2 * span / count): the values end near --max
+            off = pos < (double)span ? (uint64_t)pos : span;
+            pos += step * 2.0 * (double)(r >> 11) * 0x1p-53;
+            break;
+        case DIST_SKEWED: {
+            // (keys + 1)^u for uniform u is log-uniform on [1, keys + 1), so
+            // rank k comes up with probability ln((k + 2) / (k + 1)) ~ 1/(k + 1)
+            double u = (double)(r >> 11) * 0x1p-53;
+            uint64_t rank = (uint64_t)exp(u * log_keys) - 1;
+            rank = rank < keys ? rank : keys - 1;
+            // Hashed, so the hot values are scattered over the range
+            off = scale(digest_mix(rank ^ key_salt), span);
+            break;
+        }
+        default:
+            off = scale(r, span);
+            break;
+        }
+        value_t v = (value_t)((uint64_t)lo + off);
+        summary_add(&s, v);
+        if (binary) {
+            value_t be = value_hton(v);
+            memcpy(buf + used, &be, VALUE_BYTES);
+            used += VALUE_BYTES;
+        } else {
+            used += format_value(buf + used, (svalue_t)v);
+        }
+        if (used > GEN_BUF_SIZE - 32) {
+            if (write_all(fd, buf, used) < 0) {
+                perror("write");
+                exit(EXIT_FAILURE);
+            }
+            used = 0;
+        }
+    }
+    if (write_all(fd, buf, used) < 0) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+    if (output && close(fd) < 0) {
+        perror("close");
+        exit(EXIT_FAILURE);
+    }
+    free(buf);
+    summary_print(&s);
+    return 0;
+}
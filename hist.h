@@ -0,0 +1,91 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Log-linear histogram of 64-bit values (latencies in ns, sizes, ...).
+ * Values below 32 get a bucket each; above that every power of two is
+ * split into 16 buckets, so any recorded value is off by at most 1/16
+ * and the whole range fits in under 1000 counters. Not thread-safe:
+ * each thread fills its own and they are merged at the end.
+ */
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_LINEAR (2 * HIST_SUB)      // values below this are exact
+#define HIST_BUCKETS (HIST_LINEAR + (64 - HIST_SUB_BITS - 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline void hist_reset(struct hist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned hist_bucket(uint64_t v) {
+    if (v < HIST_LINEAR) {
+        return (unsigned)v;
+    }
+    unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+    unsigned sub = (unsigned)(v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return HIST_LINEAR + (msb - HIST_SUB_BITS - 1) * HIST_SUB + sub;
+}
+
+// Smallest value that lands in bucket b
+static inline uint64_t hist_bucket_low(unsigned b) {
+    if (b < HIST_LINEAR) {
+        return b;
+    }
+    unsigned msb = (b - HIST_LINEAR) / HIST_SUB + HIST_SUB_BITS + 1;
+    uint64_t sub = (b - HIST_LINEAR) % HIST_SUB;
+    return ((uint64_t)1 << msb) | (sub << (msb - HIST_SUB_BITS));
+}
+
+// Record n occurrences of v
+static inline void hist_add(struct hist *h, uint64_t v, uint64_t n) {
+    h->buckets[hist_bucket(v)] += n;
+    h->count += n;
+    h->sum += v * n;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static inline void hist_merge(struct hist *into, const struct hist *from) {
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+// Value at quantile q (0..1): the middle of the bucket it falls in
+static inline uint64_t hist_quantile(const struct hist *h, double q) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)(h->count - 1));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            if (i + 1 == HIST_BUCKETS) {
+                return h->max;
+            }
+            uint64_t mid = hist_bucket_low(i) + (hist_bucket_low(i + 1) - hist_bucket_low(i)) / 2;
+            return mid < h->max ? mid : h->max;
+        }
+    }
+    return h->max;
+}
+
+#endif // HIST_H
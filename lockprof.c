@@ -0,0 +1,282 @@
+#include "lockprof.h"
+
+#ifdef LOCKPROF
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hist.h"
+#include "protocol.h"
+
+#define LOCKPROF_MAX_THREADS 256
+#define LOCKPROF_MAX_CLASSES 8      // lock classes one thread takes
+#define LOCKPROF_MAX_HELD 8         // locks one thread holds at once
+#define LOCKPROF_OWNERS 1024        // mutexes tracked for handoffs, power of two
+
+struct class_rec {
+    const char *name;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t handoffs;
+    struct hist wait;
+    struct hist hold;
+};
+
+struct held_lock {
+    pthread_mutex_t *m;
+    struct class_rec *cls;
+    uint64_t since;
+};
+
+struct thread_rec {
+    char name[24];
+    int slot;
+    atomic_int retired;     // its thread exited; free for the next of its name
+    int nclasses;
+    int nheld;
+    struct held_lock held[LOCKPROF_MAX_HELD];
+    struct class_rec classes[LOCKPROF_MAX_CLASSES];
+};
+
+// Last thread to acquire each mutex, found by open addressing on its address
+struct owner_slot {
+    _Atomic(pthread_mutex_t *) m;
+    _Atomic(uintptr_t) owner;
+};
+
+static _Thread_local struct thread_rec *self = NULL;
+static _Atomic(struct thread_rec *) threads[LOCKPROF_MAX_THREADS];
+static atomic_int thread_count = 0;
+static struct owner_slot owners[LOCKPROF_OWNERS];
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+// Thread exit: its record, counts and all, waits for the next thread of
+// the same name, so a --daemon doesn't use up the slots session by session
+static void retire_rec(void *arg) {
+    struct thread_rec *t = arg;
+    atomic_store_explicit(&t->retired, 1, memory_order_release);
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, retire_rec);
+}
+
+// Claim a retired record named name ("name slot"), or NULL
+static struct thread_rec *reuse_rec(const char *name) {
+    size_t len = strlen(name);
+    int n = atomic_load(&thread_count);
+    for (int i = 0; i < n && i < LOCKPROF_MAX_THREADS; i++) {
+        struct thread_rec *t = atomic_load(&threads[i]);
+        int retired = 1;
+        if (t && strncmp(t->name, name, len) == 0 && t->name[len] == ' ' &&
+            atomic_compare_exchange_strong_explicit(&t->retired, &retired, 0,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            t->nheld = 0;   // Whatever the last owner died holding
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// The calling thread's record: a retired one of the same name, or a new one
+static struct thread_rec *thread_claim(const char *name) {
+    pthread_once(&exit_key_once, make_exit_key);
+    struct thread_rec *t = reuse_rec(name);
+    if (!t) {
+        t = calloc(1, sizeof(*t));
+        if (!t) {
+            return NULL;
+        }
+        int slot = atomic_fetch_add(&thread_count, 1);
+        if (slot >= LOCKPROF_MAX_THREADS) {
+            free(t);
+            return NULL;
+        }
+        t->slot = slot;
+        snprintf(t->name, sizeof(t->name), "%s %d", name, slot);
+        atomic_store(&threads[slot], t);
+    }
+    self = t;
+    pthread_setspecific(exit_key, t);
+    return t;
+}
+
+static struct thread_rec *thread_self(void) {
+    return self ? self : thread_claim("thread");
+}
+
+void lockprof_thread(const char *name) {
+    if (!self) {
+        thread_claim(name);
+    } else {
+        snprintf(self->name, sizeof(self->name), "%s %d", name, self->slot);
+    }
+}
+
+static struct class_rec *class_of(struct thread_rec *t, const char *name) {
+    for (int i = 0; i < t->nclasses; i++) {
+        if (t->classes[i].name == name || strcmp(t->classes[i].name, name) == 0) {
+            return &t->classes[i];
+        }
+    }
+    if (t->nclasses == LOCKPROF_MAX_CLASSES) {
+        return NULL;
+    }
+    struct class_rec *c = &t->classes[t->nclasses++];
+    c->name = name;
+    return c;
+}
+
+static struct owner_slot *owner_of(pthread_mutex_t *m) {
+    size_t h = ((uintptr_t)m >> 4) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < LOCKPROF_OWNERS; i++) {
+        struct owner_slot *s = &owners[(h + i) & (LOCKPROF_OWNERS - 1)];
+        pthread_mutex_t *cur = atomic_load(&s->m);
+        if (cur == NULL && atomic_compare_exchange_strong(&s->m, &cur, m)) {
+            return s;
+        }
+        if (cur == m) {
+            return s;
+        }
+    }
+    return NULL;    // Table full: no handoff counts for this mutex
+}
+
+// We own m now: note a handoff and start timing the hold
+static void acquired(struct thread_rec *t, struct class_rec *c, pthread_mutex_t *m) {
+    struct owner_slot *o = owner_of(m);
+    if (o) {
+        uintptr_t prev = atomic_exchange_explicit(&o->owner, (uintptr_t)t, memory_order_relaxed);
+        if (prev != 0 && prev != (uintptr_t)t) {
+            c->handoffs++;
+        }
+    }
+    if (t->nheld < LOCKPROF_MAX_HELD) {
+        t->held[t->nheld++] = (struct held_lock){ m, c, now_ns() };
+    }
+}
+
+// Stop timing the hold of m; returns its record, or NULL if untracked
+static struct class_rec *released(struct thread_rec *t, pthread_mutex_t *m) {
+    for (int i = t->nheld - 1; i >= 0; i--) {
+        if (t->held[i].m == m) {
+            struct class_rec *c = t->held[i].cls;
+            hist_add(&c->hold, now_ns() - t->held[i].since, 1);
+            t->held[i] = t->held[--t->nheld];
+            return c;
+        }
+    }
+    return NULL;
+}
+
+int lockprof_lock(pthread_mutex_t *m, const char *name) {
+    struct thread_rec *t = thread_self();
+    struct class_rec *c = t ? class_of(t, name) : NULL;
+    uint64_t start = now_ns();
+    int contended = pthread_mutex_trylock(m) != 0;
+    if (contended) {
+        pthread_mutex_lock(m);
+    }
+    if (!c) {
+        return contended;
+    }
+    c->contended += (uint64_t)contended;
+    hist_add(&c->wait, now_ns() - start, 1);
+    c->acquired++;
+    acquired(t, c, m);
+    return contended;
+}
+
+void lockprof_unlock(pthread_mutex_t *m) {
+    if (self) {
+        released(self, m);
+    }
+    pthread_mutex_unlock(m);
+}
+
+// The wait gives the mutex up: the hold ends here and a new one starts
+// on wakeup, without counting the sleep as waiting for the lock
+int lockprof_cond_wait(pthread_cond_t *cv, pthread_mutex_t *m) {
+    struct class_rec *c = self ? released(self, m) : NULL;
+    int rc = pthread_cond_wait(cv, m);
+    if (c) {
+        c->acquired++;
+        acquired(self, c, m);
+    }
+    return rc;
+}
+
+static void print_row(const char *lock, const char *thread, const struct class_rec *c) {
+    fprintf(stderr, "  %-12s %-12s %10llu %10llu %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10.3f %10.3f\n",
+            lock, thread, (unsigned long long)c->acquired, (unsigned long long)c->contended,
+            (unsigned long long)c->handoffs,
+            hist_quantile(&c->wait, 0.50) / 1e3, hist_quantile(&c->wait, 0.99) / 1e3,
+            c->wait.max / 1e3,
+            hist_quantile(&c->hold, 0.50) / 1e3, hist_quantile(&c->hold, 0.99) / 1e3,
+            c->hold.max / 1e3, c->wait.sum / 1e6, c->hold.sum / 1e6);
+}
+
+void lockprof_report(const char *program) {
+    int n = atomic_load(&thread_count);
+    if (n > LOCKPROF_MAX_THREADS) {
+        n = LOCKPROF_MAX_THREADS;
+    }
+    struct class_rec *total = malloc(sizeof(*total));
+    if (!total) {
+        return;
+    }
+    fprintf(stderr, "%s PID %d lock contention (times in us, totals in ms):\n", program, (int)getpid());
+    fprintf(stderr, "  %-12s %-12s %10s %10s %10s %9s %9s %9s %9s %9s %9s %10s %10s\n", "lock",
+            "thread", "acquired", "contended", "handoffs", "wait_p50", "wait_p99", "wait_max",
+            "hold_p50", "hold_p99", "hold_max", "wait_ms", "hold_ms");
+    // One block per lock class: a row per thread that took it, then the total
+    const char *done[LOCKPROF_MAX_THREADS * LOCKPROF_MAX_CLASSES];
+    int ndone = 0;
+    for (int i = 0; i < n; i++) {
+        struct thread_rec *t = atomic_load(&threads[i]);
+        for (int k = 0; t && k < t->nclasses; k++) {
+            const char *name = t->classes[k].name;
+            int seen = 0;
+            for (int d = 0; d < ndone && !seen; d++) {
+                seen = strcmp(done[d], name) == 0;
+            }
+            if (seen) {
+                continue;
+            }
+            done[ndone++] = name;
+            memset(total, 0, sizeof(*total));
+            for (int j = i; j < n; j++) {
+                struct thread_rec *u = atomic_load(&threads[j]);
+                for (int l = 0; u && l < u->nclasses; l++) {
+                    const struct class_rec *c = &u->classes[l];
+                    if (strcmp(c->name, name) != 0) {
+                        continue;
+                    }
+                    print_row(name, u->name, c);
+                    total->acquired += c->acquired;
+                    total->contended += c->contended;
+                    total->handoffs += c->handoffs;
+                    hist_merge(&total->wait, &c->wait);
+                    hist_merge(&total->hold, &c->hold);
+                }
+            }
+            print_row(name, "total", total);
+        }
+    }
+    free(total);
+}
+
+#else
+
+// Built without -DLOCKPROF: nothing to profile
+typedef int lockprof_disabled;
+
+#endif // LOCKPROF
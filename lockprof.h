@@ -0,0 +1,70 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+/*
+ * Lock contention profiler, built only with -DLOCKPROF (make LOCKPROF=1).
+ *
+ * LOCK()/UNLOCK()/COND_WAIT() stand in for the pthread calls on the
+ * mutexes worth watching. Each lock is named by its class ("file_mutex",
+ * "send_mutex", ...) and all mutexes of a class are reported together.
+ * Per thread and class the profiler keeps:
+ *
+ *   - a histogram of the time spent waiting to acquire (wait)
+ *   - a histogram of the time between acquire and release (hold); a
+ *     COND_WAIT() ends one hold and starts another when it wakes
+ *   - acquisitions, how many found the mutex taken (contended), and
+ *     handoffs: acquisitions of a mutex last held by another thread
+ *
+ * Each thread writes only its own records, so the profiler adds no
+ * shared writes except the one owner word per mutex used for handoffs.
+ * lockprof_report() prints the table to stderr once the threads are done.
+ *
+ * Without LOCKPROF the macros are the plain pthread calls.
+ *
+ * LOCK_WAITED() is LOCK() returning 1 if the mutex was taken when it was
+ * tried, 0 otherwise, for contention counters kept in every build (the
+ * consumer's --metrics): a trylock first, then the blocking lock.
+ */
+
+#ifdef LOCKPROF
+
+// Returns 1 if the mutex was contended
+int lockprof_lock(pthread_mutex_t *m, const char *name);
+void lockprof_unlock(pthread_mutex_t *m);
+int lockprof_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+
+// Label the calling thread's rows in the report
+void lockprof_thread(const char *name);
+
+// Print the contention report; call after the profiled threads have exited
+void lockprof_report(const char *program);
+
+#define LOCK(m, name) lockprof_lock((m), (name))
+#define LOCK_WAITED(m, name) lockprof_lock((m), (name))
+#define UNLOCK(m) lockprof_unlock(m)
+#define COND_WAIT(c, m) lockprof_cond_wait((c), (m))
+#define LOCKPROF_THREAD(name) lockprof_thread(name)
+#define LOCKPROF_REPORT(program) lockprof_report(program)
+
+#else
+
+static inline int lock_waited(pthread_mutex_t *m) {
+    if (pthread_mutex_trylock(m) == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(m);
+    return 1;
+}
+
+#define LOCK(m, name) ((void)(name), pthread_mutex_lock(m))
+#define LOCK_WAITED(m, name) ((void)(name), lock_waited(m))
+#define UNLOCK(m) pthread_mutex_unlock(m)
+#define COND_WAIT(c, m) pthread_cond_wait((c), (m))
+#define LOCKPROF_THREAD(name) ((void)0)
+#define LOCKPROF_REPORT(program) ((void)0)
+
+#endif // LOCKPROF
+
+#endif // LOCKPROF_H
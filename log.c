@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE (1 << 18)     // bytes per stream, power of two
+#define LOG_MAX_STREAMS 256
+#define LOG_MAX_LINE 128            // prefix + value + newline
+#define LOG_STAGE_SIZE (1 << 16)    // writer's linearizing buffer
+#define LOG_IDLE_NS 1000000L        // writer sleep when all rings are empty
+
+#ifndef PIPE_BUF
+#define PIPE_BUF 512
+#endif
+
+struct log_stream {
+    char *ring;
+    _Alignas(64) atomic_size_t head;    // advanced by the writer thread
+    _Alignas(64) atomic_size_t tail;    // advanced by the owning thread
+    uint64_t seen;                      // values offered, for sampling
+    size_t prefix_len;
+    char prefix[LOG_MAX_LINE];
+};
+
+static _Atomic(struct log_stream *) streams[LOG_MAX_STREAMS];
+static atomic_int stream_count = 0;
+
+static enum log_level log_level = LOG_ALL;
+static uint64_t log_every = LOG_DEFAULT_EVERY;
+static int out_is_pipe = 0;
+static pthread_t writer_thread;
+static int writer_running = 0;
+static atomic_int stopping = 0;
+
+static const char *level_names[] = { "quiet", "summary", "sample", "all" };
+
+int log_parse_level(const char *name) {
+    for (int i = 0; i <= LOG_ALL; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *log_level_name(enum log_level level) {
+    return level_names[level];
+}
+
+enum log_level log_get_level(void) {
+    return log_level;
+}
+
+uint64_t log_get_every(void) {
+    return log_every;
+}
+
+// write() all of buf, retrying on short writes
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;  // stdout is gone; drop the output
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+// Emit whole lines; on a pipe, keep every write() at most PIPE_BUF
+static void emit(const char *buf, size_t len) {
+    if (!out_is_pipe) {
+        write_all(buf, len);
+        return;
+    }
+    while (len > 0) {
+        size_t n = len;
+        if (n > PIPE_BUF) {
+            n = PIPE_BUF;
+            while (n > 0 && buf[n - 1] != '\n') {
+                n--;
+            }
+            if (n == 0) {
+                n = PIPE_BUF;   // no line end at all, can't avoid a split
+            }
+        }
+        write_all(buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+// Move whatever s has published to stdout; returns bytes written
+static size_t drain(struct log_stream *s, char *stage) {
+    size_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+    size_t total = 0;
+
+    while (head != tail) {
+        size_t n = tail - head;
+        if (n > LOG_STAGE_SIZE) {
+            n = LOG_STAGE_SIZE;
+        }
+        size_t off = head & (LOG_RING_SIZE - 1);
+        size_t first = LOG_RING_SIZE - off < n ? LOG_RING_SIZE - off : n;
+        memcpy(stage, s->ring + off, first);
+        memcpy(stage + first, s->ring, n - first);
+        // Only hand over complete lines; the rest goes out next round
+        if (n < tail - head) {
+            while (n > 0 && stage[n - 1] != '\n') {
+                n--;
+            }
+        }
+        emit(stage, n);
+        head += n;
+        total += n;
+        atomic_store_explicit(&s->head, head, memory_order_release);
+    }
+    return total;
+}
+
+static void *writer_thread_func(void *arg) {
+    (void)arg;
+    char *stage = malloc(LOG_STAGE_SIZE);
+    if (!stage) {
+        return NULL;
+    }
+    while (1) {
+        int done = atomic_load_explicit(&stopping, memory_order_acquire);
+        size_t total = 0;
+        int n = atomic_load_explicit(&stream_count, memory_order_acquire);
+        for (int i = 0; i < n && i < LOG_MAX_STREAMS; i++) {
+            struct log_stream *s = atomic_load_explicit(&streams[i], memory_order_acquire);
+            if (s) {
+                total += drain(s, stage);
+            }
+        }
+        // Exit only after a full pass that started after stopping was set
+        if (done && total == 0) {
+            break;
+        }
+        if (total == 0) {
+            struct timespec ts = { 0, LOG_IDLE_NS };
+            nanosleep(&ts, NULL);
+        }
+    }
+    free(stage);
+    return NULL;
+}
+
+int log_init(enum log_level level, uint64_t every) {
+    log_level = level;
+    log_every = every > 0 ? every : 1;
+    struct stat st;
+    out_is_pipe = fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (level < LOG_SAMPLE) {
+        return 0;   // No per-value output, so no writer thread needed
+    }
+    // A daemon calls us once per session, after the last one's shutdown
+    atomic_store_explicit(&stopping, 0, memory_order_release);
+    if (pthread_create(&writer_thread, NULL, writer_thread_func, NULL) != 0) {
+        return -1;
+    }
+    writer_running = 1;
+    return 0;
+}
+
+void log_shutdown(void) {
+    if (writer_running) {
+        atomic_store_explicit(&stopping, 1, memory_order_release);
+        pthread_join(writer_thread, NULL);
+        writer_running = 0;
+    }
+    int n = atomic_load(&stream_count);
+    for (int i = 0; i < n && i < LOG_MAX_STREAMS; i++) {
+        struct log_stream *s = atomic_exchange(&streams[i], NULL);
+        if (s) {
+            free(s->ring);
+            free(s);
+        }
+    }
+    atomic_store(&stream_count, 0);
+}
+
+struct log_stream *log_stream_open(const char *prefix) {
+    if (log_level < LOG_SAMPLE || !writer_running) {
+        return NULL;
+    }
+    int slot = atomic_fetch_add(&stream_count, 1);
+    if (slot >= LOG_MAX_STREAMS) {
+        fprintf(stderr, "log: too many streams, output from this thread is dropped\n");
+        return NULL;
+    }
+    struct log_stream *s = calloc(1, sizeof(*s));
+    if (!s || !(s->ring = malloc(LOG_RING_SIZE))) {
+        free(s);
+        return NULL;
+    }
+    atomic_init(&s->head, 0);
+    atomic_init(&s->tail, 0);
+    // Leave room for the value and newline after the prefix
+    s->prefix_len = strlen(prefix);
+    if (s->prefix_len > LOG_MAX_LINE - (VALUE_DIGITS + 1)) {
+        s->prefix_len = LOG_MAX_LINE - (VALUE_DIGITS + 1);
+    }
+    memcpy(s->prefix, prefix, s->prefix_len);
+    atomic_store_explicit(&streams[slot], s, memory_order_release);
+    return s;
+}
+
+// Format "prefix<value>\n" into line; returns its length
+static size_t format_line(const struct log_stream *s, char *line, svalue_t value) {
+    char digits[VALUE_DIGITS];
+    size_t nd = 0;
+    value_t mag = value < 0 ? (value_t)(0 - (value_t)value) : (value_t)value;
+    do {
+        digits[nd++] = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag > 0);
+
+    memcpy(line, s->prefix, s->prefix_len);
+    size_t len = s->prefix_len;
+    if (value < 0) {
+        line[len++] = '-';
+    }
+    while (nd > 0) {
+        line[len++] = digits[--nd];
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+void log_values(struct log_stream *s, const value_t *values, size_t n) {
+    if (!s) {
+        return;
+    }
+    size_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    char line[LOG_MAX_LINE];
+
+    for (size_t i = 0; i < n; i++) {
+        if (log_level == LOG_SAMPLE && s->seen++ % log_every != 0) {
+            continue;
+        }
+        size_t len = format_line(s, line, (svalue_t)values[i]);
+
+        // Ring full: publish what we have and let the writer catch up
+        while (tail + len - atomic_load_explicit(&s->head, memory_order_acquire) > LOG_RING_SIZE) {
+            atomic_store_explicit(&s->tail, tail, memory_order_release);
+            sched_yield();
+        }
+        size_t off = tail & (LOG_RING_SIZE - 1);
+        size_t first = LOG_RING_SIZE - off < len ? LOG_RING_SIZE - off : len;
+        memcpy(s->ring + off, line, first);
+        memcpy(s->ring, line + first, len - first);
+        tail += len;
+    }
+    atomic_store_explicit(&s->tail, tail, memory_order_release);
+}
+
+void log_summary(const char *fmt, ...) {
+    if (log_level != LOG_SUMMARY && log_level != LOG_SAMPLE) {
+        return;
+    }
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        write_all(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
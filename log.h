@@ -0,0 +1,62 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "value.h"
+
+/*
+ * Asynchronous status logging shared by producer and consumer.
+ *
+ * Each thread that logs opens a log_stream: a private lock-free byte
+ * ring that only that thread writes. A background writer thread drains
+ * all rings to stdout with large write()s, so no thread ever blocks on
+ * stdio or on another thread's output. Only whole lines are published,
+ * and when stdout is a pipe the writer splits its writes at line ends
+ * within PIPE_BUF so lines from the producer and consumer processes
+ * never tear.
+ *
+ * Per-value lines keep the lab's exact format: the stream prefix (e.g.
+ * "Producer PID 1, Thread ID 2 read data element ") followed by the
+ * value and a newline.
+ */
+
+enum log_level {
+    LOG_QUIET = 0,      // nothing at all
+    LOG_SUMMARY,        // one summary line per process at exit
+    LOG_SAMPLE,         // every Nth value per stream, plus the summary
+    LOG_ALL             // every value, exactly the original output
+};
+
+#define LOG_DEFAULT_EVERY 1000
+
+struct log_stream;
+
+// Parse a level name ("quiet", "summary", "sample", "all"); -1 if unknown
+int log_parse_level(const char *name);
+const char *log_level_name(enum log_level level);
+
+// Start the writer thread; returns 0, or -1 if it could not be started
+int log_init(enum log_level level, uint64_t every);
+
+// Drain every stream and stop the writer thread
+void log_shutdown(void);
+
+enum log_level log_get_level(void);
+uint64_t log_get_every(void);
+
+/*
+ * Register the calling thread's stream. prefix is copied and printed in
+ * front of every value. Returns NULL when nothing will be logged per
+ * value (LOG_QUIET/LOG_SUMMARY); log_values() accepts NULL.
+ */
+struct log_stream *log_stream_open(const char *prefix);
+
+// Log the values subject to the level and sampling interval
+void log_values(struct log_stream *s, const value_t *values, size_t n);
+
+// printf-style line at LOG_SUMMARY and LOG_SAMPLE only
+void log_summary(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // LOG_H
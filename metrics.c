@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+#include "transport.h"
+
+#define METRICS_REQUEST_MAX 4096
+#define METRICS_TIMEOUT_S 1     // per scrape, so a silent client can't hold the thread
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0          // macOS: SIGPIPE is blocked on our thread anyway
+#endif
+
+static struct transport_listener listener = { TRANSPORT_TCP, -1, "" };
+static pthread_t thread;
+static int running = 0;
+static atomic_int stopping = 0;
+static metrics_fn page_fn;
+static void *page_ctx;
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Read the request head; only its first line matters
+static void read_request(int fd, char *req, size_t cap) {
+    size_t len = 0;
+    req[0] = '\0';
+    while (len < cap - 1 && !strstr(req, "\r\n\r\n") && !strstr(req, "\n\n")) {
+        ssize_t n = recv(fd, req + len, cap - 1 - len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+        req[len] = '\0';
+    }
+}
+
+// GET /metrics or GET /, with or without a query
+static const char *route(const char *req) {
+    if (strncmp(req, "GET ", 4) != 0) {
+        return "405 Method Not Allowed";
+    }
+    const char *path = req + 4;
+    size_t n = strncmp(path, "/metrics", 8) == 0 ? 8 : path[0] == '/' ? 1 : 0;
+    if (n == 0 || (path[n] != ' ' && path[n] != '?' && path[n] != '\r' && path[n] != '\n')) {
+        return "404 Not Found";
+    }
+    return "200 OK";
+}
+
+static void serve(int fd) {
+    struct timeval tv = { METRICS_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char req[METRICS_REQUEST_MAX];
+    read_request(fd, req, sizeof(req));
+    const char *status = route(req);
+    char *body = NULL;
+    size_t body_len = 0;
+    if (strcmp(status, "200 OK") == 0) {
+        FILE *out = open_memstream(&body, &body_len);
+        if (out) {
+            page_fn(out, page_ctx);
+            if (fclose(out) != 0) {
+                free(body);
+                body = NULL;
+            }
+        }
+        if (!body) {
+            status = "500 Internal Server Error";
+        }
+    }
+    // An error page is its status line
+    char error[64];
+    const char *text = body;
+    if (!body) {
+        body_len = (size_t)snprintf(error, sizeof(error), "%s\n", status);
+        text = error;
+    }
+
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body_len);
+    if (send_all(fd, head, (size_t)n) == 0) {
+        send_all(fd, text, body_len);
+    }
+    free(body);
+}
+
+static void *metrics_thread(void *arg) {
+    (void)arg;
+    struct pollfd p = { .fd = listener.fd, .events = POLLIN };
+    while (!atomic_load(&stopping)) {
+        // The timeout bounds how long metrics_stop() waits for us
+        if (poll(&p, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept(listener.fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                usleep(10000);  // Don't spin on a persistent error (EMFILE)
+            }
+            continue;
+        }
+        // BSD hands the listener's O_NONBLOCK on; the timeouts bound us instead
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *addr, metrics_fn fn, void *ctx) {
+    enum transport_kind kind = strchr(addr, '/') ? TRANSPORT_UNIX : TRANSPORT_TCP;
+    if (transport_listen(&listener, kind, addr, 16) < 0) {
+        return -1;
+    }
+    // A scrape that is gone before we accept it must not block the thread
+    fcntl(listener.fd, F_SETFL, fcntl(listener.fd, F_GETFL) | O_NONBLOCK);
+    page_fn = fn;
+    page_ctx = ctx;
+    atomic_store(&stopping, 0);
+
+    // Signals stay with the program's threads: SIGALRM has to interrupt
+    // the consumer's accept(), not land here
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rc = pthread_create(&thread, NULL, metrics_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        transport_listener_close(&listener);
+        errno = rc;
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void metrics_stop(void) {
+    if (!running) {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    pthread_join(thread, NULL);
+    running = 0;
+    transport_listener_close(&listener);
+}
+
+void metrics_describe(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
@@ -0,0 +1,37 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+/*
+ * Live metrics endpoint: a Prometheus-style text page served over HTTP
+ * on a side listener, so a long-running consumer (--daemon, --server)
+ * can be watched while it works.
+ *
+ * The address is a UNIX socket path if it contains a '/', else a TCP
+ * "host:port" or ":port" (every interface):
+ *
+ *     curl http://localhost:9100/metrics
+ *     curl --unix-socket /tmp/consumer.metrics http://localhost/metrics
+ *
+ * One background thread, started with every signal blocked so the
+ * program's own signal handling is unaffected, accepts one scrape at a
+ * time. For each it calls fn(out, ctx) to write the page into a memory
+ * stream and sends it with HTTP/1.0 framing. fn runs on that thread:
+ * whatever it reads must be safe to read while the program's threads
+ * run, atomics or state it locks itself, and it should not take locks
+ * the hot paths hold.
+ */
+
+typedef void (*metrics_fn)(FILE *out, void *ctx);
+
+// Listen on addr and start serving; returns 0, or -1 with errno set
+int metrics_start(const char *addr, metrics_fn fn, void *ctx);
+
+// Stop the thread and close the listener (a UNIX socket is unlinked)
+void metrics_stop(void);
+
+// Write a metric's "# HELP" and "# TYPE" lines (type: counter or gauge)
+void metrics_describe(FILE *out, const char *name, const char *type, const char *help);
+
+#endif // METRICS_H
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "parse.h"
+#include "stats.h"
+
+/*
+ * Bytes kept available ahead of the cursor before a token is parsed, so
+ * the fast path never needs a bounds check or refill in the middle of a
+ * normal-length token. Anything left below this is moved to the front
+ * of the buffer on refill.
+ */
+#define PARSE_LOOKAHEAD 64
+
+#define LITTLE_ENDIAN_HOST (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+static inline int is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_digit(unsigned char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+int parser_open(struct parser *p, const char *path) {
+    memset(p, 0, sizeof(*p));
+    p->buf = malloc(PARSE_BUF_SIZE);
+    if (!p->buf) {
+        return -1;
+    }
+    p->fd = open(path, O_RDONLY);
+    if (p->fd < 0) {
+        int saved = errno;
+        free(p->buf);
+        p->buf = NULL;
+        errno = saved;
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    p->base = p->pos = p->end = p->buf;
+    p->status = PARSE_OK;
+    return 0;
+}
+
+void parser_init_mem(struct parser *p, const char *data, size_t len, off_t offset) {
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->base = p->pos = data;
+    p->end = data + len;
+    p->eof = 1;
+    p->status = PARSE_OK;
+    p->consumed = offset;
+}
+
+void parser_close(struct parser *p) {
+    if (p->fd >= 0) {
+        close(p->fd);
+    }
+    free(p->buf);
+    p->fd = -1;
+    p->buf = NULL;
+}
+
+int parser_seek(struct parser *p, off_t offset) {
+    if (p->fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (lseek(p->fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    p->base = p->pos = p->end = p->buf;
+    p->eof = 0;
+    p->status = PARSE_OK;
+    p->consumed = offset;
+    return 0;
+}
+
+/*
+ * Keep the unread tail, then read more after it. Returns the number of
+ * new bytes (0 at EOF), or -1 on a read error.
+ */
+static ssize_t refill(struct parser *p) {
+    if (p->eof) {
+        return 0;
+    }
+    size_t left = (size_t)(p->end - p->pos);
+    p->consumed += p->pos - p->base;
+    memmove(p->buf, p->pos, left);
+    p->pos = p->buf;
+    p->end = p->buf + left;
+
+    ssize_t n;
+    do {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        n = read(p->fd, p->buf + left, PARSE_BUF_SIZE - left);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return -1;
+    }
+    if (n == 0) {
+        p->eof = 1;
+    }
+    p->end += n;
+    return n;
+}
+
+// Length of the digit run at s; at least 16 bytes must be readable
+static inline size_t digit_run16(const char *s) {
+#if defined(__SSE2__)
+    __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)s), _mm_set1_epi8('0'));
+    // Digits are exactly the bytes with (c - '0') <= 9 as unsigned
+    __m128i ok = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(9)), v);
+    unsigned mask = ~(unsigned)_mm_movemask_epi8(ok) & 0xFFFF;
+    return mask ? (size_t)__builtin_ctz(mask) : 16;
+#elif defined(__ARM_NEON)
+    uint8x16_t v = vsubq_u8(vld1q_u8((const uint8_t *)s), vdupq_n_u8('0'));
+    uint8x16_t ok = vcleq_u8(v, vdupq_n_u8(9));
+    // Narrow to one nibble per byte, giving a 64-bit mask
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(ok), 4)), 0);
+    mask = ~mask;
+    return mask ? (size_t)(__builtin_ctzll(mask) >> 2) : 16;
+#else
+    size_t n = 0;
+    while (n < 16 && is_digit((unsigned char)s[n])) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Convert len (1..8) ASCII digits at s; 8 bytes must be readable
+static inline uint32_t digits8(const char *s, size_t len) {
+#if LITTLE_ENDIAN_HOST
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+    // Drop the bytes past the run; the shifted-in zeros act as leading zeros
+    v <<= 8 * (8 - len);
+    v &= 0x0F0F0F0F0F0F0F0FULL;
+    v = (v * 2561) >> 8;                                    // pairs
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;      // quads
+    v = ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+    return (uint32_t)v;
+#else
+    uint32_t acc = 0;
+    for (size_t i = 0; i < len; i++) {
+        acc = acc * 10 + (uint32_t)(s[i] - '0');
+    }
+    return acc;
+#endif
+}
+
+/*
+ * Slow path for a digit run that may cross the end of the buffer (a
+ * token longer than PARSE_LOOKAHEAD, or the tail of the file). Returns
+ * 0 on success, -1 on a read error.
+ */
+static int scan_digits_slow(struct parser *p, value_t *acc) {
+    while (1) {
+        while (p->pos < p->end && is_digit((unsigned char)*p->pos)) {
+            *acc = (value_t)(*acc * 10 + (value_t)(*p->pos++ - '0'));
+        }
+        if (p->pos < p->end) {
+            return 0;
+        }
+        ssize_t n = refill(p);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+    }
+}
+
+static const uint32_t pow10[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+size_t parse_values(struct parser *p, value_t *out, size_t max) {
+    size_t count = 0;
+
+    while (count < max && p->status == PARSE_OK) {
+        // Skip whitespace, refilling as needed
+        while (1) {
+            while (p->pos < p->end && is_space((unsigned char)*p->pos)) {
+                p->pos++;
+            }
+            if (p->end - p->pos >= PARSE_LOOKAHEAD) {
+                break;
+            }
+            ssize_t n = refill(p);
+            if (n < 0) {
+                p->status = PARSE_ERR;
+                return count;
+            }
+            if (n == 0) {
+                break;
+            }
+        }
+        if (p->pos == p->end) {
+            p->status = PARSE_EOF;
+            break;
+        }
+
+        int neg = 0;
+        if (*p->pos == '-' || *p->pos == '+') {
+            neg = *p->pos == '-';
+            p->pos++;
+        }
+        if (p->pos == p->end || !is_digit((unsigned char)*p->pos)) {
+            // Not a number: fscanf("%d") would stop here too
+            p->status = PARSE_BAD;
+            break;
+        }
+
+        value_t acc = 0;
+        if (p->end - p->pos >= 16) {
+            size_t run = digit_run16(p->pos);
+            if (run <= 8) {
+                acc = (value_t)digits8(p->pos, run);
+                p->pos += run;
+            } else {
+                // Wraps like digit-by-digit accumulation would
+                acc = (value_t)((value_t)digits8(p->pos, 8) * pow10[run - 8] +
+                                digits8(p->pos + 8, run - 8));
+                p->pos += run;
+                if (run == 16 && scan_digits_slow(p, &acc) < 0) {
+                    p->status = PARSE_ERR;
+                    return count;
+                }
+            }
+        } else if (scan_digits_slow(p, &acc) < 0) {
+            p->status = PARSE_ERR;
+            return count;
+        }
+        out[count++] = neg ? (value_t)(0 - acc) : acc;
+    }
+    return count;
+}
@@ -0,0 +1,72 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "value.h"
+
+/*
+ * Bulk decimal integer parser, a drop-in for repeated fscanf("%d").
+ *
+ * Input is read through one large buffer with read(2), so there is no
+ * stdio locking or locale work per value. Tokens follow the same rules
+ * as "%d": leading whitespace is skipped, an optional sign is accepted,
+ * and parsing stops at the first token that does not start with a
+ * digit. Values are returned as value_t (two's complement for negative
+ * input, wrapped modulo 2^VALUE_BITS like the old (uint32_t)int cast).
+ *
+ * Digit runs are located with SSE2/NEON where available and converted
+ * eight digits at a time with SWAR arithmetic, two such blocks for
+ * tokens of up to 16 digits; short buffers near the end of input take
+ * a plain scalar path.
+ */
+
+#define PARSE_BUF_SIZE (1 << 20)
+
+enum parse_status {
+    PARSE_OK = 0,   // more values may follow
+    PARSE_EOF,      // clean end of input
+    PARSE_BAD,      // malformed token ("file ends early")
+    PARSE_ERR       // read() failed, errno is set
+};
+
+struct parser {
+    int fd;                 // -1 when parsing from memory
+    char *buf;              // owned read buffer, NULL when parsing from memory
+    const char *base;       // start of the current window (buf or memory)
+    const char *pos;        // next unread byte
+    const char *end;        // end of valid data in the window
+    int eof;                // no more data beyond end
+    enum parse_status status;
+    off_t consumed;         // bytes of input before base
+};
+
+// Open path for parsing; returns 0, or -1 with errno set
+int parser_open(struct parser *p, const char *path);
+
+/*
+ * Parse len bytes already in memory (e.g. an mmap'd chunk). offset is
+ * where data starts in the file and only affects parser_offset().
+ */
+void parser_init_mem(struct parser *p, const char *data, size_t len, off_t offset);
+
+void parser_close(struct parser *p);
+
+// Continue a file parser from byte offset of the input (a token start or
+// the whitespace before one); returns 0, or -1 with errno set
+int parser_seek(struct parser *p, off_t offset);
+
+/*
+ * Parse up to max values into out. Returns the number parsed; a short
+ * count means the input stopped and p->status tells why.
+ */
+size_t parse_values(struct parser *p, value_t *out, size_t max);
+
+// Byte offset of the first byte not yet consumed
+static inline off_t parser_offset(const struct parser *p) {
+    return p->consumed + (p->pos - p->base);
+}
+
+#endif // PARSE_H
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+
+/*
+ * Microbenchmark: fscanf("%d") versus the bulk parser in parse.c.
+ *
+ * Usage: ./parse_bench [input_file]
+ *   Without an input file, a temporary file with 10M random values
+ *   (one per line) is generated and removed afterwards.
+ *
+ * Both paths must agree on the value count and checksum.
+ */
+
+#define GEN_VALUES 10000000
+#define BENCH_CHUNK 4096
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int generate(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    srand(2431);
+    for (int i = 0; i < GEN_VALUES; i++) {
+        fprintf(f, "%d\n", rand());
+    }
+    return fclose(f);
+}
+
+static void report(const char *name, double secs, size_t count, off_t bytes) {
+    printf("%-8s %10zu values  %8.3f s  %10.1f Mvalues/s  %8.1f MB/s\n", name, count, secs,
+           (double)count / secs / 1e6, (double)bytes / secs / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    char tmp_path[] = "/tmp/parse_bench_XXXXXX";
+    const char *path;
+    int generated = 0;
+
+    if (argc >= 2) {
+        path = argv[1];
+    } else {
+        int fd = mkstemp(tmp_path);
+        if (fd < 0) {
+            perror("mkstemp");
+            return EXIT_FAILURE;
+        }
+        close(fd);
+        path = tmp_path;
+        generated = 1;
+        if (generate(path) < 0) {
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        perror("stat");
+        return EXIT_FAILURE;
+    }
+
+    // Baseline: what producer_thread_func used to do
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+    size_t scanf_count = 0;
+    value_t scanf_sum = 0;
+    int value;
+    double t0 = now_sec();
+    while (fscanf(f, "%d", &value) == 1) {
+        scanf_sum += (value_t)value;
+        scanf_count++;
+    }
+    double scanf_secs = now_sec() - t0;
+    fclose(f);
+
+    struct parser p;
+    if (parser_open(&p, path) < 0) {
+        perror("parser_open");
+        return EXIT_FAILURE;
+    }
+    value_t *chunk = malloc(BENCH_CHUNK * sizeof(value_t));
+    if (!chunk) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    size_t bulk_count = 0;
+    value_t bulk_sum = 0;
+    size_t n;
+    t0 = now_sec();
+    while ((n = parse_values(&p, chunk, BENCH_CHUNK)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            bulk_sum += chunk[i];
+        }
+        bulk_count += n;
+    }
+    double bulk_secs = now_sec() - t0;
+    parser_close(&p);
+    free(chunk);
+
+    report("fscanf", scanf_secs, scanf_count, st.st_size);
+    report("bulk", bulk_secs, bulk_count, st.st_size);
+    printf("speedup  %.1fx\n", scanf_secs / bulk_secs);
+
+    if (generated) {
+        unlink(path);
+    }
+    if (scanf_count != bulk_count || scanf_sum != bulk_sum) {
+        fprintf(stderr, "Mismatch: fscanf %zu values (sum %llu), bulk %zu values (sum %llu)\n",
+                scanf_count, (unsigned long long)scanf_sum, bulk_count,
+                (unsigned long long)bulk_sum);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+/*
+ * Minimal readiness poller for the consumer's server mode: epoll on
+ * Linux, kqueue on macOS and the BSDs. Level-triggered and read-only,
+ * which is all the event loop needs; each registered fd carries a user
+ * pointer that comes back with its events.
+ */
+
+#define POLLER_MAX_EVENTS 256
+
+struct poller_event {
+    void *ptr;
+    int hangup;     // peer closed or error; a read will say which
+};
+
+#if defined(__linux__)
+
+static inline int poller_create(void) {
+    return epoll_create1(0);
+}
+
+static inline int poller_add(int pfd, int fd, void *ptr) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = ptr;
+    return epoll_ctl(pfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static inline int poller_del(int pfd, int fd) {
+    struct epoll_event ev;  // Ignored, but old kernels want it non-NULL
+    return epoll_ctl(pfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+// Up to max events, waiting at most timeout_ms; -1 with EINTR on signals
+static inline int poller_wait(int pfd, struct poller_event *out, int max, int timeout_ms) {
+    struct epoll_event evs[POLLER_MAX_EVENTS];
+    if (max > POLLER_MAX_EVENTS) {
+        max = POLLER_MAX_EVENTS;
+    }
+    int n = epoll_wait(pfd, evs, max, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        out[i].ptr = evs[i].data.ptr;
+        out[i].hangup = (evs[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) != 0;
+    }
+    return n;
+}
+
+#else
+
+static inline int poller_create(void) {
+    return kqueue();
+}
+
+static inline int poller_add(int pfd, int fd, void *ptr) {
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, ptr);
+    return kevent(pfd, &ev, 1, NULL, 0, NULL);
+}
+
+static inline int poller_del(int pfd, int fd) {
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    return kevent(pfd, &ev, 1, NULL, 0, NULL);
+}
+
+static inline int poller_wait(int pfd, struct poller_event *out, int max, int timeout_ms) {
+    struct kevent evs[POLLER_MAX_EVENTS];
+    if (max > POLLER_MAX_EVENTS) {
+        max = POLLER_MAX_EVENTS;
+    }
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    int n = kevent(pfd, NULL, 0, evs, max, timeout_ms < 0 ? NULL : &ts);
+    for (int i = 0; i < n; i++) {
+        out[i].ptr = evs[i].udata;
+        out[i].hangup = (evs[i].flags & (EV_EOF | EV_ERROR)) != 0;
+    }
+    return n;
+}
+
+#endif
+
+#endif // POLLER_H
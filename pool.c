@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "pool.h"
+#include "lockprof.h"
+#include "stats.h"
+
+#define POOL_SPINS 64   // empty scans before a thread goes to sleep
+
+// The pool and deque index of the calling thread, if it is a pool thread
+static _Thread_local struct pool *self_pool = NULL;
+static _Thread_local int self_index = -1;
+
+/*
+ * Chase-Lev deque, after Lê et al., "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (PPoPP 2013), with a fixed-size array.
+ */
+
+// Owner only; returns -1 if the deque is full
+static int deque_push(struct pool_deque *d, struct pool_task *t) {
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= POOL_DEQUE_SIZE) {
+        return -1;
+    }
+    atomic_store_explicit(&d->slots[b & (POOL_DEQUE_SIZE - 1)], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Owner only: the most recently pushed task, or NULL
+static struct pool_task *deque_pop(struct pool_deque *d) {
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (top > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;    // Empty
+    }
+    struct pool_task *t = atomic_load_explicit(&d->slots[b & (POOL_DEQUE_SIZE - 1)],
+                                               memory_order_relaxed);
+    if (top == b) {
+        // The last one: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            t = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return t;
+}
+
+// Any thread: the oldest task, or NULL if empty or another thief won
+static struct pool_task *deque_steal(struct pool_deque *d) {
+    long long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b) {
+        return NULL;
+    }
+    struct pool_task *t = atomic_load_explicit(&d->slots[top & (POOL_DEQUE_SIZE - 1)],
+                                               memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    return t;
+}
+
+static struct pool_task *inject_take(struct pool *p) {
+    if (!atomic_load_explicit(&p->inject_head, memory_order_relaxed)) {
+        return NULL;    // Racy peek; a late task is seen on the next scan
+    }
+    LOCK(&p->mutex, "pool_mutex");
+    struct pool_task *t = p->inject_head;
+    if (t) {
+        p->inject_head = t->next;
+        if (!p->inject_head) {
+            p->inject_tail = NULL;
+        }
+    }
+    UNLOCK(&p->mutex);
+    return t;
+}
+
+// Own deque first, then the injection list, then steal from the others,
+// starting after ourselves so thieves spread out
+static struct pool_task *find_task(struct pool *p, int self) {
+    struct pool_task *t = deque_pop(&p->deques[self]);
+    if (!t) {
+        t = inject_take(p);
+    }
+    for (int i = 1; !t && i < p->threads; i++) {
+        t = deque_steal(&p->deques[(self + i) % p->threads]);
+    }
+    return t;
+}
+
+static void task_done(struct pool *p) {
+    if (atomic_fetch_sub(&p->pending, 1) == 1) {
+        pthread_mutex_lock(&p->done_mutex);
+        pthread_cond_broadcast(&p->done);
+        pthread_mutex_unlock(&p->done_mutex);
+    }
+}
+
+struct pool_start {
+    struct pool *pool;
+    int index;
+};
+
+static void *pool_thread_func(void *arg) {
+    struct pool_start *start = arg;
+    struct pool *p = start->pool;
+    int self = start->index;
+    free(start);
+    self_pool = p;
+    self_index = self;
+    STATS_REGISTER("pool");
+    LOCKPROF_THREAD("pool");
+
+    unsigned spins = 0;
+    while (1) {
+        unsigned long seq = atomic_load(&p->work_seq);
+        struct pool_task *t = find_task(p, self);
+        if (t) {
+            t->run(t, self);
+            task_done(p);
+            spins = 0;
+            continue;
+        }
+        if (atomic_load(&p->stopping)) {
+            break;
+        }
+        if (++spins < POOL_SPINS) {
+            sched_yield();
+            continue;
+        }
+        // Sleep unless something was submitted since the scan began; a
+        // submitter checks sleepers after bumping work_seq, so one of us
+        // always sees the other
+        LOCK(&p->mutex, "pool_mutex");
+        atomic_fetch_add(&p->sleepers, 1);
+        if (atomic_load(&p->work_seq) == seq && !atomic_load(&p->stopping)) {
+            COND_WAIT(&p->wake, &p->mutex);
+        }
+        atomic_fetch_sub(&p->sleepers, 1);
+        UNLOCK(&p->mutex);
+        spins = 0;
+    }
+    return NULL;
+}
+
+int pool_init(struct pool *p, int threads) {
+    if (threads < 1 || threads > POOL_MAX_THREADS) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(p, 0, sizeof(*p));
+    p->deques = aligned_alloc(64, (size_t)threads * sizeof(*p->deques));
+    if (!p->deques) {
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        atomic_init(&p->deques[i].top, 0);
+        atomic_init(&p->deques[i].bottom, 0);
+    }
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_mutex_init(&p->done_mutex, NULL);
+    pthread_cond_init(&p->done, NULL);
+    atomic_init(&p->work_seq, 0);
+    atomic_init(&p->sleepers, 0);
+    atomic_init(&p->stopping, 0);
+    atomic_init(&p->pending, 0);
+    for (int i = 0; i < threads; i++) {
+        struct pool_start *start = malloc(sizeof(*start));
+        if (!start || (start->pool = p, start->index = i,
+                       pthread_create(&p->ids[i], NULL, pool_thread_func, start) != 0)) {
+            free(start);
+            p->threads = i;
+            pool_destroy(p);
+            errno = EAGAIN;
+            return -1;
+        }
+        p->threads = i + 1;
+    }
+    return 0;
+}
+
+void pool_destroy(struct pool *p) {
+    if (p->threads > 0) {
+        pool_wait(p);
+    }
+    atomic_store(&p->stopping, 1);
+    LOCK(&p->mutex, "pool_mutex");
+    pthread_cond_broadcast(&p->wake);
+    UNLOCK(&p->mutex);
+    for (int i = 0; i < p->threads; i++) {
+        pthread_join(p->ids[i], NULL);
+    }
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->done_mutex);
+    pthread_cond_destroy(&p->done);
+    free(p->deques);
+    p->deques = NULL;
+    p->threads = 0;
+}
+
+void pool_submit(struct pool *p, struct pool_task *t) {
+    atomic_fetch_add(&p->pending, 1);
+    if (self_pool == p && deque_push(&p->deques[self_index], t) < 0) {
+        // Our deque is full: nobody is short of work, run it here
+        t->run(t, self_index);
+        task_done(p);
+        return;
+    }
+    if (self_pool != p) {
+        t->next = NULL;
+        LOCK(&p->mutex, "pool_mutex");
+        if (p->inject_tail) {
+            p->inject_tail->next = t;
+        } else {
+            p->inject_head = t;
+        }
+        p->inject_tail = t;
+        UNLOCK(&p->mutex);
+    }
+    atomic_fetch_add(&p->work_seq, 1);
+    if (atomic_load(&p->sleepers) > 0) {
+        LOCK(&p->mutex, "pool_mutex");
+        pthread_cond_signal(&p->wake);
+        UNLOCK(&p->mutex);
+    }
+}
+
+void pool_wait(struct pool *p) {
+    pthread_mutex_lock(&p->done_mutex);
+    while (atomic_load(&p->pending) > 0) {
+        pthread_cond_wait(&p->done, &p->done_mutex);
+    }
+    pthread_mutex_unlock(&p->done_mutex);
+}
+
+// pool_for(): one task per subrange, carved out of one array
+struct range_task {
+    struct pool_task task;
+    struct pool *pool;
+    struct range_set *set;
+    size_t lo;
+    size_t hi;
+};
+
+struct range_set {
+    void (*fn)(void *ctx, size_t i, int worker);
+    void *ctx;
+    struct range_task *tasks;
+    atomic_size_t used;
+};
+
+static void range_run(struct pool_task *t, int worker) {
+    struct range_task *r = (struct range_task *)t;
+    struct range_set *set = r->set;
+    // Keep the low half, offer the high half to thieves, until one is left
+    while (r->hi - r->lo > 1) {
+        size_t mid = r->lo + (r->hi - r->lo) / 2;
+        struct range_task *half = &set->tasks[atomic_fetch_add(&set->used, 1)];
+        half->task.run = range_run;
+        half->pool = r->pool;
+        half->set = set;
+        half->lo = mid;
+        half->hi = r->hi;
+        r->hi = mid;
+        pool_submit(r->pool, &half->task);
+    }
+    set->fn(set->ctx, r->lo, worker);
+}
+
+int pool_for(struct pool *p, size_t n, void (*fn)(void *ctx, size_t i, int worker), void *ctx) {
+    if (n == 0) {
+        return 0;
+    }
+    // A range of n splits n - 1 times, so n tasks always suffice
+    struct range_set set;
+    set.fn = fn;
+    set.ctx = ctx;
+    set.tasks = malloc(n * sizeof(*set.tasks));
+    if (!set.tasks) {
+        return -1;
+    }
+    atomic_init(&set.used, 1);
+    struct range_task *root = &set.tasks[0];
+    root->task.run = range_run;
+    root->pool = p;
+    root->set = &set;
+    root->lo = 0;
+    root->hi = n;
+    pool_submit(p, &root->task);
+    pool_wait(p);
+    free(set.tasks);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Work-stealing thread pool for the consumer's processing stages (see
+ * stage.h).
+ *
+ * Every pool thread owns a Chase-Lev deque: it pushes and pops tasks at
+ * the bottom without locks, and idle threads steal from the top of
+ * someone else's with one CAS, so a thread that splits its work keeps
+ * the cache-warm half and others take the rest. Tasks submitted from
+ * outside the pool (receivers, workers) go through a short mutex-guarded
+ * injection list instead. Threads with nothing to do spin briefly, then
+ * sleep until work is submitted.
+ *
+ * Tasks are caller-owned; run() may free its task. pool_wait() returns
+ * once every task submitted so far, and everything those spawned, has
+ * run.
+ */
+
+#define POOL_MAX_THREADS 64
+#define POOL_DEQUE_SIZE 4096    // tasks per thread's deque; a full one runs them inline
+
+struct pool_task {
+    // worker is the pool thread running it, 0 .. threads - 1, so tasks
+    // can keep per-thread partial results
+    void (*run)(struct pool_task *t, int worker);
+    struct pool_task *next;     // injection list link
+};
+
+struct pool_deque {
+    _Alignas(64) atomic_llong top;      // thieves take here
+    _Alignas(64) atomic_llong bottom;   // the owner pushes and pops here
+    _Atomic(struct pool_task *) slots[POOL_DEQUE_SIZE];
+};
+
+struct pool {
+    int threads;
+    pthread_t ids[POOL_MAX_THREADS];
+    struct pool_deque *deques;
+
+    pthread_mutex_t mutex;      // injection list and sleeping
+    pthread_cond_t wake;
+    struct pool_task *inject_head;
+    struct pool_task *inject_tail;
+    _Alignas(64) atomic_ulong work_seq;    // bumped by every submit
+    atomic_int sleepers;
+    atomic_int stopping;
+
+    _Alignas(64) atomic_long pending;      // submitted and not yet run
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done;
+};
+
+// Start threads pool threads (1 .. POOL_MAX_THREADS); returns 0 or -1
+int pool_init(struct pool *p, int threads);
+
+// Finish every submitted task, then stop the threads
+void pool_destroy(struct pool *p);
+
+// Queue a task: onto the caller's own deque from a pool thread, else
+// onto the injection list
+void pool_submit(struct pool *p, struct pool_task *t);
+
+// Wait until every task submitted so far has run; not from a pool task
+void pool_wait(struct pool *p);
+
+/*
+ * Run fn(ctx, i, worker) for every i in [0, n) on the pool and wait for
+ * all of them. The range is split in halves recursively, each thread
+ * keeping one half and leaving the other to be stolen, so uneven items
+ * balance themselves. Returns 0, or -1 if the split tasks can't be
+ * allocated; not from a pool task.
+ */
+int pool_for(struct pool *p, size_t n, void (*fn)(void *ctx, size_t i, int worker), void *ctx);
+
+#endif // POOL_H
@@ -1,190 +1,1746 @@
-#include <stdio.h> 
-#include <stdlib.h>
-#include <unistd.h>
-#include <pthread.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <sys/wait.h>
-#include <errno.h>
-#include <string.h>
-#include <signal.h>
-
-/*
- * Producer program responsibilities:
- * - Start as parent process
- * - fork() and exec() the consumer process
- * - Connect to consumer via a TCP socket (localhost)
- * - Create 2 threads that read integers from a file and send them to consumer
- * - Print required status line for each item read
- */
-
-#define NUM_THREADS 2
-#define PORT 12345
-#define MAX_DATA 100
-
-/* Shared state for the producer threads */
-static FILE *input_file = NULL;
-static int socket_fd = -1;
-static int numbers_read = 0;  // Count of numbers read so far
-static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-void *producer_thread_func(void *arg) {
-    (void)arg;
-    // Stub function for producer threads
-    // Print example message as placeholder
-    pid_t pid = getpid();
-    pthread_t tid = pthread_self();
-
-    while (1) {
-        int value;
-
-        // Critical section: file read + shared counter update
-        pthread_mutex_lock(&file_mutex);
-
-        // Stop once we've read MAX_DATA numbers total
-        if (numbers_read >= MAX_DATA) {
-            pthread_mutex_unlock(&file_mutex);
-            break;
-        }
-
-        // Read next integer; if file ends early or error occurs, stop producing
-        if (fscanf(input_file, "%d", &value) != 1) {
-            pthread_mutex_unlock(&file_mutex);
-            break;
-        }
-        numbers_read++;
-        printf("Producer PID %d, Thread ID %lu read data element %d\n",
-               pid, (unsigned long)tid, value);
-        // End of critical section
-        pthread_mutex_unlock(&file_mutex);
-        
-        uint32_t net_val = htonl((uint32_t)value);
-        ssize_t sent_bytes = send(socket_fd, &net_val, sizeof(net_val), 0);
-
-        // If send fails or sends partial bytes, stop this thread
-        if (sent_bytes != (ssize_t)sizeof(net_val)) {
-            perror("send failed");
-            break;
-        }
-    }
-
-    return NULL;
-}
-
-int main(int argc, char *argv[]) {
-    signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE to handle send errors gracefully
-    const char *filename = "numbers.txt"; // Input file with integers
-    // Input file is numbers.txt by default, but can be overridden via argv[1]
-    if (argc >= 2) {
-        filename = argv[1];
-    }
-    // Step 1: Fork and exec the consumer process (path to consumer binary needed)
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork failed");
-        exit(EXIT_FAILURE);
-    } else if (pid == 0) {
-        // Child process exec consumer
-        execl("./consumer", "consumer", NULL);
-        // Only reached if execl fails
-        perror("execl failed");
-        exit(EXIT_FAILURE);
-    }
-
-    // Open the input file that contains integers to be sent
-    input_file = fopen(filename, "r");
-    if(!input_file) {
-        perror("fopen numbers.txt");
-        int status;
-        kill(pid, SIGTERM); // Ensure child is killed if we fail here
-        waitpid(pid, &status, 0);  // Wait for child to prevent zombie
-        exit(EXIT_FAILURE);
-    }
-
-    // Consumer listens on localhost:PORT
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    // Use loopback directly (avoids inet_pton/inet_addr issues on macOS)
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    #ifdef __APPLE__
-    // macOS specific: explicitly set length to avoid EINVAL
-    server_addr.sin_len = sizeof(server_addr);
-    #endif
-
-    // Retry connecting until consumer is ready
-    int retries = 0;
-    const int MAX_RETRIES = 50;
-
-    // Step 2: Set up a socket connection (Retry loop for macOS robustness)
-    while (1) {
-        // IMPORTANT: Create a fresh socket for every attempt
-        // On macOS, a failed connect() renders the socket unusable
-        socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (socket_fd < 0) {
-            perror("socket creation failed");
-            kill(pid, SIGTERM);
-            waitpid(pid, NULL, 0);
-            fclose(input_file);
-            exit(EXIT_FAILURE);
-        }
-
-        if (connect(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0) {
-            // Connection successful
-            break;
-        }
-
-        // Connection failed - close this socket and retry
-        close(socket_fd);
-        socket_fd = -1; // Reset fd
-
-        if (errno == ECONNREFUSED || errno == ENETUNREACH) {
-            usleep(100000); // wait 100ms before retrying
-            retries++;
-            if (retries > MAX_RETRIES) {
-                fprintf(stderr, "Failed to connect after %d retries\n", MAX_RETRIES);
-                kill(pid, SIGTERM);
-                waitpid(pid, NULL, 0);
-                fclose(input_file);
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            // Some other error occurred
-            perror("connect");
-            kill(pid, SIGTERM);
-            waitpid(pid, NULL, 0);
-            fclose(input_file);
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    // Step 3: Create producer threads
-    pthread_t threads[NUM_THREADS];
-    int created = 0;
-
-    for (int i = 0; i < NUM_THREADS; i++) {
-        if(pthread_create(&threads[i], NULL, producer_thread_func, NULL) != 0) {
-            perror("pthread_create");
-            break;
-        }
-        created++;
-    }
-    // Wait for the threads that started
-    for(int i = 0; i < created; i++) {
-        pthread_join(threads[i], NULL);
-    }
-    // Cleanup
-    close(socket_fd);
-    fclose(input_file);
-    pthread_mutex_destroy(&file_mutex);
-    int status;
-    waitpid(pid, &status, 0);
-    //appropriate code to handle thread exit
-    // Close socket and cleanup
-    return 0;
+#include <stdio.h> 
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <poll.h>
+
+#include "protocol.h"
+#include "transport.h"
+#include "ring.h"
+#include "parse.h"
+#include "log.h"
+#include "codec.h"
+#include "affinity.h"
+#include "stats.h"
+#include "lockprof.h"
+#include "checkpoint.h"
+#include "bufpool.h"
+
+/*
+ * Producer program responsibilities:
+ * - Start as parent process
+ * - fork() and exec() the consumer process
+ * - Connect to consumer via a TCP socket (localhost)
+ * - Read integers from a file on a reader thread and pass them through a
+ *   lock-free ring (see ring.h) to 2 sender threads, which send them to
+ *   the consumer in frames of up to batch_size values (see protocol.h)
+ * - Print required status line for each item read
+ *
+ * Usage: ./producer [-b batch_size] [-n limit] [-t threads]
+ *                   [-r ring_capacity] [-s | -m | -B] [-c] [--log level]
+ *                   [--log-every N] [input_file]
+ *   -b 0 selects the original one-value-per-send() protocol.
+ *   -n   caps how many values are sent (default 100); -n 0 streams the
+ *        whole file. The limit is announced to the consumer in the hello.
+ *   -s   selects the original shared-file mode: every thread reads the
+ *        file itself under file_mutex, then sends.
+ *   -m, --mmap maps the file and gives each thread its own newline-aligned
+ *        chunk to parse and send, with no shared parser or lock.
+ *   -B, --binary treats the input as packed network-order uint32 values
+ *        and sends each thread's slice of it with sendfile(), never
+ *        parsing or copying it; the consumer receives straight into its
+ *        arena.
+ *   -T, --transport tcp|unix|shm picks how to reach the consumer (see
+ *        transport.h); --socket overrides the AF_UNIX rendezvous path.
+ *   --io blocking|uring picks how sockets are driven: plain blocking
+ *        send(), or io_uring (see uring.h), which queues sends and lets
+ *        the kernel push them out in large batches. Forwarded to the
+ *        consumer, whose receivers then use io_uring too.
+ *   --stamp puts the time each batch was taken into its frame, so the
+ *        consumer can report read-to-insert latency (see bench.sh).
+ *   --codec raw|varint|delta|pack|svb codes frame values compactly (see
+ *        codec.h) if the consumer accepts it in its hello ack.
+ *   --ordered asks the consumer to store every value at its sequence
+ *        number, so its storage is in file order however the threads
+ *        interleave (not with --mmap, whose sequence numbers are claim
+ *        order, nor -b 0, which has none).
+ *   --window N keeps at most N frames per connection in flight: each
+ *        frame uses a credit the consumer hands back once it has taken
+ *        the frame in (see struct credit). Default DEFAULT_WINDOW; 0
+ *        sends without flow control.
+ *   --connect sends to an already running consumer (e.g. ./consumer
+ *        --server) instead of starting one. Without it we still use one
+ *        that answers at the default address (./consumer --daemon) and
+ *        only fork our own if none does; --spawn always forks.
+ *   -c, --multi-conn opens one connection per thread instead of one
+ *        shared socket; every frame carries a sequence number so the
+ *        consumer can restore read order.
+ *   --shards K starts K consumers and deals the input out to them
+ *        (--partition rr in READ_CHUNKs, or hash by value), each with its
+ *        own ring, connections and -t senders; --consumers LIST sends to
+ *        running ones at the listed host:port addresses (or socket paths)
+ *        instead.
+ *   -w, --workers N sets the consumer's worker thread count.
+ *   --stage LIST has the consumer we start run processing stages over
+ *        the values as they arrive (stats, sort, write:PATH; see
+ *        stage.h), on a pool of as many threads as it has workers.
+ *   --persist PATH has it stream its storage to PATH as chunks fill
+ *        (see sink.h); ./consumer --reload PATH maps it back later.
+ *   --cpus LIST pins our threads to the listed CPUs in turn (senders,
+ *        then the reader; see affinity.h); --consumer-cpus LIST does the
+ *        same for the consumer's receivers and workers, and --numa has
+ *        the consumer keep each thread's storage on its own NUMA node.
+ *   --checkpoint FILE keeps FILE at the position the consumer has
+ *        acknowledged as stored (see checkpoint.h; implies --ordered);
+ *        --resume starts from FILE's position instead of the top of the
+ *        input. The exit status is 1 if the run broke off, so a retry
+ *        loop knows to go on.
+ *   --huge-pages backs frame buffers (see bufpool.h) with 2 MB pages,
+ *        here and in the consumer we start.
+ *   --log quiet|summary|sample|all picks the status output (default all,
+ *        the exact per-element lines); --log-every N sets the sampling
+ *        interval. Both are forwarded to the consumer.
+ */
+
+#define NUM_THREADS 2       // Default sender thread count
+#define MAX_THREADS 64
+#define RING_CAPACITY 4096  // Default ring size in values
+#define READ_CHUNK 256      // Values the reader parses per ring_push()
+#define DEFAULT_LIMIT 100  // Values sent unless -n says otherwise
+
+static struct cpu_list cpus;    // --cpus, empty = unpinned
+
+/* Shared state for the producer threads */
+static struct parser input;    // Bulk integer parser over the input file
+static _Atomic int64_t numbers_read = 0;  // Count of numbers read so far
+static int64_t max_data = DEFAULT_LIMIT;   // -n limit, INT64_MAX = until EOF
+static int batch_size = DEFAULT_BATCH;  // Values per frame, 0 = single mode
+static int num_threads = NUM_THREADS;
+
+/*
+ * --shards/--consumers: the input is split across num_shards consumers,
+ * each with its own connections, ring and sender threads. The reader
+ * deals values out round-robin, a READ_CHUNK at a time, or by a hash of
+ * the value so equal values always meet in the same consumer.
+ */
+#define MAX_SHARDS 16
+enum partition {
+    PARTITION_RR = 0,
+    PARTITION_HASH
+};
+static int num_shards = 1;
+static enum partition partition = PARTITION_RR;
+static struct ring rings[MAX_SHARDS];   // Reader -> each shard's senders in pipeline mode
+
+// --mmap/--binary mode: the whole input file, split into one chunk per thread
+struct mmap_chunk {
+    const char *start;
+    size_t len;
+    off_t offset;       // of start within the file
+};
+static const char *map_base = NULL;
+static size_t map_len = 0;
+static int input_fd = -1;       // --binary: kept open for sendfile()
+static struct mmap_chunk chunks[MAX_THREADS];
+static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// pthread_mutex_lock(), with the time spent waiting counted (STATS builds)
+// and the lock profiled under name (LOCKPROF builds)
+static inline void lock_counted(pthread_mutex_t *m, const char *name) {
+    STAT_TIMER(start);
+    LOCK(m, name);
+    STAT_SINCE(STAT_LOCK_WAIT_NS, start);
+}
+
+/*
+ * A connection to the consumer. Frames (and bare -b 0 values) go out
+ * under send_mutex so threads sharing one connection never interleave
+ * bytes; with
+ * --multi-conn every thread has its own and the lock is uncontended.
+ * The credit fields are only touched under send_mutex as well.
+ */
+struct conn {
+    struct transport t;
+    pthread_mutex_t send_mutex;
+    int windowed;           // the consumer granted a credit window
+    int stopped;            // it sent CREDIT_STOP
+    uint32_t credits;       // frames we may still send
+};
+static struct conn conns[MAX_THREADS];
+static int num_conns = 0;       // per shard; shard s has conns[s * num_conns ...]
+static int num_conns_open = 0;  // connected so far, for cleanup
+static pid_t consumer_pids[MAX_SHARDS];    // the consumers we started
+static int num_spawned = 0;     // 0 with --connect: not ours
+
+// What each producer/sender thread works on
+struct thread_ctx {
+    struct conn *conn;
+    struct ring *ring;          // pipeline mode: its shard's ring
+    struct mmap_chunk *chunk;   // --mmap mode only
+};
+static struct thread_ctx contexts[MAX_THREADS];
+
+// Room for the longest frame head (header, stamp, coded length), then up
+// to one batch of host-order values; the head is built flush against
+// values. With a codec, coded frames are built the same way in coded.
+// The head is rounded to whole values so no padding comes between them.
+#define FRAME_HEAD_MAX ((sizeof(struct frame_hdr) + FRAME_EXTRA_MAX + sizeof(value_t) - 1) \
+                        / sizeof(value_t) * sizeof(value_t))
+struct frame {
+    unsigned char *coded;       // FRAME_HEAD_MAX + codec_bound(batch_size), or NULL
+    unsigned char head[FRAME_HEAD_MAX];
+    value_t values[];
+};
+
+static int stamp_frames = 0;    // --stamp: FRAME_STAMPED on every frame
+static int codec = CODEC_RAW;   // --codec, as accepted by the consumer
+
+#define CHECKPOINT_INTERVAL_MS 1000
+
+// --checkpoint: the consumer's acks, saved to checkpoint_path
+static const char *checkpoint_path = NULL;
+static int checkpoint_binary = 0;           // offsets are positions * VALUE_BYTES
+static uint64_t resume_start = 0;           // position we started at (hello.start)
+static _Atomic uint64_t acked = 0;          // highest credit.acked so far
+static atomic_int send_failed = 0;          // the run broke off (any mode)
+static struct checkpoint checkpoint_base;   // the input's size and mtime
+static uint64_t checkpoint_saved = 0;       // values in the saved checkpoint
+static pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_wake = PTHREAD_COND_INITIALIZER;
+static int checkpoint_stopping = 0;
+
+// Text input: marks[k] is the byte offset just past position
+// resume_start + k * CHECKPOINT_VALUES, recorded as the parser passes it
+static off_t *marks = NULL;
+static size_t marks_len = 0;
+static size_t marks_cap = 0;
+static pthread_mutex_t mark_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int add_mark(off_t offset) {
+    LOCK(&mark_mutex, "mark_mutex");
+    if (marks_len == marks_cap) {
+        size_t cap = marks_cap ? marks_cap * 2 : 1024;
+        off_t *grown = realloc(marks, cap * sizeof(*marks));
+        if (!grown) {
+            UNLOCK(&mark_mutex);
+            return -1;  // Later checkpoints stay where they are
+        }
+        marks = grown;
+        marks_cap = cap;
+    }
+    marks[marks_len++] = offset;
+    UNLOCK(&mark_mutex);
+    return 0;
+}
+
+// The input offset of position values (a block boundary), or -1 if the
+// parser's mark for it is missing
+static off_t input_offset(uint64_t values) {
+    if (checkpoint_binary) {
+        return (off_t)(values * sizeof(value_t));
+    }
+    size_t k = (size_t)((values - resume_start) / CHECKPOINT_VALUES);
+    LOCK(&mark_mutex, "mark_mutex");
+    off_t offset = k < marks_len ? marks[k] : -1;
+    UNLOCK(&mark_mutex);
+    return offset;
+}
+
+// Take in a credit's acked position; a later credit may carry an older one
+static void note_acked(const struct credit *c) {
+    uint64_t v = ntoh64(c->acked);
+    uint64_t cur = atomic_load(&acked);
+    while (v > cur && !atomic_compare_exchange_weak(&acked, &cur, v)) {
+    }
+}
+
+// Save the acked position if it moved on; only one thread at a time
+static void save_checkpoint(void) {
+    uint64_t values = atomic_load(&acked);
+    off_t offset = values > checkpoint_saved ? input_offset(values) : -1;
+    if (offset < 0) {
+        return;
+    }
+    struct checkpoint cp = checkpoint_base;
+    cp.values = values;
+    cp.offset = (uint64_t)offset;
+    if (checkpoint_save(&cp, checkpoint_path) < 0) {
+        perror("save checkpoint");
+        return;
+    }
+    checkpoint_saved = values;
+}
+
+// Saves the checkpoint every CHECKPOINT_INTERVAL_MS until stopped
+static void *checkpoint_thread_func(void *arg) {
+    (void)arg;
+    LOCKPROF_THREAD("checkpoint");
+    LOCK(&checkpoint_mutex, "checkpoint_mutex");
+    while (!checkpoint_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (CHECKPOINT_INTERVAL_MS % 1000) * 1000000L;
+        deadline.tv_sec += CHECKPOINT_INTERVAL_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&checkpoint_wake, &checkpoint_mutex, &deadline);
+        UNLOCK(&checkpoint_mutex);
+        save_checkpoint();
+        LOCK(&checkpoint_mutex, "checkpoint_mutex");
+    }
+    UNLOCK(&checkpoint_mutex);
+    return NULL;
+}
+
+/*
+ * Record the input's identity for --checkpoint and, with resume, pick up
+ * where the saved checkpoint left off: numbering, the parser's offset (or
+ * for --binary the slices) start there. Returns 0, or -1 after printing
+ * why.
+ */
+static int start_checkpoint(const char *filename, int binary, int resume) {
+    struct stat st;
+    if (stat(filename, &st) < 0) {
+        perror("stat input");
+        return -1;
+    }
+    checkpoint_binary = binary;
+    checkpoint_base.input_size = (uint64_t)st.st_size;
+    checkpoint_base.input_mtime = (int64_t)st.st_mtime;
+    struct checkpoint cp;
+    cp.values = 0;
+    cp.offset = 0;
+    if (resume && checkpoint_load(&cp, checkpoint_path) < 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Can't resume from %s: %s\n", checkpoint_path, strerror(errno));
+            return -1;
+        }
+        fprintf(stderr, "No checkpoint in %s yet, starting from the beginning\n", checkpoint_path);
+        cp.values = 0;
+        cp.offset = 0;
+    } else if (resume) {
+        if (cp.input_size != checkpoint_base.input_size ||
+            cp.input_mtime != checkpoint_base.input_mtime) {
+            fprintf(stderr, "%s has changed since checkpoint %s was saved\n", filename,
+                    checkpoint_path);
+            return -1;
+        }
+        if (cp.values % CHECKPOINT_VALUES != 0 || cp.offset > cp.input_size ||
+            (binary && cp.offset != cp.values * sizeof(value_t))) {
+            fprintf(stderr, "Checkpoint %s does not fit %s\n", checkpoint_path, filename);
+            return -1;
+        }
+        if ((int64_t)cp.values >= max_data) {
+            fprintf(stderr, "Checkpoint %s is already at the -n limit\n", checkpoint_path);
+            return -1;
+        }
+        fprintf(stderr, "Resuming at value %llu, byte %llu of %s\n",
+                (unsigned long long)cp.values, (unsigned long long)cp.offset, filename);
+    }
+    if (!binary && cp.offset > 0 && parser_seek(&input, (off_t)cp.offset) < 0) {
+        perror("seek input");
+        return -1;
+    }
+    resume_start = cp.values;
+    numbers_read = (int64_t)cp.values;
+    checkpoint_saved = cp.values;
+    if (!binary && add_mark((off_t)cp.offset) < 0) {
+        perror("malloc marks");
+        return -1;
+    }
+    return 0;
+}
+
+// Per-thread status stream carrying the lab's "read data element" prefix
+static struct log_stream *open_log_stream(void) {
+    char prefix[96];
+    snprintf(prefix, sizeof(prefix), "Producer PID %d, Thread ID %lu read data element ",
+             getpid(), (unsigned long)pthread_self());
+    return log_stream_open(prefix);
+}
+
+/*
+ * Parse up to max values from the input, never going past max_data in
+ * total, and log the status line for each. The caller must be the only
+ * thread using the parser (hold file_mutex in shared-file mode).
+ * *seq gets the sequence number of out[0]. Returns 0 once the file ends
+ * early, a token is malformed or max_data is reached. With --checkpoint
+ * no call crosses a CHECKPOINT_VALUES boundary, so the offset at every
+ * boundary is known.
+ */
+static size_t read_values(value_t *out, size_t max, struct log_stream *log, uint64_t *seq) {
+    *seq = (uint64_t)numbers_read;
+    int64_t left = max_data - numbers_read;
+    if ((int64_t)max > left) {
+        max = (size_t)left;
+    }
+    size_t to_mark = CHECKPOINT_VALUES - (size_t)(*seq % CHECKPOINT_VALUES);
+    if (checkpoint_path && max > to_mark) {
+        max = to_mark;
+    }
+    STAT_TIMER(start);
+    size_t n = parse_values(&input, out, max);
+    STAT_SINCE(STAT_PARSE_NS, start);
+    if (n < max && input.status == PARSE_ERR) {
+        perror("read input");
+    }
+    numbers_read += (int64_t)n;
+    if (checkpoint_path && n == to_mark && add_mark(parser_offset(&input)) < 0) {
+        perror("malloc marks");
+    }
+    log_values(log, out, n);
+    return n;
+}
+
+/*
+ * Use up one frame's credit; call with send_mutex held. With none left,
+ * push out what is queued (the consumer can only grant for frames it
+ * has) and wait for the next grant. Only the sending thread waits: no
+ * parser or ring lock is held here. Returns 0, or -1 with errno ENOSPC
+ * once the consumer has no room left, or another errno if the
+ * connection failed.
+ */
+static int take_credit(struct conn *conn) {
+    if (!conn->windowed) {
+        return 0;
+    }
+    STAT_TIMER(start);
+    while (conn->credits == 0 && !conn->stopped) {
+        if (transport_flush(&conn->t) < 0) {
+            return -1;
+        }
+        struct credit c;
+        ssize_t n = transport_recv(&conn->t, &c, sizeof(c));
+        if (n != (ssize_t)sizeof(c)) {
+            if (n >= 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        conn->credits += ntohl(c.frames);
+        note_acked(&c);
+        conn->stopped = (ntohl(c.flags) & CREDIT_STOP) != 0;
+    }
+    STAT_SINCE(STAT_CREDIT_WAIT_NS, start);
+    if (conn->stopped) {
+        errno = ENOSPC;
+        return -1;
+    }
+    conn->credits--;
+    return 0;
+}
+
+// Shared-file single mode: one parse and one 4-byte send() per value
+static void produce_single(struct conn *conn, struct log_stream *log) {
+    while (1) {
+        value_t value;
+        uint64_t seq;
+
+        // Critical section: file read + shared counter update
+        lock_counted(&file_mutex, "file_mutex");
+
+        // Read next integer; stop at max_data, if file ends early or error occurs
+        if (read_values(&value, 1, log, &seq) != 1) {
+            UNLOCK(&file_mutex);
+            break;
+        }
+        // End of critical section
+        UNLOCK(&file_mutex);
+        
+        value_t net_val = value_hton(value);
+        // If send fails or sends partial bytes, stop this thread
+        lock_counted(&conn->send_mutex, "send_mutex");
+        int rc = transport_send(&conn->t, &net_val, sizeof(net_val));
+        UNLOCK(&conn->send_mutex);
+        if (rc < 0) {
+            perror("send failed");
+            atomic_store(&send_failed, 1);
+            break;
+        }
+        STAT_ADD(STAT_ELEMENTS, 1);
+    }
+}
+
+/*
+ * Write the frame head for count values at seq (header, plus the time
+ * the values were taken with --stamp and the length of coded values if
+ * coded_len isn't 0) to the end of out[FRAME_HEAD_MAX]; returns its length.
+ */
+static size_t frame_head(unsigned char *out, uint32_t count, uint64_t seq, uint32_t coded_len) {
+    uint32_t flags = (stamp_frames ? FRAME_STAMPED : 0) | (coded_len ? FRAME_ENCODED : 0);
+    size_t len = sizeof(struct frame_hdr) + frame_extra(flags);
+    unsigned char *p = out + FRAME_HEAD_MAX - len;
+    struct frame_hdr hdr;
+    hdr.count = htonl(count);
+    hdr.flags = htonl(flags);
+    hdr.seq = hton64(seq);
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    if (flags & FRAME_STAMPED) {
+        uint64_t stamp = hton64(now_ns());
+        memcpy(p, &stamp, sizeof(stamp));
+        p += sizeof(stamp);
+    }
+    if (flags & FRAME_ENCODED) {
+        uint32_t net_len = htonl(coded_len);
+        memcpy(p, &net_len, sizeof(net_len));
+    }
+    return len;
+}
+
+/*
+ * Send the first count values of f, tagged with seq: coded if there is a
+ * codec and that saves bytes, raw otherwise. Frames go out under the
+ * connection's send_mutex. Returns 0 or -1.
+ */
+static int send_batch(struct conn *conn, struct frame *f, uint32_t count, uint64_t seq) {
+    if (batch_size == 0) {
+        // Original protocol: one bare value per send()
+        int rc = 0;
+        lock_counted(&conn->send_mutex, "send_mutex");
+        for (uint32_t i = 0; i < count && rc == 0; i++) {
+            value_t net_val = value_hton(f->values[i]);
+            rc = transport_send(&conn->t, &net_val, sizeof(net_val));
+        }
+        UNLOCK(&conn->send_mutex);
+        STAT_ADD(STAT_ELEMENTS, rc == 0 ? count : 0);
+        if (rc < 0) {
+            atomic_store(&send_failed, 1);
+        }
+        return rc;
+    }
+
+    const unsigned char *out;
+    size_t len;
+    size_t coded_len = codec != CODEC_RAW
+        ? codec_encode((enum codec)codec, f->values, count, f->coded + FRAME_HEAD_MAX) : 0;
+    if (coded_len > 0 && coded_len < count * sizeof(value_t)) {
+        size_t head = frame_head(f->coded, count, seq, (uint32_t)coded_len);
+        out = f->coded + FRAME_HEAD_MAX - head;
+        len = head + coded_len;
+    } else {
+        size_t head = frame_head(f->head, count, seq, 0);
+        for (uint32_t i = 0; i < count; i++) {
+            f->values[i] = value_hton(f->values[i]);
+        }
+        out = f->head + FRAME_HEAD_MAX - head;
+        len = head + count * sizeof(value_t);
+    }
+    lock_counted(&conn->send_mutex, "send_mutex");
+    int rc = take_credit(conn);
+    if (rc == 0) {
+        rc = transport_send(&conn->t, out, len);
+    }
+    UNLOCK(&conn->send_mutex);
+    STAT_ADD(STAT_ELEMENTS, rc == 0 ? count : 0);
+    if (rc < 0) {
+        atomic_store(&send_failed, 1);
+    }
+    return rc;
+}
+
+// --binary: our header, then the payload straight from the input file
+static int send_file_batch(struct conn *conn, uint32_t count, uint64_t seq, off_t offset) {
+    unsigned char buf[FRAME_HEAD_MAX];
+    size_t head = frame_head(buf, count, seq, 0);
+    lock_counted(&conn->send_mutex, "send_mutex");
+    int rc = take_credit(conn);
+    if (rc == 0) {
+        rc = transport_sendfile(&conn->t, buf + FRAME_HEAD_MAX - head, head, input_fd, offset,
+                                count * sizeof(value_t));
+    }
+    UNLOCK(&conn->send_mutex);
+    STAT_ADD(STAT_ELEMENTS, rc == 0 ? count : 0);
+    if (rc < 0) {
+        atomic_store(&send_failed, 1);
+    }
+    return rc;
+}
+
+// Flush a sending thread's queued data before it exits: the kernel
+// cancels io_uring sends still pending from a thread that is gone
+static void finish_sends(struct conn *conn) {
+    lock_counted(&conn->send_mutex, "send_mutex");
+    if (transport_flush(&conn->t) < 0) {
+        perror("send failed");
+        atomic_store(&send_failed, 1);
+    }
+    UNLOCK(&conn->send_mutex);
+}
+
+// Pool sizes of a frame for one batch (at least one value in single
+// mode) and of its coded form
+static size_t frame_values(void) {
+    return batch_size > 0 ? (size_t)batch_size : 1;
+}
+
+static size_t frame_bytes(void) {
+    return sizeof(struct frame) + frame_values() * sizeof(value_t);
+}
+
+static size_t coded_bytes(void) {
+    return FRAME_HEAD_MAX + codec_bound((uint32_t)frame_values());
+}
+
+// Room for a header plus one batch, and for its coded form if there is
+// a codec, from the buffer pool
+static struct frame *alloc_frame(void) {
+    struct frame *f = buf_alloc(frame_bytes());
+    if (f) {
+        f->coded = NULL;
+    }
+    if (f && codec != CODEC_RAW && !(f->coded = buf_alloc(coded_bytes()))) {
+        buf_free(f, frame_bytes());
+        f = NULL;
+    }
+    if (!f) {
+        perror("malloc frame");
+    }
+    return f;
+}
+
+static void free_frame(struct frame *f) {
+    if (f) {
+        buf_free(f->coded, coded_bytes());
+        buf_free(f, frame_bytes());
+    }
+}
+
+// Shared-file framed mode: read up to batch_size values, then send them as one frame
+static void produce_framed(struct conn *conn, struct log_stream *log) {
+    struct frame *frame = alloc_frame();
+    if (!frame) {
+        return;
+    }
+
+    while (1) {
+        uint64_t seq;
+
+        // Critical section: fill one batch from the file
+        lock_counted(&file_mutex, "file_mutex");
+        uint32_t count = (uint32_t)read_values(frame->values, (size_t)batch_size, log, &seq);
+        UNLOCK(&file_mutex);
+
+        // Limit reached or file ends early: nothing left to send
+        if (count == 0) {
+            break;
+        }
+
+        if (send_batch(conn, frame, count, seq) < 0) {
+            perror("send failed");
+            break;
+        }
+    }
+
+    free_frame(frame);
+}
+
+// --partition hash: the shard of a value; multiplicative hashing spreads
+// runs of close values, and the top bits pick the shard without a divide
+static inline int shard_of(value_t value) {
+#if VALUE_BITS == 64
+    uint64_t h = (value * 0x9e3779b97f4a7c15ULL) >> 32;
+#else
+    uint64_t h = (uint32_t)value * 2654435761u;
+#endif
+    return (int)((h * (uint64_t)num_shards) >> 32);
+}
+
+/*
+ * Pipeline mode reader: the only thread touching the parser, so parsing
+ * needs no lock. Parsed values go into the rings in chunks: all into
+ * rings[0] with one shard, else dealt out by partition. Hashed values
+ * collect in one bucket per shard until it holds a whole chunk.
+ */
+void *reader_thread_func(void *arg) {
+    (void)arg;
+    STATS_REGISTER("reader");
+    LOCKPROF_THREAD("reader");
+    struct log_stream *log = open_log_stream();
+    value_t chunk[READ_CHUNK];
+    static value_t buckets[MAX_SHARDS][READ_CHUNK];
+    size_t filled[MAX_SHARDS] = { 0 };
+    int turn = 0;       // round-robin: the shard the next chunk goes to
+    int failed = 0;
+
+    while (!failed) {
+        uint64_t seq;   // Implicit: each ring's push order is its shard's read order
+
+        // Read next integers; if file ends early or error occurs, stop producing
+        size_t n = read_values(chunk, READ_CHUNK, log, &seq);
+        if (n == 0) {
+            break;
+        }
+        if (partition == PARTITION_RR || num_shards == 1) {
+            failed = ring_push(&rings[turn], chunk, n) < 0;
+            turn = turn + 1 == num_shards ? 0 : turn + 1;
+            continue;
+        }
+        for (size_t i = 0; i < n && !failed; i++) {
+            int s = shard_of(chunk[i]);
+            buckets[s][filled[s]++] = chunk[i];
+            if (filled[s] == READ_CHUNK) {
+                failed = ring_push(&rings[s], buckets[s], READ_CHUNK) < 0;
+                filled[s] = 0;
+            }
+        }
+    }
+    // Senders that failed leave nobody to drain their ring; else hand
+    // out the last partial buckets
+    for (int s = 0; s < num_shards && !failed; s++) {
+        failed = filled[s] > 0 && ring_push(&rings[s], buckets[s], filled[s]) < 0;
+    }
+
+    for (int s = 0; s < num_shards; s++) {
+        ring_close(&rings[s]);
+    }
+    return NULL;
+}
+
+// Pipeline mode sender: drain up to one batch at a time and send it
+void *sender_thread_func(void *arg) {
+    struct thread_ctx *ctx = arg;
+    STATS_REGISTER("sender");
+    LOCKPROF_THREAD("sender");
+    struct frame *frame = alloc_frame();
+    if (!frame) {
+        ring_cancel(ctx->ring);
+        return NULL;
+    }
+    size_t max = batch_size > 0 ? (size_t)batch_size : 1;
+
+    size_t count;
+    size_t first;
+    while ((count = ring_pop(ctx->ring, frame->values, max, &first)) > 0) {
+        if (send_batch(ctx->conn, frame, (uint32_t)count, resume_start + first) < 0) {
+            perror("send failed");
+            ring_cancel(ctx->ring);
+            break;
+        }
+    }
+
+    finish_sends(ctx->conn);
+    free_frame(frame);
+    return NULL;
+}
+
+/*
+ * Claim up to want values against the max_data cap without a lock.
+ * Returns how many may still be sent (0 once the cap is reached); *start
+ * gets the sequence number of the first one.
+ */
+static uint32_t claim_values(uint32_t want, uint64_t *start) {
+    int64_t cur = atomic_load(&numbers_read);
+    int64_t got;
+    do {
+        if (cur >= max_data) {
+            return 0;
+        }
+        got = (int64_t)want < max_data - cur ? (int64_t)want : max_data - cur;
+    } while (!atomic_compare_exchange_weak(&numbers_read, &cur, cur + got));
+    *start = (uint64_t)cur;
+    return (uint32_t)got;
+}
+
+/*
+ * --mmap mode thread: parses and sends its own chunk of the mapping.
+ * A malformed token ends this chunk only; the other chunks carry on.
+ */
+void *mmap_thread_func(void *arg) {
+    struct thread_ctx *ctx = arg;
+    STATS_REGISTER("mmap");
+    LOCKPROF_THREAD("mmap");
+    struct mmap_chunk *chunk = ctx->chunk;
+    struct log_stream *log = open_log_stream();
+    struct frame *frame = alloc_frame();
+    if (!frame) {
+        return NULL;
+    }
+    size_t max = batch_size > 0 ? (size_t)batch_size : 1;
+
+    struct parser p;
+    parser_init_mem(&p, chunk->start, chunk->len, chunk->offset);
+    while (1) {
+        uint64_t seq;
+        STAT_TIMER(start);
+        size_t n = parse_values(&p, frame->values, max);
+        STAT_SINCE(STAT_PARSE_NS, start);
+        // The chunks end at max_data already; the claim numbers the values
+        uint32_t count = n > 0 ? claim_values((uint32_t)n, &seq) : 0;
+        if (count == 0) {
+            break;
+        }
+        log_values(log, frame->values, count);
+        if (send_batch(ctx->conn, frame, count, seq) < 0) {
+            perror("send failed");
+            break;
+        }
+    }
+    parser_close(&p);
+
+    finish_sends(ctx->conn);
+    free_frame(frame);
+    return NULL;
+}
+
+/*
+ * --binary mode thread: sends its slice of the file as frames whose
+ * payload never passes through user space. The values are only read
+ * (from the mapping) when they have to be logged, or coded with
+ * --codec, which sends them like any other frame instead. The file
+ * position of each value is its sequence number.
+ */
+void *binary_thread_func(void *arg) {
+    struct thread_ctx *ctx = arg;
+    STATS_REGISTER("binary");
+    LOCKPROF_THREAD("binary");
+    struct mmap_chunk *chunk = ctx->chunk;
+    struct log_stream *log = open_log_stream();
+    struct frame *frame = NULL;
+    if ((log || codec != CODEC_RAW) && !(frame = alloc_frame())) {
+        return NULL;
+    }
+
+    const value_t *src = (const value_t *)chunk->start;
+    off_t offset = chunk->offset;
+    size_t left = chunk->len / sizeof(value_t);
+    while (left > 0) {
+        uint32_t count = left < (size_t)batch_size ? (uint32_t)left : (uint32_t)batch_size;
+        if (frame) {
+            for (uint32_t i = 0; i < count; i++) {
+                frame->values[i] = value_ntoh(src[i]);
+            }
+            log_values(log, frame->values, count);
+        }
+        uint64_t seq = (uint64_t)offset / sizeof(value_t);
+        if (codec != CODEC_RAW) {
+            if (send_batch(ctx->conn, frame, count, seq) < 0) {
+                perror("send failed");
+                break;
+            }
+        } else if (send_file_batch(ctx->conn, count, seq, offset) < 0) {
+            perror("sendfile failed");
+            break;
+        }
+        atomic_fetch_add(&numbers_read, (int64_t)count);
+        src += count;
+        offset += (off_t)(count * sizeof(value_t));
+        left -= count;
+    }
+
+    finish_sends(ctx->conn);
+    free_frame(frame);
+    return NULL;
+}
+
+/*
+ * --binary: split the first max_data values of the mapping into up to n
+ * slices of whole values. Returns the number of non-empty slices.
+ */
+static int split_binary(int n) {
+    size_t values = map_len / sizeof(value_t);
+    if (map_len % sizeof(value_t) != 0) {
+        fprintf(stderr, "Ignoring %zu trailing bytes of the binary input\n",
+                map_len % sizeof(value_t));
+    }
+    if ((int64_t)values > max_data) {
+        values = (size_t)max_data;
+    }
+    size_t pos = (size_t)resume_start;     // --resume: the checkpoint's position
+    size_t share = values > pos ? (values - pos) / (size_t)n : 0;
+    size_t first = pos;
+    int used = 0;
+    for (int i = 0; i < n && pos < values; i++) {
+        size_t end = i == n - 1 ? values : first + share * (size_t)(i + 1);
+        if (end <= pos) {
+            continue;
+        }
+        chunks[used].start = map_base + pos * sizeof(value_t);
+        chunks[used].len = (end - pos) * sizeof(value_t);
+        chunks[used].offset = (off_t)(pos * sizeof(value_t));
+        used++;
+        pos = end;
+    }
+    return used;
+}
+
+static inline int text_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Bytes of the mapping that hold its first limit tokens. The threads
+// parse their chunks concurrently, so -n has to cut the text in file
+// order up front for them to send the same values a plain read would
+static size_t text_prefix(int64_t limit) {
+    size_t pos = 0;
+    for (int64_t seen = 0; seen < limit; seen++) {
+        while (pos < map_len && text_space(map_base[pos])) {
+            pos++;
+        }
+        if (pos == map_len) {
+            break;
+        }
+        while (pos < map_len && !text_space(map_base[pos])) {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+/*
+ * Split the mapping (its first max_data values with -n) into up to n
+ * chunks of roughly equal size. Every boundary is moved forward past
+ * the next newline (or other whitespace for single-line files) so no
+ * token is cut in two. Returns the number of non-empty chunks.
+ */
+static int split_mapping(int n) {
+    size_t len = max_data < INT64_MAX ? text_prefix(max_data) : map_len;
+    size_t pos = 0;
+    int used = 0;
+    for (int i = 0; i < n && pos < len; i++) {
+        size_t end = i == n - 1 ? len : len / (size_t)n * (size_t)(i + 1);
+        if (end < pos) {
+            end = pos;
+        }
+        const char *nl = memchr(map_base + end, '\n', len - end);
+        if (nl) {
+            end = (size_t)(nl - map_base) + 1;
+        } else {
+            while (end < len && map_base[end] != ' ' && map_base[end] != '\t') {
+                end++;
+            }
+        }
+        chunks[used].start = map_base + pos;
+        chunks[used].len = end - pos;
+        chunks[used].offset = (off_t)pos;
+        used++;
+        pos = end;
+    }
+    return used;
+}
+
+// Map the whole input file read-only; an empty file maps to nothing.
+// keep_fd leaves the file open in input_fd as well.
+static int map_input(const char *filename, int keep_fd) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    map_len = (size_t)st.st_size;
+    if (map_len > 0) {
+        void *addr = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(addr, map_len, MADV_SEQUENTIAL);
+        map_base = addr;
+    }
+    if (keep_fd) {
+        input_fd = fd;
+    } else {
+        close(fd);  // The mapping keeps the file alive
+    }
+    return 0;
+}
+
+// Release whichever input source main() opened
+static void close_input(void) {
+    if (input_fd >= 0) {
+        close(input_fd);
+        input_fd = -1;
+    }
+    if (map_base) {
+        munmap((void *)map_base, map_len);
+        map_base = NULL;
+    } else if (input.buf) {
+        parser_close(&input);
+    }
+}
+
+// Shared-file mode thread: reads the file itself under file_mutex
+void *producer_thread_func(void *arg) {
+    struct thread_ctx *ctx = arg;
+    STATS_REGISTER("shared");
+    LOCKPROF_THREAD("shared");
+    struct log_stream *log = open_log_stream();
+
+    if (batch_size == 0) {
+        produce_single(ctx->conn, log);
+    } else {
+        produce_framed(ctx->conn, log);
+    }
+
+    finish_sends(ctx->conn);
+    return NULL;
+}
+
+/*
+ * Done sending on every connection with a credit window. The consumer
+ * may have granted credit we will never read, and closing a socket with
+ * unread data resets it, which can cost the consumer frames it has not
+ * read yet. So half-close them all (it only hangs up once the whole
+ * session has ended), then read grants until it does.
+ */
+static void drain_credits(void) {
+    for (int i = 0; i < num_conns_open; i++) {
+        if (conns[i].windowed && transport_shutdown(&conns[i].t) < 0) {
+            conns[i].windowed = 0;
+        }
+    }
+    for (int i = 0; i < num_conns_open; i++) {
+        struct credit c;
+        while (conns[i].windowed &&
+               transport_recv(&conns[i].t, &c, sizeof(c)) == (ssize_t)sizeof(c)) {
+            note_acked(&c);
+        }
+    }
+}
+
+// Close every connection opened so far
+static void close_conns(void) {
+    for (int i = 0; i < num_conns_open; i++) {
+        transport_close(&conns[i].t);
+        pthread_mutex_destroy(&conns[i].send_mutex);
+    }
+    num_conns_open = 0;
+}
+
+// Setup failed: stop the consumer, release everything and exit
+static void abort_run(void) {
+    for (int s = 0; s < num_spawned; s++) {
+        kill(consumer_pids[s], SIGTERM); // Ensure child is killed if we fail here
+        waitpid(consumer_pids[s], NULL, 0);  // Wait for child to prevent zombie
+    }
+    close_conns();
+    close_input();
+    exit(EXIT_FAILURE);
+}
+
+// How long to wait for a consumer: for its ready byte when we start it,
+// and across all connect attempts when it runs on its own
+#define CONNECT_TIMEOUT_MS 5000
+#define BACKOFF_MIN_US 500
+#define BACKOFF_MAX_US 100000
+
+// Wait for the consumer we started to report that it listens (a byte on
+// the ready pipe, see consumer.c). Returns 0, or -1 after reporting the
+// error: EOF means it exited before listening
+static int wait_ready(int fd) {
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    int rc;
+    do {
+        rc = poll(&p, 1, CONNECT_TIMEOUT_MS);
+    } while (rc < 0 && errno == EINTR);
+    if (rc == 0) {
+        fprintf(stderr, "Consumer did not start listening within %d ms\n", CONNECT_TIMEOUT_MS);
+        return -1;
+    }
+    char c;
+    ssize_t n;
+    do {
+        n = read(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1) {
+        if (n < 0) {
+            perror("ready pipe");
+        } else {
+            fprintf(stderr, "Consumer exited before listening\n");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Connect to the consumer, retrying with exponential backoff until it
+// listens. A consumer we started has already said it is ready, so this
+// only waits for one launched separately (--connect). Returns 0, or -1
+// after reporting the error.
+static int connect_consumer(struct transport *t, enum transport_kind kind, const char *path) {
+    long delay_us = BACKOFF_MIN_US;
+    long waited_us = 0;
+
+    // Retry loop for macOS robustness: transport_connect() creates a
+    // fresh socket for every attempt, since on macOS a failed connect()
+    // renders the socket unusable
+    while (1) {
+        if (transport_connect(t, kind, path) == 0) {
+            // Connection successful
+            return 0;
+        }
+
+        // Not listening yet: no socket file, or nobody accepting on it
+        if (errno == ECONNREFUSED || errno == ENETUNREACH || errno == ENOENT) {
+            if (waited_us >= CONNECT_TIMEOUT_MS * 1000L) {
+                fprintf(stderr, "Failed to connect within %d ms\n", CONNECT_TIMEOUT_MS);
+                return -1;
+            }
+            STAT_ADD(STAT_SYSCALLS, 1);
+            usleep((useconds_t)delay_us);
+            waited_us += delay_us;
+            delay_us = delay_us * 2 > BACKOFF_MAX_US ? BACKOFF_MAX_US : delay_us * 2;
+        } else {
+            // Some other error occurred
+            perror("connect");
+            return -1;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE to handle send errors gracefully
+    const char *filename = "numbers.txt"; // Input file with integers
+    int shared_mode = 0;
+    int mmap_mode = 0;
+    int multi_conn = 0;
+    int binary_mode = 0;
+    int spawn = 1;
+    int force_spawn = 0;
+    int probed = 0;
+    int transport = TRANSPORT_TCP;
+    int io = TRANSPORT_IO_BLOCKING;
+    char socket_path[108] = "";
+    int log_level = LOG_ALL;
+    unsigned long long log_every = LOG_DEFAULT_EVERY;
+    long ring_capacity = RING_CAPACITY;
+    const char *workers_arg = NULL;
+    const char *consumer_cpus = NULL;
+    const char *stage_arg = NULL;
+    const char *persist_arg = NULL;
+    int numa_local = 0;
+    int huge_pages = 0;
+    int requested_codec = CODEC_RAW;
+    long window = DEFAULT_WINDOW;
+    int ordered = 0;
+    int resume = 0;
+    const char *consumer_list = NULL;
+    static const struct option long_opts[] = {
+        { "mmap", no_argument, NULL, 'm' },
+        { "multi-conn", no_argument, NULL, 'c' },
+        { "binary", no_argument, NULL, 'B' },
+        { "connect", no_argument, NULL, 'C' },
+        { "spawn", no_argument, NULL, 'F' },
+        { "transport", required_argument, NULL, 'T' },
+        { "socket", required_argument, NULL, 'S' },
+        { "io", required_argument, NULL, 'I' },
+        { "stamp", no_argument, NULL, 'P' },
+        { "codec", required_argument, NULL, 'Z' },
+        { "window", required_argument, NULL, 'K' },
+        { "ordered", no_argument, NULL, 'O' },
+        { "workers", required_argument, NULL, 'w' },
+        { "stage", required_argument, NULL, 'G' },
+        { "persist", required_argument, NULL, 'Q' },
+        { "cpus", required_argument, NULL, 'U' },
+        { "consumer-cpus", required_argument, NULL, 'V' },
+        { "numa", no_argument, NULL, 'N' },
+        { "huge-pages", no_argument, NULL, 'J' },
+        { "shards", required_argument, NULL, 'X' },
+        { "consumers", required_argument, NULL, 'A' },
+        { "partition", required_argument, NULL, 'Y' },
+        { "checkpoint", required_argument, NULL, 'H' },
+        { "resume", no_argument, NULL, 'R' },
+        { "log", required_argument, NULL, 'L' },
+        { "log-every", required_argument, NULL, 'E' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:n:t:r:w:smcBT:", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            batch_size = parse_batch_size(optarg);
+            if (batch_size < 0) {
+                fprintf(stderr, "Invalid batch size '%s' (0..%d)\n", optarg, MAX_BATCH);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n': {
+            char *end;
+            long long v = strtoll(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || v < 0) {
+                fprintf(stderr, "Invalid limit '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            max_data = v == 0 ? INT64_MAX : (int64_t)v;
+            break;
+        }
+        case 't':
+            num_threads = (int)parse_count(optarg, 1, MAX_THREADS);
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                fprintf(stderr, "Invalid thread count '%s' (1..%d)\n", optarg, MAX_THREADS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            ring_capacity = (long)parse_count(optarg, 2, 1L << 30);
+            if (ring_capacity < 0) {
+                fprintf(stderr, "Invalid ring capacity '%s' (2..%ld)\n", optarg, 1L << 30);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            shared_mode = 1;
+            break;
+        case 'm':
+            mmap_mode = 1;
+            break;
+        case 'c':
+            multi_conn = 1;
+            break;
+        case 'B':
+            binary_mode = 1;
+            break;
+        case 'C':
+            spawn = 0;
+            break;
+        case 'F':
+            force_spawn = 1;
+            break;
+        case 'T':
+            transport = transport_parse_kind(optarg);
+            if (transport < 0) {
+                fprintf(stderr, "Invalid transport '%s' (tcp, unix, shm)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            if (strlen(optarg) >= sizeof(socket_path)) {
+                fprintf(stderr, "Socket path too long '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            strcpy(socket_path, optarg);
+            break;
+        case 'I':
+            io = transport_parse_io(optarg);
+            if (io < 0) {
+                fprintf(stderr, "Invalid I/O engine '%s' (blocking, uring)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            stamp_frames = 1;
+            break;
+        case 'Z':
+            requested_codec = codec_parse(optarg);
+            if (requested_codec < 0) {
+                fprintf(stderr, "Invalid codec '%s' (raw, varint, delta, pack%s)\n", optarg,
+                        codec_available(CODEC_SVB) ? ", svb" : "; svb needs WIDTH=32");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'K': {
+            char *end;
+            window = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || window < 0 || window > MAX_WINDOW) {
+                fprintf(stderr, "Invalid window '%s' (0..%d frames)\n", optarg, MAX_WINDOW);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'O':
+            ordered = 1;
+            break;
+        case 'w':
+            workers_arg = optarg;   // The consumer checks the range
+            break;
+        case 'G':
+            stage_arg = optarg;     // And the stage list
+            break;
+        case 'Q':
+            persist_arg = optarg;
+            break;
+        case 'U':
+            if (cpu_list_parse(&cpus, optarg) < 0) {
+                fprintf(stderr, "Invalid CPU list '%s' (e.g. 0-3,8)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'V':
+            consumer_cpus = optarg;
+            break;
+        case 'N':
+            numa_local = 1;
+            break;
+        case 'J':
+            huge_pages = 1;
+            bufpool_init(1);
+            break;
+        case 'X':
+            num_shards = (int)parse_count(optarg, 1, MAX_SHARDS);
+            if (num_shards < 1 || num_shards > MAX_SHARDS) {
+                fprintf(stderr, "Invalid shard count '%s' (1..%d)\n", optarg, MAX_SHARDS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'A':
+            consumer_list = optarg;
+            break;
+        case 'Y':
+            if (strcmp(optarg, "rr") == 0) {
+                partition = PARTITION_RR;
+            } else if (strcmp(optarg, "hash") == 0) {
+                partition = PARTITION_HASH;
+            } else {
+                fprintf(stderr, "Invalid partitioning '%s' (rr, hash)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'H':
+            checkpoint_path = optarg;
+            break;
+        case 'R':
+            resume = 1;
+            break;
+        case 'L':
+            log_level = log_parse_level(optarg);
+            if (log_level < 0) {
+                fprintf(stderr, "Invalid log level '%s' (quiet, summary, sample, all)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'E': {
+            long long every = parse_count(optarg, 1, INT64_MAX);
+            if (every < 0) {
+                fprintf(stderr, "Invalid log interval '%s' (1 or more)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            log_every = (unsigned long long)every;
+            break;
+        }
+        default:
+            fprintf(stderr, "Usage: %s [-b batch_size] [-n limit] [-t threads] [-r ring_capacity] [-s | -m | -B] [-c]\n"
+                    "       [-w consumer_workers] [--stage list] [--persist path] [--cpus list] [--consumer-cpus list] [--numa]\n"
+                    "       [--huge-pages]\n"
+                    "       [-T tcp|unix|shm] [--socket path] [--io blocking|uring] [--connect | --spawn]\n"
+                    "       [--stamp] [--codec raw|varint|delta|pack|svb] [--window frames] [--ordered]\n"
+                    "       [--shards K | --consumers list] [--partition rr|hash]\n"
+                    "       [--checkpoint file [--resume]]\n"
+                    "       [--log level] [--log-every N] [input_file]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (shared_mode + mmap_mode + binary_mode > 1) {
+        fprintf(stderr, "-s, --mmap and --binary are mutually exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (binary_mode && batch_size == 0) {
+        fprintf(stderr, "--binary needs framed mode (-b 1 or more)\n");
+        exit(EXIT_FAILURE);
+    }
+    // --mmap numbers values in the order threads claim them, not file order
+    if (ordered && (mmap_mode || batch_size == 0)) {
+        fprintf(stderr, "--ordered needs file-order sequence numbers (not --mmap or -b 0)\n");
+        exit(EXIT_FAILURE);
+    }
+    // Acks count stored positions, so only ordered frames with credits carry them
+    if (resume && !checkpoint_path) {
+        fprintf(stderr, "--resume needs --checkpoint FILE\n");
+        exit(EXIT_FAILURE);
+    }
+    if (checkpoint_path && (mmap_mode || batch_size == 0 || window == 0)) {
+        fprintf(stderr, "--checkpoint needs file-order frames and credits (not --mmap, -b 0 or "
+                "--window 0)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (checkpoint_path) {
+        ordered = 1;
+    }
+    // Input file is numbers.txt by default, but can be overridden by the first operand
+    if (optind < argc) {
+        filename = argv[optind];
+    }
+    if (!spawn && force_spawn) {
+        fprintf(stderr, "--connect and --spawn exclude each other\n");
+        exit(EXIT_FAILURE);
+    }
+    // Shards: --consumers names where each one listens; else we start
+    // --shards of them ourselves, one address each (see below)
+    char shard_addr[MAX_SHARDS][108];
+    if (consumer_list) {
+        if (num_shards > 1 || force_spawn) {
+            fprintf(stderr, "--consumers excludes --shards and --spawn\n");
+            exit(EXIT_FAILURE);
+        }
+        num_shards = 0;
+        for (const char *p = consumer_list; p; ) {
+            const char *comma = strchr(p, ',');
+            size_t len = comma ? (size_t)(comma - p) : strlen(p);
+            if (num_shards == MAX_SHARDS || len == 0 || len >= sizeof(shard_addr[0])) {
+                fprintf(stderr, "Invalid consumer list '%s' (1..%d addresses)\n", consumer_list,
+                        MAX_SHARDS);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(shard_addr[num_shards], p, len);
+            shard_addr[num_shards++][len] = '\0';
+            p = comma ? comma + 1 : NULL;
+        }
+        spawn = 0;
+    }
+    if (num_shards > 1 && (shared_mode || mmap_mode || binary_mode)) {
+        fprintf(stderr, "Shards need the pipeline mode (not -s, --mmap or --binary)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (num_shards > 1 && checkpoint_path) {
+        fprintf(stderr, "--checkpoint needs a single consumer\n");
+        exit(EXIT_FAILURE);
+    }
+    if (num_shards * num_threads > MAX_THREADS) {
+        fprintf(stderr, "%d shards of %d sender threads is more than %d threads\n", num_shards,
+                num_threads, MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    if (num_shards > 1 && stage_arg && strstr(stage_arg, "write:")) {
+        fprintf(stderr, "--stage write:PATH would have every shard write PATH; --persist PATH "
+                "gives shard k PATH.k\n");
+        exit(EXIT_FAILURE);
+    }
+    // A resident consumer (--daemon or --server) listening at the
+    // well-known address saves the fork and exec; this first connection
+    // then becomes our connection 0
+    if (spawn && !force_spawn && num_shards == 1 &&
+        transport_connect(&conns[0].t, (enum transport_kind)transport,
+                          transport == TRANSPORT_TCP ? NULL
+                          : socket_path[0] ? socket_path : TRANSPORT_DEFAULT_PATH) == 0) {
+        spawn = 0;
+        probed = 1;
+    }
+    if (!spawn && (stage_arg || persist_arg)) {
+        fprintf(stderr, "Warning: --stage and --persist only apply to a consumer we start; the running one keeps its own\n");
+    }
+    // Only what the consumer has synced to disk may be checkpointed
+    if (spawn && checkpoint_path && !persist_arg) {
+        fprintf(stderr, "--checkpoint needs --persist: without it stored values don't outlive "
+                "the consumer\n");
+        exit(EXIT_FAILURE);
+    }
+    // Consumer logs the same way we do and listens where we will connect;
+    // the default socket path is per run so concurrent runs don't collide
+    char every_arg[24];
+    snprintf(every_arg, sizeof(every_arg), "%llu", log_every);
+    if (socket_path[0] == '\0') {
+        if (spawn) {
+            snprintf(socket_path, sizeof(socket_path), "/tmp/producer-consumer.%d.sock", (int)getpid());
+        } else {
+            strcpy(socket_path, TRANSPORT_DEFAULT_PATH);
+        }
+    }
+    // Where each shard's consumer listens: for tcp one port each from
+    // PORT up, else one socket path each
+    for (int i = 0; i < num_shards && !consumer_list; i++) {
+        int len = transport == TRANSPORT_TCP
+            ? snprintf(shard_addr[i], sizeof(shard_addr[i]), "127.0.0.1:%d", PORT + i)
+            : num_shards == 1 ? snprintf(shard_addr[i], sizeof(shard_addr[i]), "%s", socket_path)
+            : snprintf(shard_addr[i], sizeof(shard_addr[i]), "%s.%d", socket_path, i);
+        if (len >= (int)sizeof(shard_addr[i])) {
+            fprintf(stderr, "Socket path too long '%s'\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Step 1: Fork and exec the consumer processes (path to consumer binary needed).
+    // Each reports on its ready pipe once it listens; only the write end
+    // survives exec, and only in the child it belongs to
+    int ready_fds[MAX_SHARDS];
+    for (int shard = 0; spawn && shard < num_shards; shard++) {
+        int ready[2];
+        if (pipe(ready) < 0 || fcntl(ready[0], F_SETFD, FD_CLOEXEC) < 0) {
+            perror("pipe failed");
+            abort_run();
+        }
+        char ready_arg[16];
+        snprintf(ready_arg, sizeof(ready_arg), "%d", ready[1]);
+        char port_arg[16];
+        snprintf(port_arg, sizeof(port_arg), "%d", PORT + shard);
+        char shard_persist[4096];
+        snprintf(shard_persist, sizeof(shard_persist), num_shards > 1 ? "%s.%d" : "%s",
+                 persist_arg ? persist_arg : "", shard);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            abort_run();
+        } else if (pid == 0) {
+            // Child process exec consumer
+            const char *args[32];
+            int n = 0;
+            args[n++] = "consumer";
+            args[n++] = "--log";
+            args[n++] = log_level_name(log_level);
+            args[n++] = "--log-every";
+            args[n++] = every_arg;
+            args[n++] = "--transport";
+            args[n++] = transport_kind_name((enum transport_kind)transport);
+            args[n++] = "--io";
+            args[n++] = transport_io_name((enum transport_io)io);
+            args[n++] = "--socket";
+            args[n++] = transport == TRANSPORT_TCP ? socket_path : shard_addr[shard];
+            if (transport == TRANSPORT_TCP && num_shards > 1) {
+                args[n++] = "--port";
+                args[n++] = port_arg;
+            }
+            if (binary_mode) {
+                args[n++] = "--direct";  // Binary payloads need no copying on the way in either
+            }
+            if (workers_arg) {
+                args[n++] = "--workers";
+                args[n++] = workers_arg;
+            }
+            if (stage_arg) {
+                args[n++] = "--stage";
+                args[n++] = stage_arg;
+            }
+            if (persist_arg) {
+                args[n++] = "--persist";
+                args[n++] = shard_persist;
+            }
+            if (consumer_cpus) {
+                args[n++] = "--cpus";
+                args[n++] = consumer_cpus;
+            }
+            if (numa_local) {
+                args[n++] = "--numa";
+            }
+            if (huge_pages) {
+                args[n++] = "--huge-pages";
+            }
+            args[n++] = "--ready-fd";
+            args[n++] = ready_arg;
+            args[n] = NULL;
+            execv("./consumer", (char *const *)args);
+            // Only reached if execv fails
+            perror("execv failed");
+            exit(EXIT_FAILURE);
+        }
+        consumer_pids[num_spawned++] = pid;
+        close(ready[1]);
+        ready_fds[shard] = ready[0];
+    }
+    STATS_START("Producer");     // After the fork: the consumer counts its own
+    LOCKPROF_THREAD("main");
+
+    // Open the input file that contains integers to be sent
+    if ((mmap_mode || binary_mode ? map_input(filename, binary_mode)
+                                  : parser_open(&input, filename)) < 0) {
+        perror("open numbers.txt");
+        abort_run();
+    }
+    if (checkpoint_path && start_checkpoint(filename, binary_mode, resume) < 0) {
+        abort_run();
+    }
+
+    // Step 2: Connect to the consumers and announce framing, limit and layout
+    for (int shard = 0; shard < num_spawned; shard++) {
+        int rc = wait_ready(ready_fds[shard]);
+        close(ready_fds[shard]);
+        if (rc < 0) {
+            abort_run();
+        }
+    }
+    num_conns = multi_conn ? num_threads : 1;
+    uint64_t session = ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL);
+    for (int i = 0; i < num_shards * num_conns; i++) {
+        if (!(i == 0 && probed) &&
+            connect_consumer(&conns[i].t, (enum transport_kind)transport,
+                             shard_addr[i / num_conns]) < 0) {
+            abort_run();
+        }
+        transport_set_io(&conns[i].t, (enum transport_io)io);
+        pthread_mutex_init(&conns[i].send_mutex, NULL);
+        num_conns_open = i + 1;
+
+        struct hello hello;
+        memset(&hello, 0, sizeof(hello));
+        hello.magic = htonl(PROTO_MAGIC);
+        hello.version = htonl(PROTO_VERSION);
+        hello.batch_size = htonl((uint32_t)batch_size);
+        hello.conn_id = htons((uint16_t)(i % num_conns));
+        hello.conn_count = htons((uint16_t)num_conns);
+        // How much of -n a shard gets isn't known up front, so shards get no limit
+        hello.limit = hton64(max_data == INT64_MAX || num_shards > 1 ? 0 : (uint64_t)max_data);
+        hello.session = hton64(session);
+        hello.codec = htonl((uint32_t)(batch_size > 0 ? requested_codec : CODEC_RAW));
+        hello.window = htonl((uint32_t)window);
+        hello.flags = htonl((ordered ? HELLO_ORDERED : 0) | (checkpoint_path ? HELLO_ACKS : 0));
+        hello.start = hton64(resume_start);
+        hello.value_bits = htonl(VALUE_BITS);
+        if (transport_send(&conns[i].t, &hello, sizeof(hello)) < 0) {
+            perror("send hello");
+            abort_run();
+        }
+        // The consumer says which codec it takes, the same for every
+        // connection, and how many frames each may send up front
+        struct hello_ack ack;
+        if (transport_recv(&conns[i].t, &ack, sizeof(ack)) != (ssize_t)sizeof(ack) ||
+            ntohl(ack.magic) != PROTO_MAGIC || !codec_available((int)ntohl(ack.codec))) {
+            fprintf(stderr, "Bad or missing hello ack from consumer\n");
+            abort_run();
+        }
+        if (i > 0 && (int)ntohl(ack.codec) != codec) {
+            fprintf(stderr, "Consumers disagree on the codec\n");
+            abort_run();
+        }
+        codec = (int)ntohl(ack.codec);
+        conns[i].credits = ntohl(ack.window);
+        conns[i].windowed = conns[i].credits > 0;
+        conns[i].stopped = 0;
+        if (i == 0 && codec != requested_codec && batch_size > 0) {
+            fprintf(stderr, "Consumer does not take --codec %s, sending raw values\n",
+                    codec_name((enum codec)requested_codec));
+        }
+        if (i == 0 && ordered && !checkpoint_path && !(ntohl(ack.flags) & HELLO_ORDERED)) {
+            fprintf(stderr, "Consumer does not take --ordered (server mode?), storage order "
+                    "will vary\n");
+        }
+        if (i == 0 && checkpoint_path && !(ntohl(ack.flags) & HELLO_ACKS)) {
+            fprintf(stderr, "Consumer does not acknowledge durable progress (no --persist, or "
+                    "server mode?), can't --checkpoint\n");
+            abort_run();
+        }
+    }
+
+    // Background writer for the status lines
+    if (log_init((enum log_level)log_level, log_every) < 0) {
+        perror("log_init");
+        abort_run();
+    }
+
+    pthread_t checkpointer;
+    int have_checkpointer = 0;
+    if (checkpoint_path) {
+        if (pthread_create(&checkpointer, NULL, checkpoint_thread_func, NULL) != 0) {
+            perror("pthread_create");
+            abort_run();
+        }
+        have_checkpointer = 1;
+    }
+
+    // Step 3: Create producer threads
+    pthread_t threads[MAX_THREADS];
+    pthread_t reader;
+    int have_reader = 0;
+    int created = 0;
+
+    // Shard s has sender threads s * num_threads ... on its own connections
+    int senders = num_shards * num_threads;
+    for (int i = 0; i < senders; i++) {
+        int shard = i / num_threads;
+        contexts[i].conn = &conns[shard * num_conns + i % num_threads % num_conns];
+        contexts[i].ring = &rings[shard];
+        contexts[i].chunk = &chunks[i];
+    }
+
+    if (binary_mode) {
+        int n = split_binary(num_threads);
+        for (int i = 0; i < n; i++) {
+            if (thread_create_on(&threads[i], cpu_list_pick(&cpus, i), binary_thread_func,
+                                 &contexts[i]) != 0) {
+                perror("pthread_create");
+                break;
+            }
+            created++;
+        }
+    } else if (mmap_mode) {
+        int n = split_mapping(num_threads);
+        for (int i = 0; i < n; i++) {
+            if (thread_create_on(&threads[i], cpu_list_pick(&cpus, i), mmap_thread_func,
+                                 &contexts[i]) != 0) {
+                perror("pthread_create");
+                break;
+            }
+            created++;
+        }
+    } else if (shared_mode) {
+        for (int i = 0; i < num_threads; i++) {
+            if (thread_create_on(&threads[i], cpu_list_pick(&cpus, i), producer_thread_func,
+                                 &contexts[i]) != 0) {
+                perror("pthread_create");
+                break;
+            }
+            created++;
+        }
+    } else {
+        for (int shard = 0; shard < num_shards; shard++) {
+            if (ring_init(&rings[shard], (size_t)ring_capacity) < 0) {
+                perror("ring_init");
+                abort_run();
+            }
+        }
+        for (int i = 0; i < senders; i++) {
+            if (thread_create_on(&threads[i], cpu_list_pick(&cpus, i), sender_thread_func,
+                                 &contexts[i]) != 0) {
+                perror("pthread_create");
+                break;
+            }
+            created++;
+        }
+        // The reader only starts once someone can drain every ring (the
+        // last shard's first sender was created last but one)
+        int drained = created > (num_shards - 1) * num_threads;
+        if (drained && thread_create_on(&reader, cpu_list_pick(&cpus, senders),
+                                        reader_thread_func, NULL) == 0) {
+            have_reader = 1;
+        } else {
+            if (drained) {
+                perror("pthread_create");
+            }
+            for (int shard = 0; shard < num_shards; shard++) {
+                ring_close(&rings[shard]);
+            }
+        }
+    }
+    // Wait for the threads that started
+    if (have_reader) {
+        pthread_join(reader, NULL);
+    }
+    for(int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int shard = 0; !shared_mode && !mmap_mode && !binary_mode && shard < num_shards; shard++) {
+        ring_destroy(&rings[shard]);
+    }
+    // Cleanup
+    drain_credits();
+    // The last acks are in: keep the checkpoint if the run broke off
+    int failed = atomic_load(&send_failed);
+    if (have_checkpointer) {
+        LOCK(&checkpoint_mutex, "checkpoint_mutex");
+        checkpoint_stopping = 1;
+        pthread_cond_signal(&checkpoint_wake);
+        UNLOCK(&checkpoint_mutex);
+        pthread_join(checkpointer, NULL);
+        save_checkpoint();
+        if (failed && checkpoint_saved > 0) {
+            fprintf(stderr, "Run broke off; %llu values are stored, rerun with --resume to "
+                    "continue from %s\n", (unsigned long long)checkpoint_saved, checkpoint_path);
+        } else {
+            // Nothing acked: whatever FILE holds is an older run's, and
+            // this one truncated the consumer's --persist file
+            unlink(checkpoint_path);
+            if (failed) {
+                fprintf(stderr, "Run broke off before any values were stored; no checkpoint "
+                        "saved, the run has to start over\n");
+            }
+        }
+    }
+    free(marks);
+    close_conns();
+    close_input();
+    pthread_mutex_destroy(&file_mutex);
+    log_shutdown();
+    log_summary("Producer PID %d read %lld data elements\n", getpid(), (long long)numbers_read);
+    STATS_STOP();
+    LOCKPROF_REPORT("Producer");
+    int status;
+    for (int shard = 0; shard < num_spawned; shard++) {
+        waitpid(consumer_pids[shard], &status, 0);
+    }
+    //appropriate code to handle thread exit
+    // Close socket and cleanup
+    return failed ? EXIT_FAILURE : 0;
 }
\ No newline at end of file
@@ -0,0 +1,229 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "stats.h"
+#include "value.h"
+
+/*
+ * Wire protocol shared by producer and consumer.
+ *
+ * Framed mode (default): each send() carries one frame, a frame_hdr
+ * followed by `count` network-order values (value_t, VALUE_BYTES each),
+ * tagged with the sequence number of its first value.
+ *
+ * Single mode (batch size 0): the original protocol, one bare
+ * network-order value per send()/recv(). Kept for comparison.
+ *
+ * Every connection starts with a hello from the producer announcing the
+ * framing and how many values it will send at most, so both ends always
+ * agree and the consumer can size its storage. The consumer answers
+ * each hello with a hello_ack naming the value encoding it accepted and
+ * the credit window it grants (see struct credit).
+ */
+
+#define PORT 12345
+
+#define DEFAULT_BATCH 64    // values per frame unless -b is given
+#define MAX_BATCH 65536     // upper bound accepted by the consumer
+
+#define DEFAULT_WINDOW 64   // frames in flight per connection unless --window is given
+#define MAX_WINDOW 4096     // most frames of credit the consumer grants
+
+#define PROTO_MAGIC 0x43534532u   // "CSE2"
+#define PROTO_VERSION 7
+
+#define MAX_CONNS 64        // connections per producer session
+
+/*
+ * Sent once by the producer on every connection right after connect();
+ * all fields network order. A producer may open several connections
+ * (one per sender thread); they share the session id and each carries
+ * its own conn_id.
+ */
+struct hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t batch_size;    // values per frame, 0 = single mode
+    uint16_t conn_id;       // 0 .. conn_count - 1
+    uint16_t conn_count;    // connections in this session
+    uint64_t limit;         // values the producer sends at most, 0 = until EOF
+    uint64_t session;       // identifies one producer run
+    uint32_t codec;         // value encoding the producer would like (codec.h)
+    uint32_t window;        // frames it would keep in flight, 0 = no flow control
+    uint32_t flags;         // HELLO_* bits
+    uint32_t value_bits;    // VALUE_BITS the producer was built with; must match
+    uint64_t start;         // first position sent, > 0 when resuming (HELLO_ACKS)
+};
+
+/*
+ * HELLO_ORDERED: frame sequence numbers are input positions, and the
+ * consumer should store every value at its position so storage reads
+ * back in input order (ordered delivery, see arena.h).
+ */
+#define HELLO_ORDERED 0x1u
+
+/*
+ * HELLO_ACKS (with HELLO_ORDERED): the producer checkpoints. Every
+ * credit then carries how far the input is stored without a gap, in
+ * whole CHECKPOINT_VALUES blocks (synced to disk first if the consumer
+ * persists), and a resumed run names where it starts in hello.start,
+ * always such a block boundary: positions before it are stored already.
+ */
+#define HELLO_ACKS 0x2u
+#define CHECKPOINT_VALUES 16384     // ack granularity, one consumer arena chunk
+
+/*
+ * The consumer's reply to every hello, network order. codec is the
+ * encoding FRAME_ENCODED frames on this connection may use: the one
+ * asked for if the consumer knows it, else CODEC_RAW (no encoded frames).
+ * window is the credit granted up front, in frames: at most the window
+ * asked for and MAX_WINDOW, and 0 (no flow control) in single mode.
+ * flags are the HELLO_* requests it honours.
+ */
+struct hello_ack {
+    uint32_t magic;         // PROTO_MAGIC
+    uint32_t codec;
+    uint32_t window;
+    uint32_t flags;
+};
+
+/*
+ * Credit flow control, consumer to producer on the same connection,
+ * network order. With a window, every frame the producer sends uses one
+ * credit, and with none left it stops sending until a grant arrives.
+ * The consumer hands credits back once frames have been passed to its
+ * workers (or stored), so a producer never has more than the window in
+ * flight and pauses as soon as inserting falls behind, instead of
+ * filling socket buffers. Grants never exceed the storage left;
+ * CREDIT_STOP says there is none, and the producer stops sending on
+ * this connection.
+ */
+struct credit {
+    uint32_t frames;        // credits granted
+    uint32_t flags;         // CREDIT_* bits
+    uint64_t acked;         // HELLO_ACKS: positions 0 .. acked - 1 are stored, else 0
+};
+
+#define CREDIT_STOP 0x1u
+
+/*
+ * seq is the position of the batch's first value in the producer's
+ * global read order, so batches arriving on different connections can
+ * be put back in order.
+ */
+struct frame_hdr {
+    uint32_t count;         // number of values that follow, network order
+    uint32_t flags;         // FRAME_* bits, network order
+    uint64_t seq;           // network order
+};
+
+/*
+ * FRAME_STAMPED: the header is followed by a network-order uint64_t,
+ * the CLOCK_MONOTONIC time in ns when the producer took the values, so
+ * the consumer can measure read-to-insert latency (same host only).
+ */
+#define FRAME_STAMPED 0x1u
+
+/*
+ * FRAME_ENCODED: the values are coded with the connection's codec. After
+ * the stamp (if any) comes a network-order uint32_t byte length, then
+ * that many bytes that decode to exactly count values. Senders only use
+ * it when the coded form is smaller, so it is never longer than
+ * codec_bound(count).
+ */
+#define FRAME_ENCODED 0x2u
+#define FRAME_KNOWN_FLAGS (FRAME_STAMPED | FRAME_ENCODED)
+
+// Most bytes frame_extra() asks for, with every known flag set
+#define FRAME_EXTRA_MAX (sizeof(uint64_t) + sizeof(uint32_t))
+
+// Bytes between the header and the values for these flags
+static inline size_t frame_extra(uint32_t flags) {
+    return ((flags & FRAME_STAMPED) ? sizeof(uint64_t) : 0) +
+           ((flags & FRAME_ENCODED) ? sizeof(uint32_t) : 0);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t hton64(uint64_t v) {
+    if (htonl(1) == 1) {
+        return v;   // big-endian host
+    }
+    return ((uint64_t)htonl((uint32_t)v) << 32) | htonl((uint32_t)(v >> 32));
+}
+
+static inline uint64_t ntoh64(uint64_t v) {
+    return hton64(v);
+}
+
+// Parse a whole decimal option argument in lo..hi (lo >= 0); returns -1
+// if it is anything else: empty, trailing junk, out of range
+static inline long long parse_count(const char *s, long long lo, long long hi) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno == ERANGE || v < lo || v > hi) {
+        return -1;
+    }
+    return v;
+}
+
+// Parse a -b argument; returns -1 if it is not a valid batch size
+static inline int parse_batch_size(const char *s) {
+    return (int)parse_count(s, 0, MAX_BATCH);
+}
+
+// send() the whole buffer, retrying on short writes and EINTR
+static inline int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t n = send(fd, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// recv() exactly len bytes; returns len, 0 on clean EOF, -1 on error,
+// or the short count if the peer closed mid-message
+static inline ssize_t recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    size_t got = 0;
+    while (got < len) {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t n = recv(fd, p + got, len - got, MSG_WAITALL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,165 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "value.h"
+
+/*
+ * Bounded lock-free ring of values (value_t) with one writer and any
+ * number of readers (SPMC).
+ *
+ * The writer publishes values by advancing `tail`; readers claim whole
+ * ranges [head, head + n) with a single CAS on `head`, so draining a
+ * batch costs one atomic operation rather than one per value. Every slot
+ * carries a lap counter: a reader hands a slot back by setting it to
+ * pos + capacity once it has copied the value out, and the writer waits
+ * for that before reusing the slot.
+ *
+ * The writer calls ring_close() when it is done; readers get 0 from
+ * ring_pop() once the ring is closed and empty. Readers call
+ * ring_cancel() on fatal errors so a blocked writer gives up.
+ */
+
+#define RING_CACHELINE 64
+#define RING_SPINS 64   // paused polls before every further one yields
+
+struct ring {
+    size_t capacity;        // power of two
+    size_t mask;
+    value_t *values;
+    atomic_size_t *laps;
+
+    _Alignas(RING_CACHELINE) atomic_size_t tail;   // next slot to publish
+    _Alignas(RING_CACHELINE) atomic_size_t head;   // next slot to claim
+    _Alignas(RING_CACHELINE) atomic_int closed;    // writer finished
+    atomic_int cancelled;                          // readers gave up
+};
+
+// Wait a little before polling again: a CPU pause hint for the first
+// RING_SPINS polls, then sched_yield() on each, so a long wait (an empty
+// ring while the reader thread parses) gives the CPU away like log.c does
+static inline void ring_backoff(unsigned *spins) {
+    if (*spins < RING_SPINS) {
+        ++*spins;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+        return;
+    }
+    sched_yield();
+}
+
+// Round capacity up to a power of two; returns 0 on success, -1 on ENOMEM
+static inline int ring_init(struct ring *r, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    r->capacity = cap;
+    r->mask = cap - 1;
+    r->values = malloc(cap * sizeof(*r->values));
+    r->laps = malloc(cap * sizeof(*r->laps));
+    if (!r->values || !r->laps) {
+        free(r->values);
+        free(r->laps);
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&r->laps[i], i);
+    }
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->closed, 0);
+    atomic_init(&r->cancelled, 0);
+    return 0;
+}
+
+static inline void ring_destroy(struct ring *r) {
+    free(r->values);
+    free(r->laps);
+}
+
+// Writer only: append n values, waiting for free slots.
+// Returns 0 on success, -1 if the readers cancelled the ring.
+static inline int ring_push(struct ring *r, const value_t *vals, size_t n) {
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    for (size_t i = 0; i < n; i++, pos++) {
+        atomic_size_t *lap = &r->laps[pos & r->mask];
+        unsigned spins = 0;
+        while (atomic_load_explicit(lap, memory_order_acquire) != pos) {
+            if (atomic_load_explicit(&r->cancelled, memory_order_relaxed)) {
+                return -1;
+            }
+            // Publish what we have so readers can free slots for us
+            atomic_store_explicit(&r->tail, pos, memory_order_release);
+            ring_backoff(&spins);
+        }
+        r->values[pos & r->mask] = vals[i];
+    }
+    atomic_store_explicit(&r->tail, pos, memory_order_release);
+    return 0;
+}
+
+// Writer only: no more values will be pushed
+static inline void ring_close(struct ring *r) {
+    atomic_store_explicit(&r->closed, 1, memory_order_release);
+}
+
+// Reader: make a blocked writer's ring_push() fail
+static inline void ring_cancel(struct ring *r) {
+    atomic_store_explicit(&r->cancelled, 1, memory_order_relaxed);
+}
+
+// Reader: claim and copy out up to max values, waiting while the ring is
+// empty. Returns the number copied, or 0 once closed and drained. *first
+// gets the position of out[0] in push order (0 for the first value ever).
+static inline size_t ring_pop(struct ring *r, value_t *out, size_t max, size_t *first) {
+    unsigned spins = 0;
+    size_t head;
+    size_t n;
+
+    while (1) {
+        // tail, then head: a head older than that is only a range the CAS
+        // turns down, and one newer than our tail shows up as n > capacity
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        head = atomic_load_explicit(&r->head, memory_order_acquire);
+        n = tail - head;
+        if (n == 0) {
+            if (atomic_load_explicit(&r->closed, memory_order_acquire) &&
+                atomic_load_explicit(&r->tail, memory_order_acquire) == head) {
+                return 0;
+            }
+            ring_backoff(&spins);
+            continue;
+        }
+        // Other readers claimed past our tail between the two loads
+        if (n > r->capacity) {
+            continue;
+        }
+        if (n > max) {
+            n = max;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->head, &head, head + n,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            break;
+        }
+    }
+
+    *first = head;
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = head + i;
+        out[i] = r->values[pos & r->mask];
+        atomic_store_explicit(&r->laps[pos & r->mask], pos + r->capacity,
+                              memory_order_release);
+    }
+    return n;
+}
+
+#endif // RING_H
@@ -0,0 +1,217 @@
+#!/bin/bash
+
+# Scale test: for every input format and value distribution, generates
+# inputs of growing size with ./gen, sends each through ./producer (which
+# starts ./consumer) and checks that the values stored are exactly the
+# values sent: the consumer's stats stage prints the count, sum, min, max
+# and multiset digest (digest.h) of what it received, and they must equal
+# what gen reported for the file. Prints one row per run, with its
+# throughput, as CSV or JSON.
+#
+# A run whose elements/s falls below 1/FACTOR of the previous size's (same
+# format and distribution) is flagged as a cliff. Binary runs whose extra
+# options the producer refuses with --binary are reported as skipped. The
+# exit status is 1 if any run failed or stored the wrong values; cliffs
+# and skipped runs only warn.
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -n SIZES       input sizes in elements, e.g. "1e6 1e8 1e10" (default "1e4 1e5 1e6 1e7")
+  -D DISTS       value distributions: random sorted skewed (default all three)
+  -m FORMATS     input formats: text binary (default "text binary")
+  -a ARGS        extra producer options, e.g. "-c -t 4 -b 1024 -T unix"; a
+                 --stage list given here must include stats
+  -x FACTOR      flag a cliff when elements/s drops by more than FACTOR (default 2)
+  -s SEED        generator seed (default 42)
+  -f FORMAT      csv or json (default csv)
+  -o FILE        write results to FILE instead of stdout
+  -d DIR         where generated inputs go (default scale_data)
+  -k             keep generated inputs (default: remove each after its run)
+EOF
+    exit 1
+}
+
+SIZES="1e4 1e5 1e6 1e7"
+DISTS="random sorted skewed"
+FORMATS="text binary"
+ARGS=""
+FACTOR=2
+SEED=42
+FORMAT=csv
+OUT=""
+DATA_DIR=scale_data
+KEEP=0
+
+while getopts "n:D:m:a:x:s:f:o:d:kh" opt; do
+    case $opt in
+    n) SIZES=$OPTARG ;;
+    D) DISTS=$OPTARG ;;
+    m) FORMATS=$OPTARG ;;
+    a) ARGS=$OPTARG ;;
+    x) FACTOR=$OPTARG ;;
+    s) SEED=$OPTARG ;;
+    f) FORMAT=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    d) DATA_DIR=$OPTARG ;;
+    k) KEEP=1 ;;
+    *) usage ;;
+    esac
+done
+if [ "$FORMAT" != csv ] && [ "$FORMAT" != json ]; then
+    usage
+fi
+if [ ! -x ./producer ] || [ ! -x ./consumer ] || [ ! -x ./gen ]; then
+    echo "Error: build producer, consumer and gen first (make)" >&2
+    exit 1
+fi
+
+BUILD=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+now() {
+    perl -MTime::HiRes=time -e 'printf "%.6f\n", time'
+}
+
+# Generates the input once and keeps gen's summary of it next to it
+input_file() {
+    local n=$1 format=$2 dist=$3
+    local path="$DATA_DIR/scale-$dist-$n.$([ "$format" = binary ] && echo bin || echo txt)"
+    if [ ! -s "$path" ] || [ ! -s "$path.sum" ]; then
+        mkdir -p "$DATA_DIR"
+        echo "Generating $path" >&2
+        ./gen -n "$n" --dist "$dist" --seed "$SEED" $([ "$format" = binary ] && echo -B) \
+              -o "$path.tmp" 2> "$path.sum.tmp" &&
+            mv "$path.tmp" "$path" && mv "$path.sum.tmp" "$path.sum" || return 1
+    fi
+    echo "$path"
+}
+
+ROWS=0
+emit() {
+    if [ "$FORMAT" = csv ]; then
+        if [ $ROWS -eq 0 ]; then
+            echo "build,format,dist,args,elements,bytes,seconds,elements_per_sec,mb_per_sec,cliff,status"
+        fi
+        local row=("$@")
+        row[3]="\"$4\""     # producer options may hold commas
+        local IFS=,
+        echo "${row[*]}"
+    else
+        [ $ROWS -eq 0 ] && echo "[" || echo ","
+        printf '  {"build": "%s", "format": "%s", "dist": "%s", "args": "%s", ' "$1" "$2" "$3" "$4"
+        printf '"elements": %s, "bytes": %s, "seconds": %s, ' "$5" "$6" "$7"
+        printf '"elements_per_sec": %s, "mb_per_sec": %s, "cliff": %s, "status": "%s"}' \
+            "$8" "$9" "${10}" "${11}"
+    fi
+    ROWS=$((ROWS + 1))
+}
+
+# "N values, sum S, min A, max B, digest D" of every consumer (one per
+# shard) added up; digests and sums wrap at 64 bits on both sides
+received() {
+    local count=0 sum=0 min="" max="" digest=0
+    local c s lo hi d
+    while read -r c s lo hi d; do
+        count=$((count + c))
+        sum=$((sum + s))
+        digest=$((digest + 16#$d))
+        if [ -z "$min" ] || [ "$lo" -lt "$min" ]; then min=$lo; fi
+        if [ -z "$max" ] || [ "$hi" -gt "$max" ]; then max=$hi; fi
+    done < <(sed -n 's/.*stage stats: \([0-9]*\) values, sum \(-*[0-9]*\), min \(-*[0-9]*\), max \(-*[0-9]*\), .*digest \([0-9a-f]*\)$/\1 \2 \3 \4 \5/p')
+    printf '%s values, sum %s, min %s, max %s, digest %016x\n' "$count" "$sum" "$min" "$max" "$digest"
+}
+
+# Why the producer would refuse --binary with the -a options, if it would:
+# it needs frames and sends from the mapped file, not through the ring
+binary_conflict() {
+    local prev="" a
+    for a in $ARGS; do
+        case "$prev $a" in
+        *" -b0" | "-b 0")
+            echo "--binary needs framed mode (-b 1 or more)"; return 0 ;;
+        *" -s" | *" -m" | *" --mmap")
+            echo "$a and --binary are mutually exclusive"; return 0 ;;
+        *" --consumers" | *" --consumers="* | "--shards "[!1]* | "--shards "1?* | \
+        *" --shards="[!1]* | *" --shards=1"?*)
+            echo "shards need the pipeline mode, not --binary"; return 0 ;;
+        esac
+        prev=$a
+    done
+    return 1
+}
+
+FAILED=0
+PREV_RATE=0
+
+run_one() {
+    local format=$1 dist=$2 n=$3
+    local flags="" file reason
+    [ "$format" = binary ] && flags="--binary"
+    if [ "$format" = binary ] && reason=$(binary_conflict); then
+        echo "Skipping $dist binary input of $n values: $reason" >&2
+        emit "$BUILD" "$format" "$dist" "$ARGS" "$n" 0 0 0 0 false skipped
+        return
+    fi
+    if ! file=$(input_file "$n" "$format" "$dist"); then
+        echo "Generating $dist $format input of $n values failed" >&2
+        emit "$BUILD" "$format" "$dist" "$ARGS" "$n" 0 0 0 0 false fail
+        FAILED=1
+        return
+    fi
+    local bytes
+    bytes=$(wc -c < "$file" | tr -d ' ')
+
+    local start end out
+    start=$(now)
+    out=$(./producer --spawn -n 0 --log summary --stage stats $flags $ARGS "$file" 2>&1)
+    local rc=$?
+    end=$(now)
+
+    local sent expected got status=ok
+    sent=$(awk '/^Producer PID .* read [0-9]+ data elements/ { print $(NF-2) }' <<<"$out")
+    expected=$(cat "$file.sum")
+    if [ "$n" -eq 0 ]; then
+        got="0 values"
+    else
+        got=$(received <<<"$out")
+    fi
+    if [ $rc -ne 0 ] || [ "$sent" != "$n" ]; then
+        status=fail
+    elif [ "$got" != "$expected" ]; then
+        status=mismatch
+        printf 'Mismatch on %s:\n  sent:     %s\n  received: %s\n' "$file" "$expected" "$got" >&2
+    fi
+    [ $status = ok ] || FAILED=1
+
+    local secs rate mbs
+    read -r secs rate mbs < <(awk -v s="$start" -v e="$end" -v n="$n" -v b="$bytes" \
+        'BEGIN { t = e - s; printf "%.6f %.0f %.3f\n", t, n / t, b / t / 1e6 }')
+    local cliff=false
+    if awk -v p="$PREV_RATE" -v r="$rate" -v f="$FACTOR" 'BEGIN { exit !(p > 0 && r * f < p) }'; then
+        cliff=true
+        echo "Cliff: $dist $format at $n elements, $rate elements/s after $PREV_RATE" >&2
+    fi
+    PREV_RATE=$rate
+    emit "$BUILD" "$format" "$dist" "$ARGS" "$n" "$bytes" "$secs" "$rate" "$mbs" "$cliff" "$status"
+    if [ $KEEP -eq 0 ]; then
+        rm -f "$file" "$file.sum"
+    fi
+}
+
+if [ -n "$OUT" ]; then
+    exec > "$OUT"
+fi
+for format in $FORMATS; do
+    for dist in $DISTS; do
+        PREV_RATE=0
+        for n in $SIZES; do
+            n=$(awk -v n="$n" 'BEGIN { printf "%.0f\n", n }')
+            run_one "$format" "$dist" "$n"
+        done
+    done
+done
+if [ "$FORMAT" = json ]; then
+    [ $ROWS -eq 0 ] && echo "[" || echo
+    echo "]"
+fi
+exit $FAILED
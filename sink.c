@@ -0,0 +1,367 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sink.h"
+#include "log.h"
+#include "lockprof.h"
+#include "stats.h"
+
+#define CHUNK_BYTES ((size_t)ARENA_CHUNK_VALUES * sizeof(value_t))
+
+// Write all of len bytes at off; returns 0 or an errno
+static int pwrite_all(struct sink *s, int fd, const void *buf, size_t len, off_t off) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+#ifdef O_DIRECT
+            // Some file systems take the O_DIRECT open but not the writes
+            if (errno == EINVAL && fd == s->fd && s->direct) {
+                int flags = fcntl(fd, F_GETFL);
+                if (flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+                    s->direct = 0;
+                    continue;
+                }
+            }
+#endif
+            return errno;
+        }
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// One write per run of slots that are adjacent in the file
+static int write_buffer(struct sink *s, const struct sink_buffer *b) {
+    int i = 0;
+    while (i < b->used) {
+        int run = 1;
+        while (i + run < b->used &&
+               b->offsets[i + run] == b->offsets[i] + (off_t)(run * CHUNK_BYTES)) {
+            run++;
+        }
+        int err = pwrite_all(s, s->fd, b->data + (size_t)i * CHUNK_BYTES, run * CHUNK_BYTES,
+                             b->offsets[i]);
+        if (err != 0) {
+            return err;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+// Acks: note the chunks b put on disk and move the durable mark past
+// every chunk from the start that is there; b has been synced
+static void mark_durable(struct sink *s, const struct sink_buffer *b) {
+    for (int i = 0; i < b->used; i++) {
+        uint64_t pos = (uint64_t)(b->offsets[i] - SINK_DATA_OFFSET) / sizeof(value_t);
+        s->written[(pos - s->start) / ARENA_CHUNK_VALUES] = 1;
+    }
+    while (s->durable_next < ARENA_MAX_CHUNKS && s->written[s->durable_next]) {
+        s->durable_next++;
+    }
+    atomic_store_explicit(&s->durable, (uint64_t)s->durable_next * ARENA_CHUNK_VALUES,
+                          memory_order_release);
+}
+
+static void *sink_thread_func(void *arg) {
+    struct sink *s = arg;
+    STATS_REGISTER("sink");
+    LOCKPROF_THREAD("sink");
+    LOCK(&s->mutex, "sink_mutex");
+    while (1) {
+        struct sink_buffer *b = s->bufs[0].full ? &s->bufs[0] : s->bufs[1].full ? &s->bufs[1] : NULL;
+        if (!b) {
+            if (s->stopping) {
+                break;
+            }
+            COND_WAIT(&s->work, &s->mutex);
+            continue;
+        }
+        UNLOCK(&s->mutex);
+        int err = s->error ? 0 : write_buffer(s, b);
+        if (err == 0 && s->written && s->error == 0) {
+            err = fdatasync(s->fd) < 0 ? errno : 0;
+            if (err == 0) {
+                mark_durable(s, b);
+            }
+        }
+        LOCK(&s->mutex, "sink_mutex");
+        if (err != 0 && s->error == 0) {
+            s->error = err;
+        }
+        b->used = 0;
+        b->full = 0;
+        // Writers waiting on a used-up buffer continue in this one
+        if (s->bufs[s->filling].used == SINK_SLOTS) {
+            s->filling = (int)(b - s->bufs);
+        }
+        pthread_cond_broadcast(&s->room);
+    }
+    UNLOCK(&s->mutex);
+    return NULL;
+}
+
+// Resuming: the file must hold everything before start; its header is
+// cleared until this session is complete
+static int sink_continue(struct sink *s) {
+    struct stat st;
+    static const struct sink_header none;
+    if (fstat(s->tail_fd, &st) < 0) {
+        return -1;
+    }
+    if ((uint64_t)st.st_size < SINK_DATA_OFFSET + s->start * sizeof(value_t)) {
+        fprintf(stderr, "%s holds fewer values than the resume point %llu\n", s->path,
+                (unsigned long long)s->start);
+        errno = EINVAL;
+        return -1;
+    }
+    if (pwrite_all(s, s->tail_fd, &none, sizeof(none), 0) != 0 ||
+        ftruncate(s->tail_fd, SINK_DATA_OFFSET + (off_t)(s->start * sizeof(value_t))) < 0 ||
+        fdatasync(s->tail_fd) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int sink_open(struct sink *s, const char *path, int ordered, uint64_t start, int acks) {
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->ordered = ordered;
+    s->start = start;
+    atomic_init(&s->durable, 0);
+    s->path = strdup(path);
+    // calloc'd like the arena directory: only touched pages are backed
+    s->written = acks ? calloc(ARENA_MAX_CHUNKS, 1) : NULL;
+    if (!s->path || (acks && !s->written)) {
+        free(s->path);
+        free(s->written);
+        errno = ENOMEM;
+        return -1;
+    }
+    s->tail_fd = open(path, O_WRONLY | O_CREAT | (start > 0 ? 0 : O_TRUNC), 0644);
+    if (s->tail_fd < 0 || (start > 0 && sink_continue(s) < 0)) {
+        int err = errno;
+        if (s->tail_fd >= 0) {
+            close(s->tail_fd);
+        }
+        free(s->path);
+        free(s->written);
+        errno = err;
+        return -1;
+    }
+#ifdef O_DIRECT
+    s->fd = open(path, O_WRONLY | O_DIRECT);
+    s->direct = s->fd >= 0;
+#endif
+    if (s->fd < 0) {
+        s->fd = open(path, O_WRONLY);
+#ifdef F_NOCACHE
+        s->direct = s->fd >= 0 && fcntl(s->fd, F_NOCACHE, 1) == 0;
+#endif
+    }
+    for (int i = 0; i < 2; i++) {
+        s->bufs[i].data = aligned_alloc(SINK_ALIGN, SINK_SLOTS * CHUNK_BYTES);
+    }
+    if (s->fd < 0 || !s->bufs[0].data || !s->bufs[1].data) {
+        int err = s->fd < 0 ? errno : ENOMEM;
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        close(s->tail_fd);
+        free(s->bufs[0].data);
+        free(s->bufs[1].data);
+        free(s->path);
+        free(s->written);
+        errno = err;
+        return -1;
+    }
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->room, NULL);
+    pthread_cond_init(&s->work, NULL);
+    if (pthread_create(&s->thread, NULL, sink_thread_func, s) != 0) {
+        close(s->fd);
+        close(s->tail_fd);
+        free(s->bufs[0].data);
+        free(s->bufs[1].data);
+        free(s->path);
+        free(s->written);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void sink_chunk(void *sink, size_t slot, const value_t *values, uint32_t count) {
+    struct sink *s = sink;
+    LOCK(&s->mutex, "sink_mutex");
+    // Only when the I/O thread is a whole buffer behind
+    while (s->error == 0 && s->bufs[s->filling].used == SINK_SLOTS) {
+        COND_WAIT(&s->room, &s->mutex);
+    }
+    if (s->error != 0) {
+        UNLOCK(&s->mutex);
+        return;
+    }
+    struct sink_buffer *b = &s->bufs[s->filling];
+    int i = b->used++;
+    uint64_t pos = s->start + (s->ordered ? slot : s->appended++) * ARENA_CHUNK_VALUES;
+    b->offsets[i] = SINK_DATA_OFFSET + (off_t)(pos * sizeof(value_t));
+    b->copying++;
+    if (b->used == SINK_SLOTS && s->bufs[1 - s->filling].used == 0) {
+        s->filling = 1 - s->filling;
+    }
+    UNLOCK(&s->mutex);
+
+    // Copies into one buffer run side by side
+    memcpy(b->data + (size_t)i * CHUNK_BYTES, values, count * sizeof(value_t));
+
+    LOCK(&s->mutex, "sink_mutex");
+    if (--b->copying == 0 && b->used == SINK_SLOTS) {
+        b->full = 1;
+        pthread_cond_signal(&s->work);
+    }
+    UNLOCK(&s->mutex);
+}
+
+int sink_finish(struct sink *s, const struct arena *a) {
+    // Hand over the last, partly used buffer and let the I/O thread drain
+    LOCK(&s->mutex, "sink_mutex");
+    struct sink_buffer *last = &s->bufs[s->filling];
+    if (last->used > 0 && !last->full) {
+        last->full = 1;
+    }
+    s->stopping = 1;
+    pthread_cond_signal(&s->work);
+    UNLOCK(&s->mutex);
+    pthread_join(s->thread, NULL);
+
+    // Partly filled chunks, packed after the full ones unless ordered
+    int err = s->error;
+    uint64_t tail = 0;
+    struct arena_iter it;
+    const value_t *values;
+    size_t n;
+    arena_iter_init(&it, a);
+    while (err == 0 && (n = arena_iter_next(&it, &values)) > 0) {
+        if (n == ARENA_CHUNK_VALUES) {
+            continue;
+        }
+        uint64_t pos = s->start + (s->ordered ? arena_iter_slot(&it) * ARENA_CHUNK_VALUES
+                                              : s->appended * ARENA_CHUNK_VALUES + tail);
+        err = pwrite_all(s, s->tail_fd, values, n * sizeof(value_t),
+                         SINK_DATA_OFFSET + (off_t)(pos * sizeof(value_t)));
+        tail += n;
+    }
+    uint64_t count = s->start + (s->ordered ? arena_end(a) : s->appended * ARENA_CHUNK_VALUES + tail);
+
+    // Data first, then the header that makes the file valid
+    struct sink_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = SINK_MAGIC;
+    h.version = SINK_VERSION;
+    h.byte_order = SINK_BYTE_ORDER;
+    h.value_size = sizeof(value_t);
+    h.flags = s->ordered ? SINK_ORDERED : 0;
+    h.count = count;
+    if (err == 0 && (ftruncate(s->tail_fd, SINK_DATA_OFFSET + (off_t)(count * sizeof(value_t))) < 0 ||
+                     fdatasync(s->tail_fd) < 0)) {
+        err = errno;
+    }
+    if (err == 0) {
+        err = pwrite_all(s, s->tail_fd, &h, sizeof(h), 0);
+    }
+    if (err == 0 && fdatasync(s->tail_fd) < 0) {
+        err = errno;
+    }
+    close(s->fd);
+    if (close(s->tail_fd) < 0 && err == 0) {
+        err = errno;
+    }
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->room);
+    pthread_cond_destroy(&s->work);
+    free(s->bufs[0].data);
+    free(s->bufs[1].data);
+    free(s->written);
+    int rc = 0;
+    if (err != 0) {
+        fprintf(stderr, "persist %s: %s\n", s->path, strerror(err));
+        rc = -1;
+    } else {
+        log_summary("Consumer PID %d persisted %llu values to %s%s\n", getpid(),
+                    (unsigned long long)count, s->path, s->direct ? " (direct I/O)" : "");
+    }
+    free(s->path);
+    return rc;
+}
+
+int sink_map(struct sink_view *v, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < SINK_DATA_OFFSET) {
+        fprintf(stderr, "%s: not a --persist file\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    const struct sink_header *h = map;
+    const char *why = NULL;
+    if (h->magic != SINK_MAGIC) {
+        why = "not a --persist file, or its run did not finish";
+    } else if (h->version != SINK_VERSION) {
+        why = "unsupported version";
+    } else if (h->value_size != sizeof(value_t)) {
+        why = "values of another width (see make WIDTH=)";
+    } else if (h->byte_order != SINK_BYTE_ORDER) {
+        why = "written on a host of the other byte order";
+    } else if (h->count > ((uint64_t)st.st_size - SINK_DATA_OFFSET) / sizeof(value_t)) {
+        why = "truncated";
+    }
+    if (why) {
+        fprintf(stderr, "%s: %s\n", path, why);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    v->map = map;
+    v->map_len = (size_t)st.st_size;
+    v->values = (const value_t *)((const char *)map + SINK_DATA_OFFSET);
+    v->count = h->count;
+    v->ordered = (h->flags & SINK_ORDERED) != 0;
+    return 0;
+}
+
+void sink_unmap(struct sink_view *v) {
+    munmap(v->map, v->map_len);
+    v->map = NULL;
+}
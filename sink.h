@@ -0,0 +1,127 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "arena.h"
+
+/*
+ * Persistence for the consumer's storage (--persist PATH).
+ *
+ * Every arena chunk is streamed to the file the moment it fills: the
+ * inserting thread copies it into one of two page-aligned buffers, and a
+ * background I/O thread writes whichever buffer is full in large
+ * O_DIRECT writes (F_NOCACHE on macOS; plain writes where the file
+ * system refuses both) while the threads fill the other. Only when the
+ * disk falls a whole buffer behind does a copy wait. The few partly
+ * filled chunks and the header go through the page cache at the end.
+ *
+ * File layout, so a later run maps it and reads the values in place:
+ *
+ *   0                  struct sink_header, zero-padded to SINK_DATA_OFFSET
+ *   SINK_DATA_OFFSET   count host-order value_t values (header.value_size
+ *                      bytes each: 2, 4 or 8 with make WIDTH=)
+ *
+ * In ordered mode chunk k lands at
+ *
+ *   SINK_DATA_OFFSET + k * ARENA_CHUNK_VALUES * sizeof(value_t)
+ *
+ * (chunks of 32, 64 or 128 KB at WIDTH=16, 32, 64), so the values are in
+ * input order; otherwise chunks are appended as they fill. The header is written last, after everything else is on disk,
+ * so an interrupted run leaves a file sink_map() refuses.
+ *
+ * Checkpointing (ordered only): with durable acks the I/O thread syncs
+ * every buffer it writes and then advances sink_durable(), the count of
+ * chunks from the session start that are on disk with no gap. A resumed
+ * session opens the file of the run it continues without truncating it
+ * and places its values from start on.
+ */
+
+#define SINK_MAGIC 0x43534556u          // "CSEV"
+#define SINK_VERSION 1
+#define SINK_BYTE_ORDER 0x01020304u     // as stored by the writing host
+#define SINK_ALIGN 4096                 // O_DIRECT buffer, offset and length unit
+#define SINK_DATA_OFFSET SINK_ALIGN
+#define SINK_SLOTS 64                   // chunks per buffer: 4 MB writes at WIDTH=32
+
+#define SINK_ORDERED 0x1                // sink_header.flags
+
+struct sink_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t value_size;                // bytes per value
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t count;                     // values at SINK_DATA_OFFSET
+};
+
+struct sink_buffer {
+    unsigned char *data;                // SINK_SLOTS chunks, SINK_ALIGN-aligned
+    off_t offsets[SINK_SLOTS];          // file offset of every slot
+    int used;                           // slots handed out
+    int copying;                        // of those, copies still running
+    int full;                           // waiting for or being written by the I/O thread
+};
+
+struct sink {
+    int fd;                             // O_DIRECT where supported
+    int tail_fd;                        // page-cache writes: tails and header
+    int direct;
+    int ordered;
+    uint64_t start;                     // position of the session's first value
+    char *path;
+    unsigned char *written;             // acks: session chunks on disk, by index
+    size_t durable_next;                // acks: first chunk not yet known durable
+    _Atomic uint64_t durable;           // acks: values of the session synced, no gap
+    pthread_mutex_t mutex;
+    pthread_cond_t room;                // writers: a slot is free
+    pthread_cond_t work;                // I/O thread: a buffer is full
+    struct sink_buffer bufs[2];
+    int filling;                        // buffer writers copy into
+    uint64_t appended;                  // unordered: chunks placed so far
+    int stopping;
+    int error;                          // first errno, 0 if none
+    pthread_t thread;
+};
+
+/*
+ * Create path (or with start > 0, continue it: values before start stay)
+ * and start the I/O thread. acks turns on durable progress tracking;
+ * start and acks need ordered. Returns 0, or -1 with errno set.
+ */
+int sink_open(struct sink *s, const char *path, int ordered, uint64_t start, int acks);
+
+// Values of this session on disk from its start with no gap; 0 without acks
+static inline uint64_t sink_durable(struct sink *s) {
+    return atomic_load_explicit(&s->durable, memory_order_acquire);
+}
+
+// Queue one full chunk (arena_on_full() signature); slot is its arena index
+void sink_chunk(void *sink, size_t slot, const value_t *values, uint32_t count);
+
+/*
+ * Once every value is stored: write what is queued, the partly filled
+ * chunks of a and the header, close the file and print the summary.
+ * Returns 0, or -1 after printing why.
+ */
+int sink_finish(struct sink *s, const struct arena *a);
+
+// A file written by a sink, mapped read-only
+struct sink_view {
+    const value_t *values;
+    uint64_t count;
+    int ordered;
+    void *map;
+    size_t map_len;
+};
+
+// Map path and check its header; returns 0, or -1 after printing why
+int sink_map(struct sink_view *v, const char *path);
+void sink_unmap(struct sink_view *v);
+
+#endif // SINK_H
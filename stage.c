@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stage.h"
+#include "log.h"
+#include "digest.h"
+
+struct stage_op {
+    const char *name;
+    int has_arg;        // name:ARG
+    void *(*open)(const char *arg, int threads, int ordered);
+    // One chunk of values; index is its arena slot, worker the pool thread
+    void (*chunk)(void *state, int worker, size_t index, const value_t *values,
+                  uint32_t count);
+    // Every chunk has been seen: complete and print; 0 or -1
+    int (*finish)(void *state, struct pool *pool);
+    void (*close)(void *state);
+};
+
+static double ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * stats: running count/sum/min/max, the multiset digest (digest.h) and a
+ * sign and bit-length histogram
+ */
+
+// 0 .. VALUE_BITS - 1 negative, VALUE_BITS zero, the rest positive
+#define STATS_BUCKETS (2 * VALUE_BITS)
+
+struct stats_part {
+    _Alignas(64) uint64_t count;    // one cache line (or more) per pool thread
+    uint64_t sum;                   // of the signed values, wrapping at 64 bits
+    svalue_t min;
+    svalue_t max;
+    uint64_t digest;
+    uint64_t buckets[STATS_BUCKETS];
+};
+
+struct stats_state {
+    int threads;
+    struct stats_part *parts;
+};
+
+static int bit_length(value_t v) {
+    return 64 - __builtin_clzll((unsigned long long)v);
+}
+
+static int stats_bucket(svalue_t v) {
+    if (v == 0) {
+        return VALUE_BITS;
+    }
+    return v > 0 ? VALUE_BITS + bit_length((value_t)v)
+                 : VALUE_BITS - bit_length((value_t)(0 - (value_t)v));
+}
+
+static void *stats_open(const char *arg, int threads, int ordered) {
+    (void)arg;
+    (void)ordered;
+    struct stats_state *s = malloc(sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->threads = threads;
+    s->parts = aligned_alloc(64, (size_t)threads * sizeof(*s->parts));
+    if (!s->parts) {
+        free(s);
+        return NULL;
+    }
+    memset(s->parts, 0, (size_t)threads * sizeof(*s->parts));
+    for (int i = 0; i < threads; i++) {
+        s->parts[i].min = SVALUE_MAX;
+        s->parts[i].max = SVALUE_MIN;
+    }
+    return s;
+}
+
+static void stats_chunk(void *state, int worker, size_t index, const value_t *values,
+                        uint32_t count) {
+    (void)index;
+    struct stats_part *p = &((struct stats_state *)state)->parts[worker];
+    uint64_t sum = 0;
+    uint64_t digest = 0;
+    svalue_t min = p->min, max = p->max;
+    for (uint32_t i = 0; i < count; i++) {
+        svalue_t v = (svalue_t)values[i];
+        sum += (uint64_t)(int64_t)v;
+        digest += digest_mix(values[i]);
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        p->buckets[stats_bucket(v)]++;
+    }
+    p->count += count;
+    p->sum += sum;
+    p->digest += digest;
+    p->min = min;
+    p->max = max;
+}
+
+static int stats_finish(void *state, struct pool *pool) {
+    (void)pool;
+    struct stats_state *s = state;
+    struct stats_part total = s->parts[0];
+    for (int i = 1; i < s->threads; i++) {
+        const struct stats_part *p = &s->parts[i];
+        total.count += p->count;
+        total.sum += p->sum;
+        total.digest += p->digest;
+        total.min = p->min < total.min ? p->min : total.min;
+        total.max = p->max > total.max ? p->max : total.max;
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            total.buckets[b] += p->buckets[b];
+        }
+    }
+    if (total.count == 0) {
+        log_summary("Consumer PID %d stage stats: 0 values\n", getpid());
+        return 0;
+    }
+    log_summary("Consumer PID %d stage stats: %llu values, sum %lld, min %" PRIdVALUE
+                ", max %" PRIdVALUE ", mean %.3f, digest %016llx\n", getpid(),
+                (unsigned long long)total.count, (long long)total.sum, total.min, total.max,
+                (double)(int64_t)total.sum / (double)total.count,
+                (unsigned long long)total.digest);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        if (total.buckets[b] == 0) {
+            continue;
+        }
+        // Bucket b holds the values of bit length |b - VALUE_BITS| on its
+        // side of zero; magnitudes are unsigned so 64-bit ones fit
+        int len = b > VALUE_BITS ? b - VALUE_BITS : VALUE_BITS - b;
+        unsigned long long mlo = b == VALUE_BITS ? 0 : 1ULL << (len - 1);
+        unsigned long long mhi = b == VALUE_BITS ? 0 : len == 64 ? ~0ULL : (1ULL << len) - 1;
+        long long lo = (long long)mlo;
+        long long hi = (long long)mhi;
+        if (b < VALUE_BITS) {
+            lo = mhi > (unsigned long long)SVALUE_MAX ? SVALUE_MIN : (long long)(0 - mhi);
+            hi = (long long)(0 - mlo);
+        }
+        log_summary("Consumer PID %d stage stats: [%lld, %lld] %llu\n", getpid(), lo, hi,
+                    (unsigned long long)total.buckets[b]);
+    }
+    return 0;
+}
+
+static void stats_close(void *state) {
+    struct stats_state *s = state;
+    free(s->parts);
+    free(s);
+}
+
+/*
+ * sort: parallel LSD radix sort, 8 bits per pass
+ */
+
+#define SORT_PASSES VALUE_BYTES
+#define SORT_RADIX 256
+#define SORT_BLOCK 65536    // values per task in passes after the first
+
+// One arena chunk, with its first-pass digit counts
+struct sort_run {
+    size_t index;
+    const value_t *values;
+    uint32_t count;
+    uint32_t hist[SORT_RADIX];
+};
+
+struct sort_runs {
+    _Alignas(64) struct sort_run *runs;     // per pool thread
+    size_t n;
+    size_t cap;
+};
+
+struct sort_state {
+    int threads;
+    struct sort_runs *parts;
+    atomic_int failed;
+
+    // Set up by sort_finish() for the pool_for() passes
+    struct sort_run **runs;
+    size_t nruns;
+    uint64_t n;
+    size_t *offsets;        // [task][digit] write position
+    const value_t *src;
+    value_t *dst;
+    int pass;
+    value_t *bufs[2];
+    const value_t *sorted;
+};
+
+// Digit pass of v; the top digit has its sign bit flipped so negative
+// values sort first
+static inline unsigned sort_digit(value_t v, int pass) {
+    unsigned d = (v >> (8 * pass)) & 0xff;
+    return pass == SORT_PASSES - 1 ? d ^ 0x80 : d;
+}
+
+static void *sort_open(const char *arg, int threads, int ordered) {
+    (void)arg;
+    (void)ordered;
+    struct sort_state *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->threads = threads;
+    s->parts = aligned_alloc(64, (size_t)threads * sizeof(*s->parts));
+    if (!s->parts) {
+        free(s);
+        return NULL;
+    }
+    memset(s->parts, 0, (size_t)threads * sizeof(*s->parts));
+    atomic_init(&s->failed, 0);
+    return s;
+}
+
+static void sort_chunk(void *state, int worker, size_t index, const value_t *values,
+                       uint32_t count) {
+    struct sort_state *s = state;
+    struct sort_runs *p = &s->parts[worker];
+    if (p->n == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 64;
+        struct sort_run *runs = realloc(p->runs, cap * sizeof(*runs));
+        if (!runs) {
+            atomic_store(&s->failed, 1);
+            return;
+        }
+        p->runs = runs;
+        p->cap = cap;
+    }
+    struct sort_run *r = &p->runs[p->n++];
+    r->index = index;
+    r->values = values;
+    r->count = count;
+    memset(r->hist, 0, sizeof(r->hist));
+    for (uint32_t i = 0; i < count; i++) {
+        r->hist[sort_digit(values[i], 0)]++;
+    }
+}
+
+static int run_cmp(const void *a, const void *b) {
+    size_t x = (*(struct sort_run *const *)a)->index;
+    size_t y = (*(struct sort_run *const *)b)->index;
+    return x < y ? -1 : x > y;
+}
+
+// First pass: scatter one arena chunk into the first buffer
+static void sort_scatter_run(void *ctx, size_t i, int worker) {
+    (void)worker;
+    struct sort_state *s = ctx;
+    const struct sort_run *r = s->runs[i];
+    size_t *off = &s->offsets[i * SORT_RADIX];
+    for (uint32_t k = 0; k < r->count; k++) {
+        value_t v = r->values[k];
+        s->dst[off[sort_digit(v, 0)]++] = v;
+    }
+}
+
+static void sort_block_range(const struct sort_state *s, size_t i, size_t *lo, size_t *hi) {
+    *lo = i * SORT_BLOCK;
+    *hi = *lo + SORT_BLOCK < s->n ? *lo + SORT_BLOCK : s->n;
+}
+
+static void sort_hist_block(void *ctx, size_t i, int worker) {
+    (void)worker;
+    struct sort_state *s = ctx;
+    size_t lo, hi;
+    sort_block_range(s, i, &lo, &hi);
+    size_t *count = &s->offsets[i * SORT_RADIX];
+    memset(count, 0, SORT_RADIX * sizeof(*count));
+    for (size_t k = lo; k < hi; k++) {
+        count[sort_digit(s->src[k], s->pass)]++;
+    }
+}
+
+static void sort_scatter_block(void *ctx, size_t i, int worker) {
+    (void)worker;
+    struct sort_state *s = ctx;
+    size_t lo, hi;
+    sort_block_range(s, i, &lo, &hi);
+    size_t *off = &s->offsets[i * SORT_RADIX];
+    for (size_t k = lo; k < hi; k++) {
+        value_t v = s->src[k];
+        s->dst[off[sort_digit(v, s->pass)]++] = v;
+    }
+}
+
+/*
+ * Turn per-task digit counts into write positions: digit by digit, and
+ * within a digit task by task, so every pass is stable. Returns 1 if
+ * one digit holds every value, in which case the pass would move
+ * nothing and can be skipped.
+ */
+static int sort_prefix(size_t *offsets, size_t tasks, uint64_t n) {
+    size_t pos = 0;
+    for (int d = 0; d < SORT_RADIX; d++) {
+        size_t start = pos;
+        for (size_t t = 0; t < tasks; t++) {
+            size_t c = offsets[t * SORT_RADIX + d];
+            offsets[t * SORT_RADIX + d] = pos;
+            pos += c;
+        }
+        if (pos - start == n) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int sort_finish(void *state, struct pool *pool) {
+    struct sort_state *s = state;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (atomic_load(&s->failed)) {
+        fprintf(stderr, "sort: out of memory for the chunk list\n");
+        return -1;
+    }
+
+    // The chunks in arena order, with their first-pass counts
+    s->nruns = 0;
+    for (int w = 0; w < s->threads; w++) {
+        s->nruns += s->parts[w].n;
+    }
+    s->runs = malloc((s->nruns ? s->nruns : 1) * sizeof(*s->runs));
+    if (!s->runs) {
+        perror("sort");
+        return -1;
+    }
+    size_t k = 0;
+    s->n = 0;
+    for (int w = 0; w < s->threads; w++) {
+        for (size_t i = 0; i < s->parts[w].n; i++) {
+            s->runs[k++] = &s->parts[w].runs[i];
+            s->n += s->parts[w].runs[i].count;
+        }
+    }
+    qsort(s->runs, s->nruns, sizeof(*s->runs), run_cmp);
+    if (s->n == 0) {
+        log_summary("Consumer PID %d stage sort: 0 values\n", getpid());
+        return 0;
+    }
+
+    size_t blocks = (size_t)((s->n + SORT_BLOCK - 1) / SORT_BLOCK);
+    size_t tasks = s->nruns > blocks ? s->nruns : blocks;
+    s->offsets = malloc(tasks * SORT_RADIX * sizeof(*s->offsets));
+    s->bufs[0] = malloc(s->n * sizeof(value_t));
+    s->bufs[1] = malloc(s->n * sizeof(value_t));
+    if (!s->offsets || !s->bufs[0] || !s->bufs[1]) {
+        perror("sort");
+        return -1;
+    }
+
+    // Pass 0 reads the arena: it also gathers the chunks into one array
+    for (size_t r = 0; r < s->nruns; r++) {
+        for (int d = 0; d < SORT_RADIX; d++) {
+            s->offsets[r * SORT_RADIX + d] = s->runs[r]->hist[d];
+        }
+    }
+    sort_prefix(s->offsets, s->nruns, s->n);
+    s->dst = s->bufs[0];
+    if (pool_for(pool, s->nruns, sort_scatter_run, s) < 0) {
+        perror("sort");
+        return -1;
+    }
+    int cur = 0;
+    for (s->pass = 1; s->pass < SORT_PASSES; s->pass++) {
+        s->src = s->bufs[cur];
+        s->dst = s->bufs[1 - cur];
+        if (pool_for(pool, blocks, sort_hist_block, s) < 0) {
+            perror("sort");
+            return -1;
+        }
+        if (sort_prefix(s->offsets, blocks, s->n)) {
+            continue;
+        }
+        if (pool_for(pool, blocks, sort_scatter_block, s) < 0) {
+            perror("sort");
+            return -1;
+        }
+        cur = 1 - cur;
+    }
+    s->sorted = s->bufs[cur];
+    log_summary("Consumer PID %d stage sort: %llu values in %.1f ms, min %" PRIdVALUE
+                " median %" PRIdVALUE " max %" PRIdVALUE "\n",
+                getpid(), (unsigned long long)s->n, ms_since(&start), (svalue_t)s->sorted[0],
+                (svalue_t)s->sorted[(s->n - 1) / 2], (svalue_t)s->sorted[s->n - 1]);
+    return 0;
+}
+
+static void sort_close(void *state) {
+    struct sort_state *s = state;
+    for (int w = 0; w < s->threads; w++) {
+        free(s->parts[w].runs);
+    }
+    free(s->parts);
+    free(s->runs);
+    free(s->offsets);
+    free(s->bufs[0]);
+    free(s->bufs[1]);
+    free(s);
+}
+
+/*
+ * write:PATH: the values in network order, one pwrite() per chunk
+ */
+
+struct write_state {
+    int fd;
+    int ordered;
+    char *path;
+    value_t *bufs;                  // ARENA_CHUNK_VALUES per pool thread
+    atomic_ullong offset;           // unordered: next append position
+    atomic_ullong values;
+    atomic_int error;               // first errno, 0 if none
+};
+
+static void *write_open(const char *arg, int threads, int ordered) {
+    struct write_state *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->ordered = ordered;
+    s->path = strdup(arg);
+    s->bufs = malloc((size_t)threads * ARENA_CHUNK_VALUES * sizeof(value_t));
+    s->fd = -1;
+    if (!s->path || !s->bufs) {
+        free(s->path);
+        free(s->bufs);
+        free(s);
+        return NULL;
+    }
+    s->fd = open(arg, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s->fd < 0) {
+        perror(arg);
+        free(s->path);
+        free(s->bufs);
+        free(s);
+        return NULL;
+    }
+    atomic_init(&s->offset, 0);
+    atomic_init(&s->values, 0);
+    atomic_init(&s->error, 0);
+    return s;
+}
+
+static void write_chunk(void *state, int worker, size_t index, const value_t *values,
+                        uint32_t count) {
+    struct write_state *s = state;
+    value_t *buf = &s->bufs[(size_t)worker * ARENA_CHUNK_VALUES];
+    for (uint32_t i = 0; i < count; i++) {
+        buf[i] = value_hton(values[i]);
+    }
+    size_t len = count * sizeof(value_t);
+    off_t off = s->ordered ? (off_t)(index * ARENA_CHUNK_VALUES * sizeof(value_t))
+                           : (off_t)atomic_fetch_add(&s->offset, len);
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(s->fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int expected = 0;
+            atomic_compare_exchange_strong(&s->error, &expected, errno);
+            return;
+        }
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    atomic_fetch_add(&s->values, count);
+}
+
+static int write_finish(void *state, struct pool *pool) {
+    (void)pool;
+    struct write_state *s = state;
+    int err = atomic_load(&s->error);
+    if (err == 0 && close(s->fd) < 0) {
+        err = errno;
+    }
+    s->fd = -1;
+    if (err != 0) {
+        fprintf(stderr, "write %s: %s\n", s->path, strerror(err));
+        return -1;
+    }
+    log_summary("Consumer PID %d stage write: %llu values to %s\n", getpid(),
+                (unsigned long long)atomic_load(&s->values), s->path);
+    return 0;
+}
+
+static void write_close(void *state) {
+    struct write_state *s = state;
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    free(s->path);
+    free(s->bufs);
+    free(s);
+}
+
+static const struct stage_op stage_ops[] = {
+    { "stats", 0, stats_open, stats_chunk, stats_finish, stats_close },
+    { "sort", 0, sort_open, sort_chunk, sort_finish, sort_close },
+    { "write", 1, write_open, write_chunk, write_finish, write_close },
+};
+
+/*
+ * Pipeline
+ */
+
+// Split item into operator and argument in place; prints why and
+// returns NULL if it names no operator or has the wrong argument
+static const struct stage_op *parse_item(char *item, const char **arg) {
+    char *colon = strchr(item, ':');
+    if (colon) {
+        *colon = '\0';
+    }
+    *arg = colon ? colon + 1 : NULL;
+    for (size_t i = 0; i < sizeof(stage_ops) / sizeof(stage_ops[0]); i++) {
+        const struct stage_op *op = &stage_ops[i];
+        if (strcmp(item, op->name) != 0) {
+            continue;
+        }
+        if (op->has_arg && (!*arg || !**arg)) {
+            fprintf(stderr, "Stage '%s' needs an argument (%s:ARG)\n", item, item);
+            return NULL;
+        } else if (!op->has_arg && *arg) {
+            fprintf(stderr, "Stage '%s' takes no argument\n", item);
+            return NULL;
+        }
+        return op;
+    }
+    fprintf(stderr, "Unknown stage '%s' (stats, sort, write:PATH)\n", item);
+    return NULL;
+}
+
+// Parse list; with pl, open every operator into it as well
+static int parse_list(const char *list, struct pipeline *pl, int threads, int ordered) {
+    char *copy = strdup(list);
+    if (!copy) {
+        perror("strdup");
+        return -1;
+    }
+    int count = 0, rc = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        const char *arg;
+        const struct stage_op *op = parse_item(item, &arg);
+        if (!op) {
+            rc = -1;
+            break;
+        }
+        if (count == STAGE_MAX) {
+            fprintf(stderr, "At most %d stages\n", STAGE_MAX);
+            rc = -1;
+            break;
+        }
+        if (pl) {
+            void *state = op->open(arg, threads, ordered);
+            if (!state) {
+                fprintf(stderr, "Stage '%s' could not be set up\n", op->name);
+                rc = -1;
+                break;
+            }
+            pl->ops[count] = op;
+            pl->states[count] = state;
+            pl->count = count + 1;
+        }
+        count++;
+    }
+    if (rc == 0 && count == 0) {
+        fprintf(stderr, "Empty stage list\n");
+        rc = -1;
+    }
+    free(copy);
+    return rc;
+}
+
+int pipeline_check(const char *list) {
+    return parse_list(list, NULL, 0, 0);
+}
+
+struct chunk_task {
+    struct pool_task task;
+    struct pipeline *pl;
+    size_t index;
+    const value_t *values;
+    uint32_t count;
+};
+
+static void chunk_run(struct pool_task *t, int worker) {
+    struct chunk_task *c = (struct chunk_task *)t;
+    struct pipeline *pl = c->pl;
+    for (int i = 0; i < pl->count; i++) {
+        pl->ops[i]->chunk(pl->states[i], worker, c->index, c->values, c->count);
+    }
+    free(c);
+}
+
+// On the inserting thread: hand the chunk to the pool
+void pipeline_chunk(void *pipeline, size_t index, const value_t *values, uint32_t count) {
+    struct pipeline *pl = pipeline;
+    struct chunk_task *c = malloc(sizeof(*c));
+    if (!c) {
+        atomic_store(&pl->failed, 1);
+        return;
+    }
+    c->task.run = chunk_run;
+    c->pl = pl;
+    c->index = index;
+    c->values = values;
+    c->count = count;
+    pool_submit(pl->pool, &c->task);
+}
+
+int pipeline_open(struct pipeline *pl, const char *list, struct pool *pool, int ordered) {
+    pl->pool = pool;
+    pl->ordered = ordered;
+    pl->count = 0;
+    atomic_init(&pl->failed, 0);
+    if (parse_list(list, pl, pool->threads, ordered) < 0) {
+        pipeline_close(pl);
+        return -1;
+    }
+    return 0;
+}
+
+int pipeline_finish(struct pipeline *pl, const struct arena *a) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Full chunks are queued already; the rest are partly filled
+    struct arena_iter it;
+    const value_t *values;
+    size_t n;
+    arena_iter_init(&it, a);
+    while (a && (n = arena_iter_next(&it, &values)) > 0) {
+        if (n < ARENA_CHUNK_VALUES) {
+            pipeline_chunk(pl, arena_iter_slot(&it), values, (uint32_t)n);
+        }
+    }
+    pool_wait(pl->pool);
+
+    int rc = 0;
+    if (atomic_load(&pl->failed)) {
+        fprintf(stderr, "Stages missed chunks: out of memory for their tasks\n");
+        rc = -1;
+    }
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->ops[i]->finish(pl->states[i], pl->pool) < 0) {
+            rc = -1;
+        }
+    }
+    log_summary("Consumer PID %d stages done %.1f ms after the last value\n", getpid(),
+                ms_since(&start));
+    return rc;
+}
+
+void pipeline_close(struct pipeline *pl) {
+    for (int i = 0; i < pl->count; i++) {
+        pl->ops[i]->close(pl->states[i]);
+    }
+    pl->count = 0;
+}
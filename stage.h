@@ -0,0 +1,76 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "arena.h"
+#include "pool.h"
+
+/*
+ * Downstream processing stages for the consumer (--stage LIST).
+ *
+ * A pipeline is a comma-separated list of operators that see every
+ * value the consumer stores, while the data is still arriving: as each
+ * arena chunk fills (arena_on_full()), one task per chunk is queued on
+ * the work-stealing pool (pool.h) and runs every operator over it. When
+ * the last connection ends, pipeline_finish() feeds the partly filled
+ * chunks, waits for the pool and lets each operator complete, so what
+ * is left after the last byte is only the part that needs all the data.
+ *
+ *   stats        count, sum, min, max, mean and a histogram of the
+ *                values (as signed ints) by sign and bit length. Every
+ *                pool thread keeps its own partial result, merged at
+ *                the end.
+ *   sort         LSD radix sort, one 8-bit pass per value byte, in signed
+ *                order.
+ *                The first pass's digit counts are taken per chunk as
+ *                chunks arrive; at the end the chunks are scattered
+ *                straight out of the arena, then the remaining passes
+ *                run block-parallel on the pool.
+ *   write:PATH   the values in network order (the --binary input
+ *                format), written per chunk with pwrite(). In ordered
+ *                mode every chunk goes to its position in the input, so
+ *                the file is the input; otherwise chunks are appended
+ *                as they fill.
+ *
+ * Results are printed at the summary and sample log levels.
+ */
+
+#define STAGE_MAX 8     // operators per pipeline
+
+struct stage_op;
+
+struct pipeline {
+    struct pool *pool;
+    int ordered;
+    int count;
+    const struct stage_op *ops[STAGE_MAX];
+    void *states[STAGE_MAX];
+    atomic_int failed;      // a chunk could not be queued
+};
+
+// Check an operator list as given to --stage; prints why and returns -1
+// if it is invalid
+int pipeline_check(const char *list);
+
+/*
+ * Open the operators in list for one session, with their chunk work
+ * running on pool; ordered says chunk index k holds the values from
+ * position k * ARENA_CHUNK_VALUES. Returns 0 or -1.
+ */
+int pipeline_open(struct pipeline *pl, const char *list, struct pool *pool, int ordered);
+
+// Queue one chunk of values for every operator (arena_on_full()
+// signature); the values must stay put until pipeline_finish()
+void pipeline_chunk(void *pipeline, size_t index, const value_t *values, uint32_t count);
+
+// Once every value is stored: queue the partly filled chunks of a (if
+// not NULL), process the rest and print each result; returns 0, or -1
+// if an operator failed
+int pipeline_finish(struct pipeline *pl, const struct arena *a);
+
+void pipeline_close(struct pipeline *pl);
+
+#endif // STAGE_H
@@ -0,0 +1,157 @@
+#include "stats.h"
+
+#ifdef STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define STATS_MAX_THREADS 256
+
+_Thread_local struct stats_block *stats_self = NULL;
+
+static _Atomic(struct stats_block *) blocks[STATS_MAX_THREADS];
+static atomic_int block_count = 0;
+
+static const char *program_name = "";
+static pthread_t signal_thread;
+static int signal_running = 0;
+static atomic_int stopping = 0;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+// Thread exit: its block, totals and all, waits for the next thread of
+// the same name
+static void retire_block(void *arg) {
+    struct stats_block *s = arg;
+    atomic_store_explicit(&s->retired, 1, memory_order_release);
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, retire_block);
+}
+
+// Claim a retired block registered as name ("name slot"), or NULL
+static struct stats_block *reuse_block(const char *name) {
+    size_t len = strlen(name);
+    int n = atomic_load(&block_count);
+    for (int i = 0; i < n && i < STATS_MAX_THREADS; i++) {
+        struct stats_block *s = atomic_load(&blocks[i]);
+        int retired = 1;
+        if (s && strncmp(s->name, name, len) == 0 && s->name[len] == ' ' &&
+            atomic_compare_exchange_strong_explicit(&s->retired, &retired, 0,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void stats_register(const char *name) {
+    pthread_once(&exit_key_once, make_exit_key);
+    struct stats_block *s = reuse_block(name);
+    if (!s) {
+        s = aligned_alloc(64, sizeof(*s));
+        if (!s) {
+            return;
+        }
+        memset(s, 0, sizeof(*s));
+        atomic_init(&s->retired, 0);
+        int slot = atomic_fetch_add(&block_count, 1);
+        if (slot >= STATS_MAX_THREADS) {
+            free(s);
+            return;
+        }
+        snprintf(s->name, sizeof(s->name), "%s %d", name, slot);
+        atomic_store(&blocks[slot], s);
+    }
+    stats_self = s;
+    pthread_setspecific(exit_key, s);
+}
+
+static void print_row(const char *name, const uint64_t *v) {
+    fprintf(stderr, "  %-16s %12llu %14llu %14llu %10llu %12.3f %10.3f %10.3f %10.3f %10.3f %11llu\n",
+            name, (unsigned long long)v[STAT_ELEMENTS], (unsigned long long)v[STAT_BYTES_SENT],
+            (unsigned long long)v[STAT_BYTES_RECEIVED], (unsigned long long)v[STAT_SYSCALLS],
+            v[STAT_LOCK_WAIT_NS] / 1e6, v[STAT_PARSE_NS] / 1e6, v[STAT_SEND_NS] / 1e6,
+            v[STAT_RECV_NS] / 1e6, v[STAT_CREDIT_WAIT_NS] / 1e6,
+            (unsigned long long)v[STAT_BUF_REFILLS]);
+}
+
+// One line per thread plus the totals, on stderr so stdout stays parseable
+static void stats_report(void) {
+    uint64_t total[STAT_COUNTERS] = {0};
+    flockfile(stderr);
+    fprintf(stderr, "%s PID %d stats:\n", program_name, (int)getpid());
+    fprintf(stderr, "  %-16s %12s %14s %14s %10s %12s %10s %10s %10s %10s %11s\n", "thread",
+            "elements", "bytes_sent", "bytes_recv", "syscalls", "lock_wait_ms", "parse_ms",
+            "send_ms", "recv_ms", "credit_ms", "buf_refills");
+    int n = atomic_load(&block_count);
+    for (int i = 0; i < n && i < STATS_MAX_THREADS; i++) {
+        struct stats_block *s = atomic_load(&blocks[i]);
+        if (!s) {
+            continue;   // Slot claimed, not yet published
+        }
+        uint64_t v[STAT_COUNTERS];
+        for (int c = 0; c < STAT_COUNTERS; c++) {
+            v[c] = atomic_load_explicit(&s->v[c], memory_order_relaxed);
+            total[c] += v[c];
+        }
+        print_row(s->name, v);
+    }
+    print_row("total", total);
+    funlockfile(stderr);
+}
+
+static void *signal_thread_func(void *arg) {
+    sigset_t *set = arg;
+    sigset_t all;
+    int sig;
+    // Leave every other signal (the consumer's accept alarm) to the
+    // threads that expect it
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    while (sigwait(set, &sig) == 0 && !atomic_load(&stopping)) {
+        stats_report();
+    }
+    return NULL;
+}
+
+void stats_start(const char *program) {
+    static sigset_t set;
+    program_name = program;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    // Only the signal thread ever takes SIGUSR1
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal_running = pthread_create(&signal_thread, NULL, signal_thread_func, &set) == 0;
+    stats_register("main");
+}
+
+void stats_stop(void) {
+    if (signal_running) {
+        atomic_store(&stopping, 1);
+        pthread_kill(signal_thread, SIGUSR1);
+        pthread_join(signal_thread, NULL);
+        signal_running = 0;
+    }
+    stats_report();
+    int n = atomic_load(&block_count);
+    for (int i = 0; i < n && i < STATS_MAX_THREADS; i++) {
+        free(atomic_exchange(&blocks[i], NULL));
+    }
+    atomic_store(&block_count, 0);
+    stats_self = NULL;
+}
+
+#else
+
+// Built without -DSTATS: nothing to count
+typedef int stats_disabled;
+
+#endif // STATS
@@ -0,0 +1,95 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Per-thread hot-path counters, built only with -DSTATS (make STATS=1).
+ *
+ * Every thread that registers gets its own block of counters that only
+ * it writes (plain relaxed load + store, no locked instructions, no
+ * shared cache lines), so counting never contends. Readers sum the blocks
+ * when the report is printed: at exit, and whenever the process gets
+ * SIGUSR1. Threads that never registered are not counted. A block
+ * outlives its thread: the next thread to register under the same name
+ * carries on counting in it, so a --daemon's blocks, one per receiver
+ * or worker at a time rather than per session, only add up.
+ *
+ * Without STATS every macro below expands to nothing, so the counters
+ * cost nothing in normal builds.
+ */
+
+enum stat_counter {
+    STAT_ELEMENTS = 0,      // values this thread sent or inserted, each counted once
+    STAT_BYTES_SENT,
+    STAT_BYTES_RECEIVED,
+    STAT_SYSCALLS,          // send/recv/read/sendfile/futex/io_uring calls
+    STAT_LOCK_WAIT_NS,      // blocked acquiring a mutex or on a hand-off queue
+    STAT_PARSE_NS,          // turning input text into values
+    STAT_SEND_NS,           // inside transport sends
+    STAT_RECV_NS,           // inside transport receives
+    STAT_CREDIT_WAIT_NS,    // out of credit, waiting for the consumer's grant
+    STAT_BUF_REFILLS,       // buffer pool slow paths: shared list visits and slab maps
+    STAT_COUNTERS
+};
+
+#ifdef STATS
+
+#include <stdatomic.h>
+#include <time.h>
+
+struct stats_block {
+    _Alignas(64) _Atomic uint64_t v[STAT_COUNTERS];
+    char name[24];
+    atomic_int retired;     // its thread exited; free for the next of its name
+};
+
+extern _Thread_local struct stats_block *stats_self;
+
+/*
+ * Start counting for this process: program names the report. Call from
+ * the main thread before other threads exist; it blocks SIGUSR1 (the
+ * mask is inherited) and starts a thread that prints a report on each
+ * SIGUSR1.
+ */
+void stats_start(const char *program);
+
+// Give the calling thread its counters; name labels its report line
+void stats_register(const char *name);
+
+// Print the final report and stop the SIGUSR1 thread
+void stats_stop(void);
+
+static inline void stats_add(enum stat_counter c, uint64_t n) {
+    struct stats_block *s = stats_self;
+    if (s) {
+        atomic_store_explicit(&s->v[c], atomic_load_explicit(&s->v[c], memory_order_relaxed) + n,
+                              memory_order_relaxed);
+    }
+}
+
+static inline uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#define STAT_ADD(c, n) stats_add((c), (uint64_t)(n))
+#define STAT_TIMER(t) uint64_t t = stats_clock()
+#define STAT_SINCE(c, t) stats_add((c), stats_clock() - (t))
+#define STATS_START(program) stats_start(program)
+#define STATS_REGISTER(name) stats_register(name)
+#define STATS_STOP() stats_stop()
+
+#else
+
+#define STAT_ADD(c, n) ((void)0)
+#define STAT_TIMER(t) ((void)0)
+#define STAT_SINCE(c, t) ((void)0)
+#define STATS_START(program) ((void)0)
+#define STATS_REGISTER(name) ((void)0)
+#define STATS_STOP() ((void)0)
+
+#endif // STATS
+
+#endif // STATS_H
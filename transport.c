@@ -0,0 +1,833 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#endif
+#ifdef __APPLE__
+#include <sys/uio.h>
+#endif
+
+#include "protocol.h"
+#include "transport.h"
+#include "uring.h"
+#include "stats.h"
+
+#define SHM_MAGIC 0x53484d31u                   // "SHM1"
+#define SHM_HEADER_BYTES 4096                   // segment header, one page
+#define SHM_DATA_BYTES ((size_t)1 << 22)        // connector -> acceptor ring
+#define SHM_BACK_BYTES ((size_t)1 << 16)        // acceptor -> connector ring
+#define SHM_SPINS 64            // yielding polls before sleeping on the futex
+#define SHM_SLEEP_NS 100000000L // longest sleep before checking on the peer
+#define SHM_POLL_NS 50000L      // sleep step without futexes
+
+/*
+ * One direction of a shared-memory connection: a byte ring with exactly
+ * one writer and one reader. Positions only grow; the writer owns tail,
+ * the reader owns head. data_seq/space_seq are futex words bumped after
+ * every publish so a sleeping side can wait on them, and the waiter
+ * counts let the other side skip the wake syscall when nobody sleeps.
+ */
+struct shm_ring {
+    size_t size;                                // data bytes, power of two
+    size_t offset;                              // data offset in the segment
+    _Alignas(64) atomic_size_t tail;
+    atomic_uint data_seq;
+    atomic_uint data_waiters;
+    atomic_int closed;                          // writer is done
+    _Alignas(64) atomic_size_t head;
+    atomic_uint space_seq;
+    atomic_uint space_waiters;
+    atomic_int abandoned;                       // reader went away
+};
+
+struct shm_segment {
+    uint32_t magic;
+    uint32_t reserved;
+    struct shm_ring rings[2];   // [0] connector -> acceptor, [1] the way back
+};
+
+_Static_assert(sizeof(struct shm_segment) <= SHM_HEADER_BYTES, "shm header too large");
+
+#define SHM_SEGMENT_BYTES (SHM_HEADER_BYTES + SHM_DATA_BYTES + SHM_BACK_BYTES)
+
+static const char *kind_names[] = { "tcp", "unix", "shm" };
+
+int transport_parse_kind(const char *name) {
+    for (int i = 0; i <= TRANSPORT_SHM; i++) {
+        if (strcmp(name, kind_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *transport_kind_name(enum transport_kind kind) {
+    return kind_names[kind];
+}
+
+static const char *io_names[] = { "blocking", "uring" };
+
+int transport_parse_io(const char *name) {
+    for (int i = 0; i <= TRANSPORT_IO_URING; i++) {
+        if (strcmp(name, io_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *transport_io_name(enum transport_io io) {
+    return io_names[io];
+}
+
+void transport_set_io(struct transport *t, enum transport_io io) {
+    if (t->kind != TRANSPORT_SHM) {
+        t->io = io;
+    }
+}
+
+// io_uring was asked for but can't be had: say so once, then block
+static void uring_unavailable(struct transport *t) {
+    static atomic_int warned = 0;
+    if (!atomic_exchange(&warned, 1)) {
+        fprintf(stderr, "io_uring unavailable (%s), using blocking I/O\n", strerror(errno));
+    }
+    t->io = TRANSPORT_IO_BLOCKING;
+}
+
+static void transport_reset(struct transport *t, enum transport_kind kind) {
+    memset(t, 0, sizeof(*t));
+    t->kind = kind;
+    t->fd = -1;
+}
+
+// Fill in an AF_UNIX address; -1 with ENAMETOOLONG if path does not fit
+static int unix_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    #ifdef __APPLE__
+    addr->sun_len = sizeof(*addr);
+    #endif
+    return 0;
+}
+
+/*
+ * tcp: spec is "host:port", ":port" or NULL for PORT; no host means
+ * 127.0.0.1 to connect and every interface to listen on. Returns 0, or
+ * -1 with errno EINVAL if spec doesn't parse or its host doesn't resolve.
+ */
+static int tcp_addr(struct sockaddr_in *addr, const char *spec, int listening) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    #ifdef __APPLE__
+    // macOS specific: explicitly set length to avoid EINVAL
+    addr->sin_len = sizeof(*addr);
+    #endif
+    long port = PORT;
+    char host[256] = "";
+    if (spec) {
+        const char *colon = strrchr(spec, ':');
+        char *end;
+        if (!colon || (size_t)(colon - spec) >= sizeof(host)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(host, spec, (size_t)(colon - spec));
+        host[colon - spec] = '\0';
+        port = strtol(colon + 1, &end, 10);
+        if (colon[1] == '\0' || *end != '\0' || port < 1 || port > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    addr->sin_port = htons((uint16_t)port);
+    if (host[0] == '\0') {
+        // Use loopback directly (avoids inet_pton/inet_addr issues on macOS)
+        addr->sin_addr.s_addr = listening ? htonl(INADDR_ANY) : inet_addr("127.0.0.1");
+        return 0;
+    }
+    if (inet_pton(AF_INET, host, &addr->sin_addr) == 1) {
+        return 0;
+    }
+    struct addrinfo hints;
+    struct addrinfo *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    addr->sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// ---- Shared-memory rings ----
+
+static char *ring_data(const struct transport *t, const struct shm_ring *r) {
+    return (char *)t->map + r->offset;
+}
+
+// Wait until *seq moves on from old; returns 1 if we stopped after SHM_SLEEP_NS
+static int shm_sleep(atomic_uint *seq, unsigned old) {
+#ifdef __linux__
+    // Shared futex: the word lives in a mapping both processes see
+    struct timespec ts = { 0, SHM_SLEEP_NS };
+    STAT_ADD(STAT_SYSCALLS, 1);
+    if (syscall(SYS_futex, (unsigned *)seq, FUTEX_WAIT, old, &ts, NULL, 0) < 0 &&
+        errno == ETIMEDOUT) {
+        return 1;
+    }
+    return 0;
+#else
+    for (long waited = 0; waited < SHM_SLEEP_NS; waited += SHM_POLL_NS) {
+        if (atomic_load(seq) != old) {
+            return 0;
+        }
+        struct timespec ts = { 0, SHM_POLL_NS };
+        STAT_ADD(STAT_SYSCALLS, 1);
+        nanosleep(&ts, NULL);
+    }
+    return 1;
+#endif
+}
+
+// Bump a futex word and wake its sleepers, if there are any
+static void shm_notify(atomic_uint *seq, atomic_uint *waiters) {
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(waiters) > 0) {
+#ifdef __linux__
+        STAT_ADD(STAT_SYSCALLS, 1);
+        syscall(SYS_futex, (unsigned *)seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+    }
+}
+
+// The rendezvous socket hangs up when the peer process exits, even if
+// it never got to transport_close()
+static int peer_gone(const struct transport *t) {
+    struct pollfd p = { t->fd, POLLIN, 0 };
+    if (poll(&p, 1, 0) <= 0) {
+        return 0;
+    }
+    if (p.revents & (POLLHUP | POLLERR)) {
+        return 1;
+    }
+    char c;
+    return recv(t->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+/*
+ * Block until the ring's `pos` field no longer equals `old` or *flag is
+ * set. Returns 0 then, or -1 if the peer disappeared. The waiter count
+ * is raised before the final check so a concurrent publish either is
+ * seen here or sees us and wakes the futex.
+ */
+static int shm_wait(const struct transport *t, atomic_size_t *pos, size_t old,
+                    atomic_int *flag, atomic_uint *seq, atomic_uint *waiters) {
+    for (unsigned spins = 0; ; spins++) {
+        if (atomic_load(pos) != old || atomic_load(flag)) {
+            return 0;
+        }
+        if (spins < SHM_SPINS) {
+            STAT_ADD(STAT_SYSCALLS, 1);
+            sched_yield();
+            continue;
+        }
+        unsigned s = atomic_load(seq);
+        atomic_fetch_add(waiters, 1);
+        int timed_out = 0;
+        if (atomic_load(pos) == old && !atomic_load(flag)) {
+            timed_out = shm_sleep(seq, s);
+        }
+        atomic_fetch_sub(waiters, 1);
+        if (timed_out && peer_gone(t)) {
+            // Whatever the peer published before it died is visible now
+            return atomic_load(pos) != old || atomic_load(flag) ? 0 : -1;
+        }
+    }
+}
+
+static int shm_send(struct transport *t, const char *p, size_t len) {
+    struct shm_ring *r = t->tx;
+    char *data = ring_data(t, r);
+    size_t mask = r->size - 1;
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    while (len > 0) {
+        if (atomic_load_explicit(&r->abandoned, memory_order_relaxed)) {
+            errno = EPIPE;
+            return -1;
+        }
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t room = r->size - (tail - head);
+        if (room == 0) {
+            if (shm_wait(t, &r->head, head, &r->abandoned, &r->space_seq, &r->space_waiters) < 0) {
+                errno = EPIPE;
+                return -1;
+            }
+            continue;
+        }
+        size_t n = len < room ? len : room;
+        size_t off = tail & mask;
+        size_t first = r->size - off < n ? r->size - off : n;
+        memcpy(data + off, p, first);
+        memcpy(data, p + first, n - first);
+        tail += n;
+        p += n;
+        len -= n;
+        atomic_store(&r->tail, tail);
+        shm_notify(&r->data_seq, &r->data_waiters);
+    }
+    return 0;
+}
+
+// File bytes go straight from pread() into free ring space
+static int shm_sendfile(struct transport *t, int fd, off_t offset, size_t len) {
+    struct shm_ring *r = t->tx;
+    char *data = ring_data(t, r);
+    size_t mask = r->size - 1;
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    while (len > 0) {
+        if (atomic_load_explicit(&r->abandoned, memory_order_relaxed)) {
+            errno = EPIPE;
+            return -1;
+        }
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t room = r->size - (tail - head);
+        if (room == 0) {
+            if (shm_wait(t, &r->head, head, &r->abandoned, &r->space_seq, &r->space_waiters) < 0) {
+                errno = EPIPE;
+                return -1;
+            }
+            continue;
+        }
+        size_t off = tail & mask;
+        size_t n = len < room ? len : room;
+        if (n > r->size - off) {
+            n = r->size - off;  // Up to the wrap; the rest goes in the next round
+        }
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t got = pread(fd, data + off, n, offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (got == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        tail += (size_t)got;
+        offset += got;
+        len -= (size_t)got;
+        atomic_store(&r->tail, tail);
+        shm_notify(&r->data_seq, &r->data_waiters);
+    }
+    return 0;
+}
+
+static ssize_t shm_recv(struct transport *t, char *p, size_t len) {
+    struct shm_ring *r = t->rx;
+    const char *data = ring_data(t, r);
+    size_t mask = r->size - 1;
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t got = 0;
+
+    while (got < len) {
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (tail == head) {
+            // closed is set after the last publish, so re-check tail after it
+            if (atomic_load(&r->closed) && atomic_load(&r->tail) == head) {
+                break;
+            }
+            if (shm_wait(t, &r->tail, head, &r->closed, &r->data_seq, &r->data_waiters) < 0) {
+                break;
+            }
+            continue;
+        }
+        size_t n = tail - head < len - got ? tail - head : len - got;
+        size_t off = head & mask;
+        size_t first = r->size - off < n ? r->size - off : n;
+        memcpy(p + got, data + off, first);
+        memcpy(p + got + first, data, n - first);
+        head += n;
+        got += n;
+        atomic_store(&r->head, head);
+        shm_notify(&r->space_seq, &r->space_waiters);
+    }
+    return (ssize_t)got;
+}
+
+static void ring_setup(struct shm_ring *r, size_t offset, size_t size) {
+    r->size = size;
+    r->offset = offset;
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->data_seq, 0);
+    atomic_init(&r->data_waiters, 0);
+    atomic_init(&r->closed, 0);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->space_seq, 0);
+    atomic_init(&r->space_waiters, 0);
+    atomic_init(&r->abandoned, 0);
+}
+
+// Connector: create an anonymous segment and pass it over the socket
+static int shm_offer(struct transport *t) {
+    static atomic_uint counter = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "/pc-%d-%u", (int)getpid(), atomic_fetch_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    shm_unlink(name);   // Only the fds keep it alive from here on
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, SHM_SEGMENT_BYTES) == 0) {
+        map = mmap(NULL, SHM_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    struct shm_segment *seg = map;
+    seg->magic = SHM_MAGIC;
+    ring_setup(&seg->rings[0], SHM_HEADER_BYTES, SHM_DATA_BYTES);
+    ring_setup(&seg->rings[1], SHM_HEADER_BYTES + SHM_DATA_BYTES, SHM_BACK_BYTES);
+
+    // One byte of payload carries the descriptor
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    ssize_t sent = sendmsg(t->fd, &msg, 0);
+    int err = errno;
+    close(fd);  // The mapping keeps the segment alive
+    if (sent != 1) {
+        munmap(map, SHM_SEGMENT_BYTES);
+        errno = sent < 0 ? err : EPROTO;
+        return -1;
+    }
+    t->map = map;
+    t->map_len = SHM_SEGMENT_BYTES;
+    t->tx = &seg->rings[0];
+    t->rx = &seg->rings[1];
+    return 0;
+}
+
+// Acceptor: receive the connector's segment and map it
+static int shm_take(struct transport *t) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    ssize_t n;
+    do {
+        n = recvmsg(t->fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    struct cmsghdr *cm = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+        if (n >= 0) {
+            errno = EPROTO;
+        }
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)SHM_SEGMENT_BYTES) {
+        map = mmap(NULL, SHM_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        errno = EPROTO;
+    }
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    struct shm_segment *seg = map;
+    if (seg->magic != SHM_MAGIC ||
+        seg->rings[0].offset != SHM_HEADER_BYTES ||
+        seg->rings[0].size != SHM_DATA_BYTES ||
+        seg->rings[1].offset != SHM_HEADER_BYTES + SHM_DATA_BYTES ||
+        seg->rings[1].size != SHM_BACK_BYTES) {
+        munmap(map, SHM_SEGMENT_BYTES);
+        errno = EPROTO;
+        return -1;
+    }
+    t->map = map;
+    t->map_len = SHM_SEGMENT_BYTES;
+    t->tx = &seg->rings[1];
+    t->rx = &seg->rings[0];
+    return 0;
+}
+
+// ---- Listener and connections ----
+
+int transport_listen(struct transport_listener *l, enum transport_kind kind,
+                     const char *path, int backlog) {
+    l->kind = kind;
+    l->path[0] = '\0';
+    int family = kind == TRANSPORT_TCP ? AF_INET : AF_UNIX;
+    l->fd = socket(family, SOCK_STREAM, 0);
+    if (l->fd < 0) {
+        return -1;
+    }
+
+    int rc;
+    if (kind == TRANSPORT_TCP) {
+        // Allow reuse of address
+        int opt_val = 1;
+        if (setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val)) < 0) {
+            goto fail;
+        }
+        struct sockaddr_in addr;
+        if (tcp_addr(&addr, path, 1) < 0) {
+            goto fail;
+        }
+        rc = bind(l->fd, (struct sockaddr *)&addr, sizeof(addr));
+    } else {
+        struct sockaddr_un addr;
+        if (unix_addr(&addr, path) < 0) {
+            goto fail;
+        }
+        unlink(path);   // A stale socket from an earlier run would block bind()
+        rc = bind(l->fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (rc == 0) {
+            strcpy(l->path, path);
+        }
+    }
+    if (rc < 0 || listen(l->fd, backlog) < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail: {
+        int err = errno;
+        transport_listener_close(l);
+        errno = err;
+        return -1;
+    }
+}
+
+int transport_accept(struct transport_listener *l, struct transport *t) {
+    transport_reset(t, l->kind);
+    t->fd = accept(l->fd, NULL, NULL);
+    if (t->fd < 0) {
+        return -1;
+    }
+    if (t->kind == TRANSPORT_SHM && shm_take(t) < 0) {
+        int err = errno;
+        close(t->fd);
+        t->fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void transport_listener_close(struct transport_listener *l) {
+    if (l->fd >= 0) {
+        close(l->fd);
+        l->fd = -1;
+    }
+    if (l->path[0] != '\0') {
+        unlink(l->path);
+        l->path[0] = '\0';
+    }
+}
+
+int transport_connect(struct transport *t, enum transport_kind kind, const char *path) {
+    transport_reset(t, kind);
+    int rc;
+    if (kind == TRANSPORT_TCP) {
+        struct sockaddr_in addr;
+        if (tcp_addr(&addr, path, 0) < 0) {
+            return -1;
+        }
+        t->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (t->fd < 0) {
+            return -1;
+        }
+        rc = connect(t->fd, (struct sockaddr *)&addr, sizeof(addr));
+    } else {
+        struct sockaddr_un addr;
+        if (unix_addr(&addr, path) < 0) {
+            return -1;
+        }
+        t->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (t->fd < 0) {
+            return -1;
+        }
+        rc = connect(t->fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (rc == 0 && kind == TRANSPORT_SHM) {
+            rc = shm_offer(t);
+        }
+    }
+    if (rc < 0) {
+        // A failed connect() leaves the socket unusable on macOS; never reuse it
+        int err = errno;
+        close(t->fd);
+        t->fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int send_bytes(struct transport *t, const void *buf, size_t len) {
+    if (t->kind == TRANSPORT_SHM) {
+        return shm_send(t, buf, len);
+    }
+    if (t->io == TRANSPORT_IO_URING && !t->usend && !(t->usend = uring_sender_new(t->fd))) {
+        uring_unavailable(t);
+    }
+    if (t->usend) {
+        return uring_sender_send(t->usend, buf, len);
+    }
+    return send_all(t->fd, buf, len);
+}
+
+static int sendfile_bytes(struct transport *t, const void *head, size_t head_len,
+                          int fd, off_t offset, size_t len) {
+    if (t->kind == TRANSPORT_SHM) {
+        if (shm_send(t, head, head_len) < 0) {
+            return -1;
+        }
+        return shm_sendfile(t, fd, offset, len);
+    }
+    // Whatever io_uring still holds has to go out first
+    if (t->usend && uring_sender_flush(t->usend) < 0) {
+        return -1;
+    }
+#if defined(__linux__)
+    // MSG_MORE keeps the small head from going out (and stalling on
+    // Nagle) as a segment of its own
+    const char *p = head;
+    while (head_len > 0) {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t n = send(t->fd, p, head_len, MSG_MORE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        p += n;
+        head_len -= (size_t)n;
+    }
+    while (len > 0) {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t n = sendfile(t->fd, fd, &offset, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;    // File shrank under us
+            }
+            return -1;
+        }
+        len -= (size_t)n;
+    }
+    return 0;
+#elif defined(__APPLE__)
+    // The head rides along in sendfile()'s header vector
+    struct iovec iov = { (void *)head, head_len };
+    struct sf_hdtr hdtr = { &iov, 1, NULL, 0 };
+    while (head_len > 0 || len > 0) {
+        off_t n = (off_t)len;   // Counts the head too on return
+        STAT_ADD(STAT_SYSCALLS, 1);
+        int rc = sendfile(fd, t->fd, offset, &n, head_len > 0 ? &hdtr : NULL, 0);
+        if (rc < 0 && errno != EINTR && errno != EAGAIN) {
+            return -1;
+        }
+        if (n == 0 && rc == 0) {
+            errno = EIO;
+            return -1;
+        }
+        size_t sent = (size_t)n;
+        size_t from_head = sent < head_len ? sent : head_len;
+        iov.iov_base = (char *)iov.iov_base + from_head;
+        iov.iov_len -= from_head;
+        head_len -= from_head;
+        offset += (off_t)(sent - from_head);
+        len -= sent - from_head;
+    }
+    return 0;
+#else
+    if (send_all(t->fd, head, head_len) < 0) {
+        return -1;
+    }
+    char buf[65536];
+    while (len > 0) {
+        size_t want = len < sizeof(buf) ? len : sizeof(buf);
+        STAT_ADD(STAT_SYSCALLS, 1);
+        ssize_t n = pread(fd, buf, want, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        if (send_all(t->fd, buf, (size_t)n) < 0) {
+            return -1;
+        }
+        offset += n;
+        len -= (size_t)n;
+    }
+    return 0;
+#endif
+}
+
+static ssize_t recv_bytes(struct transport *t, void *buf, size_t len) {
+    if (t->kind == TRANSPORT_SHM) {
+        return shm_recv(t, buf, len);
+    }
+    if (t->io == TRANSPORT_IO_URING && !t->urecv && !(t->urecv = uring_receiver_new(t->fd))) {
+        uring_unavailable(t);
+    }
+    if (t->urecv) {
+        return uring_receiver_recv(t->urecv, buf, len);
+    }
+    return recv_all(t->fd, buf, len);
+}
+
+// Public I/O entry points: the engine above, plus the stats counters
+
+int transport_send(struct transport *t, const void *buf, size_t len) {
+    STAT_TIMER(start);
+    int rc = send_bytes(t, buf, len);
+    STAT_SINCE(STAT_SEND_NS, start);
+    STAT_ADD(STAT_BYTES_SENT, rc == 0 ? len : 0);
+    return rc;
+}
+
+int transport_sendfile(struct transport *t, const void *head, size_t head_len,
+                       int fd, off_t offset, size_t len) {
+    STAT_TIMER(start);
+    int rc = sendfile_bytes(t, head, head_len, fd, offset, len);
+    STAT_SINCE(STAT_SEND_NS, start);
+    STAT_ADD(STAT_BYTES_SENT, rc == 0 ? head_len + len : 0);
+    return rc;
+}
+
+ssize_t transport_recv(struct transport *t, void *buf, size_t len) {
+    STAT_TIMER(start);
+    ssize_t n = recv_bytes(t, buf, len);
+    STAT_SINCE(STAT_RECV_NS, start);
+    STAT_ADD(STAT_BYTES_RECEIVED, n > 0 ? (size_t)n : 0);
+    transport_count_received(t, n > 0 ? (size_t)n : 0);
+    return n;
+}
+
+int transport_flush(struct transport *t) {
+    if (t->usend && uring_sender_flush(t->usend) < 0) {
+        return -1;
+    }
+    if (t->kind == TRANSPORT_TCP) {
+        // Setting TCP_NODELAY sends whatever is pending at once; clearing
+        // it again keeps the coalescing for the bulk of the stream
+        int on = 1, off = 0;
+        if (setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0 ||
+            setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &off, sizeof(off)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int transport_shutdown(struct transport *t) {
+    if (t->usend && uring_sender_flush(t->usend) < 0) {
+        return -1;
+    }
+    if (t->map) {
+        atomic_store(&t->tx->closed, 1);
+        shm_notify(&t->tx->data_seq, &t->tx->data_waiters);
+        return 0;
+    }
+    return shutdown(t->fd, SHUT_WR);
+}
+
+void transport_close(struct transport *t) {
+    if (t->usend) {
+        // Queued data still belongs to the stream
+        uring_sender_flush(t->usend);
+        uring_sender_free(t->usend);
+        t->usend = NULL;
+    }
+    if (t->urecv) {
+        uring_receiver_free(t->urecv);
+        t->urecv = NULL;
+    }
+    if (t->map) {
+        // EOF for the reader of our ring, EPIPE for the writer of theirs
+        atomic_store(&t->tx->closed, 1);
+        shm_notify(&t->tx->data_seq, &t->tx->data_waiters);
+        atomic_store(&t->rx->abandoned, 1);
+        shm_notify(&t->rx->space_seq, &t->rx->space_waiters);
+        munmap(t->map, t->map_len);
+        t->map = NULL;
+    }
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+}
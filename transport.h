@@ -0,0 +1,159 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/*
+ * Byte-stream transports between producer and consumer.
+ *
+ * Every transport behaves like a full-duplex stream socket, so the wire
+ * protocol in protocol.h runs unchanged on top and the consumer can talk
+ * back (credits, acks) on the same connection:
+ *
+ *   tcp   TCP, by default on 127.0.0.1:PORT, the original path; any
+ *         "host:port" address otherwise
+ *   unix  AF_UNIX stream socket at a filesystem path
+ *   shm   a POSIX shared-memory segment per connection holding two
+ *         single-producer/single-consumer byte rings, one per direction.
+ *         The AF_UNIX socket is still used to rendezvous: the connecting
+ *         side creates the segment and passes its fd over the socket with
+ *         SCM_RIGHTS, and the socket then only serves to notice a peer
+ *         that died. Data moves with one memcpy into and one out of the
+ *         ring; an idle side sleeps on a futex in the segment (Linux) or
+ *         polls with a short sleep elsewhere.
+ *
+ * Socket transports can run their I/O through io_uring instead of
+ * blocking send()/recv() (transport_set_io(), see uring.h). If io_uring
+ * is not built in or the kernel refuses it, they warn once and keep using
+ * the blocking calls.
+ *
+ * A transport carries bytes only; callers that share one between threads
+ * serialize sends themselves, and only one thread receives at a time.
+ */
+
+// AF_UNIX socket path when none is given; the producer passes its own
+#define TRANSPORT_DEFAULT_PATH "/tmp/producer-consumer.sock"
+
+enum transport_kind {
+    TRANSPORT_TCP = 0,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM
+};
+
+enum transport_io {
+    TRANSPORT_IO_BLOCKING = 0,
+    TRANSPORT_IO_URING
+};
+
+struct shm_ring;
+struct uring_sender;
+struct uring_receiver;
+
+struct transport {
+    enum transport_kind kind;
+    enum transport_io io;
+    struct uring_sender *usend;     // io_uring engines, created on first use
+    struct uring_receiver *urecv;
+    int fd;                     // stream socket (shm: the rendezvous socket)
+    void *map;                  // shm: the mapped segment
+    size_t map_len;
+    struct shm_ring *tx;        // shm: ring we write
+    struct shm_ring *rx;        // shm: ring we read
+    _Atomic uint64_t received;  // bytes received; only the receiving thread writes it
+};
+
+struct transport_listener {
+    enum transport_kind kind;
+    int fd;
+    char path[108];             // unix/shm: socket path, unlinked on close
+};
+
+// Parse a kind name ("tcp", "unix", "shm"); -1 if unknown
+int transport_parse_kind(const char *name);
+const char *transport_kind_name(enum transport_kind kind);
+
+// Parse an I/O engine name ("blocking", "uring"); -1 if unknown
+int transport_parse_io(const char *name);
+const char *transport_io_name(enum transport_io io);
+
+// Pick the I/O engine for a connected socket transport; shm ignores it
+void transport_set_io(struct transport *t, enum transport_io io);
+
+/*
+ * path names the AF_UNIX socket for unix/shm, and for tcp the address:
+ * "host:port", ":port" (listening: every interface; connecting:
+ * 127.0.0.1) or NULL for PORT.
+ */
+
+/*
+ * Server side. Return 0, or -1 with errno set (the error is not printed).
+ */
+int transport_listen(struct transport_listener *l, enum transport_kind kind,
+                     const char *path, int backlog);
+int transport_accept(struct transport_listener *l, struct transport *t);
+void transport_listener_close(struct transport_listener *l);
+
+/*
+ * Client side: a single connection attempt. Returns 0, or -1 with errno
+ * from the failing call so the caller can decide whether to retry
+ * (ECONNREFUSED and ENOENT mean the server is not listening yet).
+ */
+int transport_connect(struct transport *t, enum transport_kind kind, const char *path);
+
+// Send the whole buffer; returns 0 or -1 with errno set
+int transport_send(struct transport *t, const void *buf, size_t len);
+
+/*
+ * Send head_len bytes of head, then len bytes of file fd starting at
+ * offset, without staging the file data in a user buffer: sendfile() on
+ * socket transports (Linux, macOS; the head is corked onto the same
+ * segment), a pread() straight into the ring for shm. Other systems fall
+ * back to pread() and send(). Returns 0 or -1 with errno set.
+ */
+int transport_sendfile(struct transport *t, const void *head, size_t head_len,
+                       int fd, off_t offset, size_t len);
+
+// Receive exactly len bytes; returns len, 0 on clean EOF, -1 on error,
+// or the short count if the peer closed mid-message (like recv_all())
+ssize_t transport_recv(struct transport *t, void *buf, size_t len);
+
+/*
+ * Count n bytes received on t, for readers on other threads (the
+ * consumer's --metrics). Only the receiving thread counts, so this is a
+ * plain load and store, no locked instruction; transport_recv() does it
+ * itself, callers reading t->fd directly call it.
+ */
+static inline void transport_count_received(struct transport *t, size_t n) {
+    atomic_store_explicit(&t->received,
+                          atomic_load_explicit(&t->received, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline uint64_t transport_received(const struct transport *t) {
+    return atomic_load_explicit(&t->received, memory_order_relaxed);
+}
+
+/*
+ * Wait until everything sent so far has left (only io_uring queues
+ * sends), and have TCP push out small segments Nagle's algorithm holds
+ * back, so a peer waiting for them before it answers gets them now. A
+ * thread that sent through io_uring must flush before it exits: the
+ * kernel cancels a thread's pending requests when it exits. Returns 0
+ * or -1 with errno set.
+ */
+int transport_flush(struct transport *t);
+
+/*
+ * Half-close: flush, then end our sending direction only. The peer sees
+ * EOF once it has read everything we sent, and we can still receive
+ * what it sends until it closes. Returns 0 or -1 with errno set.
+ */
+int transport_shutdown(struct transport *t);
+
+// End our side; the peer sees EOF once it has read everything we sent
+void transport_close(struct transport *t);
+
+#endif // TRANSPORT_H
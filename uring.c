@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+#include "stats.h"
+
+#ifdef HAVE_IO_URING
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 16                    // SQ size; the CQ gets twice that
+#define SEND_STAGE_BYTES ((size_t)1 << 20)  // staging ring, power of two
+#define RECV_BUFS 16                        // provided buffers, power of two
+#define RECV_BUF_BYTES 65536
+#define RECV_BGID 0
+
+// One io_uring instance: the mapped SQ/CQ rings and SQE array
+struct uring {
+    int fd;
+    void *ring_map;
+    size_t ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int uring_init(struct uring *u) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(u, 0, sizeof(*u));
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (u->fd < 0) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(u->fd);
+        errno = ENOSYS;     // Pre-5.4 kernel; not worth supporting
+        return -1;
+    }
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    u->ring_map = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       u->fd, IORING_OFF_SQ_RING);
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->ring_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+        int err = errno;
+        if (u->ring_map != MAP_FAILED) {
+            munmap(u->ring_map, u->ring_len);
+        }
+        if (u->sqes != MAP_FAILED) {
+            munmap(u->sqes, u->sqes_len);
+        }
+        close(u->fd);
+        errno = err;
+        return -1;
+    }
+    char *ring = u->ring_map;
+    u->sq_head = (unsigned *)(ring + params.sq_off.head);
+    u->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+    u->sq_mask = (unsigned *)(ring + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(ring + params.sq_off.array);
+    u->cq_head = (unsigned *)(ring + params.cq_off.head);
+    u->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+    u->cq_mask = (unsigned *)(ring + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_exit(struct uring *u) {
+    munmap(u->sqes, u->sqes_len);
+    munmap(u->ring_map, u->ring_len);
+    close(u->fd);
+}
+
+// Next free SQE, zeroed; the caller fills it and calls uring_enter()
+static struct io_uring_sqe *uring_sqe(struct uring *u) {
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head > *u->sq_mask) {
+        return NULL;
+    }
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// Submit to_submit SQEs and/or wait for wait_nr completions
+static int uring_enter(struct uring *u, unsigned to_submit, unsigned wait_nr) {
+    while (1) {
+        STAT_ADD(STAT_SYSCALLS, 1);
+        int rc = (int)syscall(__NR_io_uring_enter, u->fd, to_submit, wait_nr,
+                              wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0 || errno != EINTR) {
+            return rc < 0 ? -1 : 0;
+        }
+        to_submit = 0;  // An interrupted enter has still consumed the SQEs
+    }
+}
+
+static struct io_uring_cqe *uring_peek(struct uring *u) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &u->cqes[head & *u->cq_mask];
+}
+
+static void uring_seen(struct uring *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#define CANCEL_TAG 1
+
+// Cancel the outstanding requests and wait until all of them are gone, so
+// the kernel is done with our buffers before they are freed
+static void uring_cancel(struct uring *u, int outstanding) {
+    struct io_uring_sqe *sqe = outstanding > 0 ? uring_sqe(u) : NULL;
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = CANCEL_TAG;
+    int cancel_pending = 1;
+    if (uring_enter(u, 1, 0) < 0) {
+        return;
+    }
+    while (outstanding > 0 || cancel_pending) {
+        struct io_uring_cqe *cqe = uring_peek(u);
+        if (!cqe) {
+            if (uring_enter(u, 0, 1) < 0) {
+                return;
+            }
+            continue;
+        }
+        if (cqe->user_data == CANCEL_TAG) {
+            cancel_pending = 0;
+        } else if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            outstanding--;
+        }
+        uring_seen(u);
+    }
+}
+
+// ---- Sender ----
+
+struct uring_sender {
+    struct uring u;
+    int fd;
+    char *stage;
+    size_t head;        // first byte not yet sent
+    size_t tail;        // end of queued bytes
+    size_t inflight;    // bytes covered by the running SEND, 0 if none
+    int error;          // errno of a failed SEND; sticky
+};
+
+// Start a SEND for the queued bytes up to the staging ring's wrap point
+static int sender_kick(struct uring_sender *s) {
+    size_t off = s->head & (SEND_STAGE_BYTES - 1);
+    size_t len = s->tail - s->head;
+    if (len > SEND_STAGE_BYTES - off) {
+        len = SEND_STAGE_BYTES - off;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(&s->u);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->fd;
+    sqe->addr = (unsigned long)(s->stage + off);
+    sqe->len = (unsigned)len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    s->inflight = len;
+    return uring_enter(&s->u, 1, 0);
+}
+
+// Retire finished SENDs, waiting for one if wait is set, and keep the
+// queue moving
+static int sender_reap(struct uring_sender *s, int wait) {
+    struct io_uring_cqe *cqe = uring_peek(&s->u);
+    if (!cqe && wait && s->inflight > 0) {
+        if (uring_enter(&s->u, 0, 1) < 0) {
+            return -1;
+        }
+        cqe = uring_peek(&s->u);
+    }
+    while (cqe) {
+        if (cqe->res < 0) {
+            s->error = -cqe->res;
+        } else {
+            s->head += (size_t)cqe->res;   // A short send resumes from here
+        }
+        s->inflight = 0;
+        uring_seen(&s->u);
+        cqe = uring_peek(&s->u);
+    }
+    if (s->error) {
+        errno = s->error;
+        return -1;
+    }
+    if (s->inflight == 0 && s->head != s->tail) {
+        return sender_kick(s);
+    }
+    return 0;
+}
+
+struct uring_sender *uring_sender_new(int fd) {
+    struct uring_sender *s = calloc(1, sizeof(*s));
+    if (!s || !(s->stage = malloc(SEND_STAGE_BYTES))) {
+        free(s);
+        return NULL;
+    }
+    if (uring_init(&s->u) < 0) {
+        free(s->stage);
+        free(s);
+        return NULL;
+    }
+    s->fd = fd;
+    return s;
+}
+
+int uring_sender_send(struct uring_sender *s, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        size_t room = SEND_STAGE_BYTES - (s->tail - s->head);
+        if (sender_reap(s, room == 0) < 0) {
+            return -1;
+        }
+        room = SEND_STAGE_BYTES - (s->tail - s->head);
+        size_t n = len < room ? len : room;
+        size_t off = s->tail & (SEND_STAGE_BYTES - 1);
+        size_t first = SEND_STAGE_BYTES - off < n ? SEND_STAGE_BYTES - off : n;
+        memcpy(s->stage + off, p, first);
+        memcpy(s->stage, p + first, n - first);
+        s->tail += n;
+        p += n;
+        len -= n;
+    }
+    return sender_reap(s, 0);
+}
+
+int uring_sender_flush(struct uring_sender *s) {
+    while (s->head != s->tail) {
+        if (sender_reap(s, 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void uring_sender_free(struct uring_sender *s) {
+    if (!s) {
+        return;
+    }
+    uring_cancel(&s->u, s->inflight > 0);
+    uring_exit(&s->u);
+    free(s->stage);
+    free(s);
+}
+
+// ---- Receiver ----
+
+struct uring_receiver {
+    struct uring u;
+    int fd;
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    char *bufs;
+    unsigned short br_tail;
+    int armed;          // multishot RECV outstanding
+    int cur;            // buffer being drained, -1 if none
+    const char *pos;
+    size_t left;
+    int eof;
+    int error;
+};
+
+static void receiver_give(struct uring_receiver *r, int bid) {
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (RECV_BUFS - 1)];
+    b->addr = (unsigned long)(r->bufs + (size_t)bid * RECV_BUF_BYTES);
+    b->len = RECV_BUF_BYTES;
+    b->bid = (unsigned short)bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static int receiver_arm(struct uring_receiver *r) {
+    struct io_uring_sqe *sqe = uring_sqe(&r->u);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = r->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BGID;
+    r->armed = 1;
+    return uring_enter(&r->u, 1, 0);
+}
+
+struct uring_receiver *uring_receiver_new(int fd) {
+    struct uring_receiver *r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->fd = fd;
+    r->cur = -1;
+    r->br_len = RECV_BUFS * sizeof(struct io_uring_buf);
+    r->br = mmap(NULL, r->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->bufs = malloc((size_t)RECV_BUFS * RECV_BUF_BYTES);
+    if (r->br == MAP_FAILED || !r->bufs || uring_init(&r->u) < 0) {
+        goto fail;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)r->br;
+    reg.ring_entries = RECV_BUFS;
+    reg.bgid = RECV_BGID;
+    if (syscall(__NR_io_uring_register, r->u.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_exit(&r->u);
+        goto fail;
+    }
+    for (int i = 0; i < RECV_BUFS; i++) {
+        receiver_give(r, i);
+    }
+    return r;
+
+fail:
+    if (r->br != MAP_FAILED) {
+        munmap(r->br, r->br_len);
+    }
+    free(r->bufs);
+    free(r);
+    return NULL;
+}
+
+// Take the next completion, waiting for one; returns 0 or -1 on error
+static int receiver_next(struct uring_receiver *r) {
+    if (!r->armed && receiver_arm(r) < 0) {
+        return -1;
+    }
+    struct io_uring_cqe *cqe = uring_peek(&r->u);
+    if (!cqe) {
+        if (uring_enter(&r->u, 0, 1) < 0) {
+            return -1;
+        }
+        return 0;   // Look again on the next round
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        r->armed = 0;   // Multishot ended; rearm unless this is EOF or an error
+    }
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        r->cur = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        r->pos = r->bufs + (size_t)r->cur * RECV_BUF_BYTES;
+        r->left = (size_t)cqe->res;
+    } else if (cqe->res == 0) {
+        r->eof = 1;
+    } else if (cqe->res != -ENOBUFS) {
+        // ENOBUFS only means we were slow to hand buffers back
+        r->error = cqe->res < 0 ? -cqe->res : EIO;
+    }
+    uring_seen(&r->u);
+    return 0;
+}
+
+ssize_t uring_receiver_recv(struct uring_receiver *r, void *buf, size_t len) {
+    char *p = buf;
+    size_t got = 0;
+    while (got < len) {
+        if (r->left > 0) {
+            size_t n = len - got < r->left ? len - got : r->left;
+            memcpy(p + got, r->pos, n);
+            r->pos += n;
+            r->left -= n;
+            got += n;
+            if (r->left == 0) {
+                receiver_give(r, r->cur);
+                r->cur = -1;
+            }
+            continue;
+        }
+        if (r->eof) {
+            break;
+        }
+        if (r->error || receiver_next(r) < 0) {
+            if (!r->error) {
+                r->error = errno;
+            }
+            if (got == 0) {
+                errno = r->error;
+                return -1;
+            }
+            break;
+        }
+    }
+    return (ssize_t)got;
+}
+
+void uring_receiver_free(struct uring_receiver *r) {
+    if (!r) {
+        return;
+    }
+    uring_cancel(&r->u, r->armed);
+    uring_exit(&r->u);
+    munmap(r->br, r->br_len);
+    free(r->bufs);
+    free(r);
+}
+
+#else // !HAVE_IO_URING
+
+struct uring_sender *uring_sender_new(int fd) {
+    (void)fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+struct uring_receiver *uring_receiver_new(int fd) {
+    (void)fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+int uring_sender_send(struct uring_sender *s, const void *buf, size_t len) {
+    (void)s;
+    (void)buf;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_sender_flush(struct uring_sender *s) {
+    (void)s;
+    return 0;
+}
+
+void uring_sender_free(struct uring_sender *s) {
+    (void)s;
+}
+
+ssize_t uring_receiver_recv(struct uring_receiver *r, void *buf, size_t len) {
+    (void)r;
+    (void)buf;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_receiver_free(struct uring_receiver *r) {
+    (void)r;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,51 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Optional io_uring I/O engine for stream sockets, driven with raw
+ * syscalls (no liburing needed). Built on Linux when the kernel headers
+ * have <linux/io_uring.h>, unless NO_IO_URING is defined; everywhere else
+ * the constructors return NULL and callers keep the blocking path.
+ *
+ * Sender: send() calls copy into a staging ring and return; one SEND is
+ * kept in flight at a time, and while it runs later data piles up behind
+ * it, so the next SEND covers all of it. Completions are reaped from the
+ * shared CQ without syscalls. Data only moves while the sender is being
+ * called, so callers flush before going quiet or closing.
+ *
+ * Receiver: a single multishot RECV stays armed on the socket and the kernel
+ * fills buffers from a registered provided-buffer ring as data arrives;
+ * recv() copies out of completed buffers and only enters the kernel when
+ * none are waiting.
+ */
+
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+struct uring_sender;
+struct uring_receiver;
+
+// NULL if io_uring is unavailable (not built in, or refused by the kernel)
+struct uring_sender *uring_sender_new(int fd);
+struct uring_receiver *uring_receiver_new(int fd);
+
+// Queue the whole buffer; returns 0, or -1 with errno from a failed send
+int uring_sender_send(struct uring_sender *s, const void *buf, size_t len);
+
+// Wait until everything queued has been sent; returns 0 or -1
+int uring_sender_flush(struct uring_sender *s);
+
+void uring_sender_free(struct uring_sender *s);
+
+// Same contract as recv_all(): len, 0 on EOF, -1 on error or a short count
+ssize_t uring_receiver_recv(struct uring_receiver *r, void *buf, size_t len);
+
+void uring_receiver_free(struct uring_receiver *r);
+
+#endif // URING_H
@@ -0,0 +1,73 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+#include <inttypes.h>
+
+/*
+ * The element type, fixed at build time: make WIDTH=16|32|64 (default
+ * 32) builds everything with -DVALUE_BITS=N. Values are value_t
+ * (unsigned, so arithmetic wraps) and read as svalue_t, its two's
+ * complement signed twin, wherever they are printed or compared; text
+ * input wraps modulo 2^VALUE_BITS like the old (uint32_t)int cast.
+ *
+ * The width is part of the wire format (hello.value_bits) and of the
+ * --persist header (value_size), so programs built for different widths
+ * refuse each other's connections and files instead of misreading them.
+ * Every per-value loop is compiled for the one width, with no run-time
+ * switch: SIMD paths exist where the lanes differ (codec.c), and the
+ * Stream VByte codec, whose 1-4 byte lengths are inherently 32-bit, is
+ * only built for WIDTH=32.
+ */
+
+#ifndef VALUE_BITS
+#define VALUE_BITS 32
+#endif
+
+#if VALUE_BITS == 16
+typedef uint16_t value_t;
+typedef int16_t svalue_t;
+#define SVALUE_MIN INT16_MIN
+#define SVALUE_MAX INT16_MAX
+#define PRIdVALUE PRId16
+#define VALUE_DIGITS 6          // "-32768"
+#elif VALUE_BITS == 32
+typedef uint32_t value_t;
+typedef int32_t svalue_t;
+#define SVALUE_MIN INT32_MIN
+#define SVALUE_MAX INT32_MAX
+#define PRIdVALUE PRId32
+#define VALUE_DIGITS 11         // "-2147483648"
+#elif VALUE_BITS == 64
+typedef uint64_t value_t;
+typedef int64_t svalue_t;
+#define SVALUE_MIN INT64_MIN
+#define SVALUE_MAX INT64_MAX
+#define PRIdVALUE PRId64
+#define VALUE_DIGITS 20         // "-9223372036854775808"
+#else
+#error "VALUE_BITS must be 16, 32 or 64"
+#endif
+
+#define VALUE_BYTES (VALUE_BITS / 8)
+
+// Host order to network order and back
+static inline value_t value_hton(value_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if VALUE_BITS == 16
+    return __builtin_bswap16(v);
+#elif VALUE_BITS == 32
+    return __builtin_bswap32(v);
+#else
+    return __builtin_bswap64(v);
+#endif
+#else
+    return v;
+#endif
+}
+
+static inline value_t value_ntoh(value_t v) {
+    return value_hton(v);
+}
+
+#endif // VALUE_H